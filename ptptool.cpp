@@ -49,6 +49,8 @@
 #include <vector>
 #include <map>
 
+#include "src/phc_device.h"
+
 struct Msg {
   uint64_t ptpNow;
   char name[64];
@@ -58,21 +60,6 @@ std::map<std::string, Msg> data;
 
 evutil_socket_t sendSocket;
 
-#ifndef ADJ_SETOFFSET
-#define ADJ_SETOFFSET 0x0100
-#endif
-
-#ifndef CLOCK_INVALID
-#define CLOCK_INVALID -1
-#endif
-
-static clockid_t get_clockid(int fd) {
-#define CLOCKFD 3
-#define FD_TO_CLOCKID(fd) ((~(clockid_t)(fd) << 3) | CLOCKFD)
-
-  return FD_TO_CLOCKID(fd);
-}
-
 static void handle_alarm(int s) { printf("received signal %d\n", s); }
 
 static int install_handler(int signum, void (*handler)(int)) {
@@ -93,25 +80,6 @@ static int install_handler(int signum, void (*handler)(int)) {
   return 0;
 }
 
-static long ppb_to_scaled_ppm(int ppb) {
-  /*
-   * The 'freq' field in the 'struct timex' is in parts per
-   * million, but with a 16 bit binary fractional field.
-   * Instead of calculating either one of
-   *
-   *    scaled_ppm = (ppb / 1000) << 16  [1]
-   *    scaled_ppm = (ppb << 16) / 1000  [2]
-   *
-   * we simply use double precision math, in order to avoid the
-   * truncation in [1] and the possible overflow in [2].
-   */
-  return (long)(ppb * 65.536);
-}
-
-static int64_t pctns(struct ptp_clock_time *t) {
-  return t->sec * 1000000000LL + t->nsec;
-}
-
 int optArgToInt() {
   try {
     return std::stoi(optarg);
@@ -121,12 +89,6 @@ int optArgToInt() {
   }
 }
 
-std::string getPHCFileName(int phc_index) {
-  std::stringstream s;
-  s << "/dev/ptp" << phc_index;
-  return s.str();
-}
-
 static void usage(char *progname) {
   fprintf(stderr,
           "usage: %s [options]\n"
@@ -162,11 +124,10 @@ static void usage(char *progname) {
 int main(int argc, char *argv[]) {
   struct ptp_clock_caps caps;
   struct ptp_extts_event event;
-  struct ptp_extts_request extts_request;
   struct ptp_perout_request perout_request;
   struct ptp_pin_desc desc;
   struct timespec ts;
-  struct timex tx;
+  PhcDevice phc;
 
   static timer_t timerid;
   struct itimerspec timeout;
@@ -180,7 +141,7 @@ int main(int argc, char *argv[]) {
   char *hostname = nullptr;
 
   unsigned int i;
-  int c, cnt, fd;
+  int c, cnt, err;
 
   int device = -1;
   clockid_t clkid;
@@ -345,21 +306,16 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  fd = open(getPHCFileName(device).c_str(), O_RDWR);
-  if (fd < 0) {
-    fprintf(stderr, "opening /dev/ptp%d: %s\n", device, strerror(errno));
-    return -1;
-  }
-
-  clkid = get_clockid(fd);
-  if (CLOCK_INVALID == clkid) {
-    fprintf(stderr, "failed to read clock id\n");
+  err = phc.open(device);
+  if (err) {
+    fprintf(stderr, "opening /dev/ptp%d: %s\n", device, strerror(-err));
     return -1;
   }
+  clkid = phc.clockId();
 
   if (capabilities) {
-    if (ioctl(fd, PTP_CLOCK_GETCAPS, &caps)) {
-      perror("PTP_CLOCK_GETCAPS");
+    if ((err = phc.getCaps(&caps))) {
+      fprintf(stderr, "PTP_CLOCK_GETCAPS: %s\n", strerror(-err));
     } else {
       printf(
           "/dev/ptp%d\n"
@@ -377,31 +333,24 @@ int main(int argc, char *argv[]) {
   }
 
   if (0x7fffffff != adjfreq) {
-    memset(&tx, 0, sizeof(tx));
-    tx.modes = ADJ_FREQUENCY;
-    tx.freq = ppb_to_scaled_ppm(adjfreq);
-    if (clock_adjtime(clkid, &tx)) {
-      perror("clock_adjtime");
+    if ((err = phc.adjustFrequency(adjfreq))) {
+      fprintf(stderr, "clock_adjtime: %s\n", strerror(-err));
     } else {
       puts("frequency adjustment okay");
     }
   }
 
   if (adjtime) {
-    memset(&tx, 0, sizeof(tx));
-    tx.modes = ADJ_SETOFFSET;
-    tx.time.tv_sec = adjtime;
-    tx.time.tv_usec = 0;
-    if (clock_adjtime(clkid, &tx) < 0) {
-      perror("clock_adjtime");
+    if ((err = phc.adjustTime(adjtime * 1000000000LL))) {
+      fprintf(stderr, "clock_adjtime: %s\n", strerror(-err));
     } else {
       puts("time shift okay");
     }
   }
 
   if (gettime) {
-    if (clock_gettime(clkid, &ts)) {
-      perror("clock_gettime");
+    if ((err = phc.getTime(&ts))) {
+      fprintf(stderr, "clock_gettime: %s\n", strerror(-err));
     } else {
       printf("clock time: %ld.%09ld or %s", ts.tv_sec, ts.tv_nsec,
              ctime(&ts.tv_sec));
@@ -410,15 +359,15 @@ int main(int argc, char *argv[]) {
 
   if (settime == 1) {
     clock_gettime(CLOCK_REALTIME, &ts);
-    if (clock_settime(clkid, &ts)) {
-      perror("clock_settime");
+    if ((err = phc.setTime(&ts))) {
+      fprintf(stderr, "clock_settime: %s\n", strerror(-err));
     } else {
       puts("set time okay");
     }
   }
 
   if (settime == 2) {
-    clock_gettime(clkid, &ts);
+    phc.getTime(&ts);
     if (clock_settime(CLOCK_REALTIME, &ts)) {
       perror("clock_settime");
     } else {
@@ -429,8 +378,8 @@ int main(int argc, char *argv[]) {
   if (settime == 3) {
     ts.tv_sec = seconds;
     ts.tv_nsec = 0;
-    if (clock_settime(clkid, &ts)) {
-      perror("clock_settime");
+    if ((err = phc.setTime(&ts))) {
+      fprintf(stderr, "clock_settime: %s\n", strerror(-err));
     } else {
       puts("set time okay");
     }
@@ -462,19 +411,16 @@ int main(int argc, char *argv[]) {
   }
 
   if (extts) {
-    memset(&extts_request, 0, sizeof(extts_request));
-    extts_request.index = index;
-    extts_request.flags = PTP_ENABLE_FEATURE;
-    if (ioctl(fd, PTP_EXTTS_REQUEST, &extts_request)) {
-      perror("PTP_EXTTS_REQUEST");
+    if ((err = phc.enableExtts(index, 0))) {
+      fprintf(stderr, "PTP_EXTTS_REQUEST: %s\n", strerror(-err));
       extts = 0;
     } else {
       puts("external time stamp request okay");
     }
     for (; extts; extts--) {
-      cnt = read(fd, &event, sizeof(event));
-      if (cnt != sizeof(event)) {
-        perror("read");
+      cnt = phc.readExtts(&event, 1);
+      if (cnt != 1) {
+        fprintf(stderr, "read: %s\n", strerror(cnt < 0 ? -cnt : EIO));
         break;
       }
       printf("event index %u at %lld.%09u\n", event.index, event.t.sec,
@@ -490,23 +436,23 @@ int main(int argc, char *argv[]) {
       fflush(stdout);
     }
     /* Disable the feature again. */
-    extts_request.flags = 0;
-    if (ioctl(fd, PTP_EXTTS_REQUEST, &extts_request)) {
-      perror("PTP_EXTTS_REQUEST");
+    if ((err = phc.disableExtts(index))) {
+      fprintf(stderr, "PTP_EXTTS_REQUEST: %s\n", strerror(-err));
     }
   }
 
   if (list_pins) {
     int n_pins = 0;
-    if (ioctl(fd, PTP_CLOCK_GETCAPS, &caps)) {
-      perror("PTP_CLOCK_GETCAPS");
+    if ((err = phc.getCaps(&caps))) {
+      fprintf(stderr, "PTP_CLOCK_GETCAPS: %s\n", strerror(-err));
     } else {
       n_pins = caps.n_pins;
     }
     for (int i = 0; i < n_pins; i++) {
+      memset(&desc, 0, sizeof(desc));
       desc.index = i;
-      if (ioctl(fd, PTP_PIN_GETFUNC, &desc)) {
-        perror("PTP_PIN_GETFUNC");
+      if ((err = phc.getPin(&desc))) {
+        fprintf(stderr, "PTP_PIN_GETFUNC: %s\n", strerror(-err));
         break;
       }
       printf("name %s index %u func %u chan %u\n", desc.name, desc.index,
@@ -558,8 +504,8 @@ int main(int argc, char *argv[]) {
   }
 
   if (perout >= 0) {
-    if (clock_gettime(clkid, &ts)) {
-      perror("clock_gettime");
+    if ((err = phc.getTime(&ts))) {
+      fprintf(stderr, "clock_gettime: %s\n", strerror(-err));
       return -1;
     }
     memset(&perout_request, 0, sizeof(perout_request));
@@ -568,29 +514,24 @@ int main(int argc, char *argv[]) {
     perout_request.start.nsec = 0;
     perout_request.period.sec = 0;
     perout_request.period.nsec = perout;
-    if (ioctl(fd, PTP_PEROUT_REQUEST, &perout_request)) {
-      perror("PTP_PEROUT_REQUEST");
+    if ((err = phc.setPerout(&perout_request))) {
+      fprintf(stderr, "PTP_PEROUT_REQUEST: %s\n", strerror(-err));
     } else {
       puts("periodic output request okay");
     }
   }
 
   if (pin_index >= 0) {
-    memset(&desc, 0, sizeof(desc));
-    desc.index = pin_index;
-    desc.func = pin_func;
-    desc.chan = index;
-    if (ioctl(fd, PTP_PIN_SETFUNC, &desc)) {
-      perror("PTP_PIN_SETFUNC");
+    if ((err = phc.setPin(pin_index, pin_func, index))) {
+      fprintf(stderr, "PTP_PIN_SETFUNC: %s\n", strerror(-err));
     } else {
       puts("set pin function okay");
     }
   }
 
   if (pps != -1) {
-    int enable = pps ? 1 : 0;
-    if (ioctl(fd, PTP_ENABLE_PPS, enable)) {
-      perror("PTP_ENABLE_PPS");
+    if ((err = phc.enablePps(pps != 0))) {
+      fprintf(stderr, "PTP_ENABLE_PPS: %s\n", strerror(-err));
     } else {
       puts("pps for system time request okay");
     }
@@ -606,16 +547,16 @@ int main(int argc, char *argv[]) {
     ptp_sys_offset sysoff = {};
     sysoff.n_samples = n_samples;
 
-    if (ioctl(fd, PTP_SYS_OFFSET, &sysoff))
-      perror("PTP_SYS_OFFSET");
+    if ((err = phc.sysOffset(&sysoff)))
+      fprintf(stderr, "PTP_SYS_OFFSET: %s\n", strerror(-err));
     else
       puts("system and phc clock time offset request okay");
 
     pct = &sysoff.ts[0];
     for (i = 0; i < sysoff.n_samples; i++) {
-      t1 = pctns(pct + 2 * i);
-      tp = pctns(pct + 2 * i + 1);
-      t2 = pctns(pct + 2 * i + 2);
+      t1 = PhcDevice::toNs(pct + 2 * i);
+      tp = PhcDevice::toNs(pct + 2 * i + 1);
+      t2 = PhcDevice::toNs(pct + 2 * i + 2);
       interval = t2 - t1;
       offset = (t2 + t1) / 2 - tp;
 
@@ -631,6 +572,6 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  close(fd);
+  phc.close();
   return 0;
 }
@@ -0,0 +1,172 @@
+/*
+ * ShiwaPTPTool - Declarative device configuration
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "device_config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/ptp_clock.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *PIN_FUNCTIONS[] = {"none", "extts", "perout", "phys"};
+
+const char *DeviceConfig::pinFunctionName(unsigned int func) {
+    return func < sizeof(PIN_FUNCTIONS) / sizeof(PIN_FUNCTIONS[0]) ? PIN_FUNCTIONS[func] : "?";
+}
+
+// Whole-token integer conversions; false on trailing garbage.
+static bool toInt64(const char *s, int64_t *out) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 0);
+    if (!*s || *end || errno) {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+static bool toIndex(const char *s, unsigned int limit, unsigned int *out) {
+    int64_t v;
+    if (!toInt64(s, &v) || v < 0 || v >= limit) {
+        return false;
+    }
+    *out = (unsigned int)v;
+    return true;
+}
+
+bool DeviceConfig::load(const char *path) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        return false;
+    }
+
+    char line[512];
+    int lineNo = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), in)) {
+        lineNo++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        char *args[5];
+        int n = 0;
+        char *save = nullptr;
+        for (char *tok = strtok_r(line, " \t", &save); tok && n < 5;
+             tok = strtok_r(nullptr, " \t", &save)) {
+            args[n++] = tok;
+        }
+        if (!n) {
+            continue;
+        }
+
+        const char *error = nullptr;
+        if (!strcmp(args[0], "freq")) {
+            char *end = nullptr;
+            freq = n == 2 ? strtod(args[1], &end) : 0;
+            if (n != 2 || *end) {
+                error = "expected 'freq <ppb>'";
+            }
+            hasFreq = true;
+        } else if (!strcmp(args[0], "pin")) {
+            unsigned int index, func = 0, chan = 0;
+            if (n < 3 || n > 4 || !toIndex(args[1], MAX_PINS, &index)) {
+                error = "expected 'pin <index> <function> [channel]'";
+            } else {
+                while (func < 4 && strcmp(args[2], PIN_FUNCTIONS[func])) {
+                    func++;
+                }
+                if (func == 4) {
+                    error = "pin function must be none, extts, perout or phys";
+                } else if (n == 4 ? !toIndex(args[3], MAX_CHANNELS, &chan)
+                                  : func != PTP_PF_NONE) {
+                    error = "invalid or missing pin channel";
+                } else {
+                    pins[index].set = true;
+                    pins[index].func = func;
+                    pins[index].chan = chan;
+                }
+            }
+        } else if (!strcmp(args[0], "perout")) {
+            unsigned int chan;
+            Perout p;
+            p.set = true;
+            if (n < 3 || n > 4 || !toIndex(args[1], MAX_CHANNELS, &chan)) {
+                error = "expected 'perout <channel> <period> [phase]' or 'perout <channel> off'";
+            } else if (!strcmp(args[2], "off") && n == 3) {
+                perout[chan] = p;
+            } else if (!toInt64(args[2], &p.period) || p.period <= 0 ||
+                       (n == 4 && (!toInt64(args[3], &p.phase) || p.phase < 0 ||
+                                   p.phase >= p.period))) {
+                error = "period must be positive and phase within the period (ns)";
+            } else {
+                perout[chan] = p;
+            }
+        } else if (!strcmp(args[0], "pps")) {
+            if (n == 2 && !strcmp(args[1], "on")) {
+                pps = 1;
+            } else if (n == 2 && !strcmp(args[1], "off")) {
+                pps = 0;
+            } else {
+                error = "expected 'pps on' or 'pps off'";
+            }
+        } else {
+            error = "unknown item";
+        }
+
+        if (error) {
+            fprintf(stderr, "%s:%d: %s\n", path, lineNo, error);
+            ok = false;
+        }
+    }
+    if (ok && ferror(in)) {
+        perror(path);
+        ok = false;
+    }
+    fclose(in);
+    return ok;
+}
+
+int DeviceConfig::saveState(const char *path) const {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *out = fopen(tmp, "w");
+    if (!out) {
+        return -errno;
+    }
+    fputs("# last applied by shiwaptptool-cli --apply\n", out);
+    for (unsigned int i = 0; i < MAX_CHANNELS; i++) {
+        if (!perout[i].set) {
+            continue;
+        }
+        if (perout[i].period) {
+            fprintf(out, "perout %u %" PRId64 " %" PRId64 "\n", i, perout[i].period,
+                    perout[i].phase);
+        } else {
+            fprintf(out, "perout %u off\n", i);
+        }
+    }
+    if (pps >= 0) {
+        fprintf(out, "pps %s\n", pps ? "on" : "off");
+    }
+    int err = ferror(out) ? -EIO : 0;
+    if (fclose(out) && !err) {
+        err = -errno;
+    }
+    if (!err && rename(tmp, path)) {
+        err = -errno;
+    }
+    if (err) {
+        unlink(tmp);
+    }
+    return err;
+}
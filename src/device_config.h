@@ -0,0 +1,67 @@
+/*
+ * ShiwaPTPTool - Declarative device configuration
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_DEVICE_CONFIG_H
+#define SHIWA_DEVICE_CONFIG_H
+
+#include <stdint.h>
+
+// Desired state of one PHC. Only the items present in the file are
+// managed; everything else is left as it is. One item per line:
+//
+//   # comment
+//   freq -120.5              frequency adjustment (ppb)
+//   pin 0 extts 1            pin index, function (none, extts, perout,
+//   pin 1 perout 0           phys) and channel
+//   perout 0 1000000000 0    period and phase (ns) of an output channel
+//   perout 1 off
+//   pps on                   system clock PPS (on or off)
+//
+// The kernel reports pins and the frequency but not the periodic outputs
+// or PPS, so the last applied values of those are kept in a state file of
+// the same format.
+struct DeviceConfig {
+    static const unsigned int MAX_PINS = 64;
+    static const unsigned int MAX_CHANNELS = 32;
+
+    struct Pin {
+        bool set = false;
+        unsigned int func = 0;
+        unsigned int chan = 0;
+    };
+
+    struct Perout {
+        bool set = false;
+        int64_t period = 0;     // ns, 0 = off
+        int64_t phase = 0;      // ns, edges at phase + k * period
+
+        bool operator==(const Perout &o) const {
+            return set == o.set && period == o.period && (!period || phase == o.phase);
+        }
+        bool operator!=(const Perout &o) const { return !(*this == o); }
+    };
+
+    bool hasFreq = false;
+    double freq = 0;
+    Pin pins[MAX_PINS];
+    Perout perout[MAX_CHANNELS];
+    int pps = -1;               // -1 = not managed
+
+    // Returns false and names the file and line on stderr.
+    bool load(const char *path);
+
+    // Writes the periodic output and PPS items atomically. Returns 0 or
+    // a negative errno.
+    int saveState(const char *path) const;
+
+    static const char *pinFunctionName(unsigned int func);
+};
+
+#endif // SHIWA_DEVICE_CONFIG_H
@@ -0,0 +1,147 @@
+/*
+ * ShiwaPTPTool - Single-thread epoll event loop
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "event_loop.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+// Upper bound on descriptors dispatched per wakeup.
+static const int MAX_EVENTS = 64;
+
+EventLoop::EventLoop() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    sigemptyset(&sigmask);
+}
+
+EventLoop::~EventLoop() {
+    for (int tfd : timers) {
+        close(tfd);
+    }
+    if (sigfd >= 0) {
+        close(sigfd);
+        sigprocmask(SIG_UNBLOCK, &sigmask, nullptr);
+    }
+    if (epfd >= 0) {
+        close(epfd);
+    }
+}
+
+int EventLoop::add(int fd, uint32_t events, Handler handler) {
+    if (entries.count(fd)) {
+        return -EEXIST;
+    }
+    std::unique_ptr<Entry> entry(new Entry{fd, std::move(handler), false});
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.ptr = entry.get();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        return -errno;
+    }
+    entries[fd] = std::move(entry);
+    return 0;
+}
+
+int EventLoop::remove(int fd) {
+    auto it = entries.find(fd);
+    if (it == entries.end()) {
+        return -ENOENT;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    // Events for this entry may still be pending in the current batch, so
+    // it is only freed after the batch is dispatched.
+    it->second->removed = true;
+    graveyard.push_back(std::move(it->second));
+    entries.erase(it);
+    return 0;
+}
+
+int EventLoop::addSignals(std::initializer_list<int> signals, std::function<void(int)> handler) {
+    if (sigfd >= 0) {
+        return -EBUSY;
+    }
+    for (int s : signals) {
+        sigaddset(&sigmask, s);
+    }
+    sigprocmask(SIG_BLOCK, &sigmask, nullptr);
+    sigfd = signalfd(-1, &sigmask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sigfd < 0) {
+        int err = -errno;
+        sigprocmask(SIG_UNBLOCK, &sigmask, nullptr);
+        return err;
+    }
+    int fd = sigfd;
+    return add(sigfd, EPOLLIN, [fd, handler](uint32_t) {
+        struct signalfd_siginfo info;
+        while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+            handler((int)info.ssi_signo);
+        }
+    });
+}
+
+int EventLoop::addTimer(clockid_t clock, std::function<void(uint64_t)> handler) {
+    int tfd = timerfd_create(clock, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (tfd < 0) {
+        return -errno;
+    }
+    int err = add(tfd, EPOLLIN, [tfd, handler](uint32_t) {
+        uint64_t expirations;
+        if (read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            handler(expirations);
+        }
+    });
+    if (err) {
+        close(tfd);
+        return err;
+    }
+    timers.push_back(tfd);
+    return tfd;
+}
+
+int EventLoop::removeTimer(int tfd) {
+    auto it = std::find(timers.begin(), timers.end(), tfd);
+    if (it == timers.end()) {
+        return -ENOENT;
+    }
+    remove(tfd);
+    close(tfd);
+    timers.erase(it);
+    return 0;
+}
+
+int EventLoop::run(int timeout_ms) {
+    stopping = false;
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopping) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (n == 0) {
+            return -ETIMEDOUT;
+        }
+        for (int i = 0; i < n; i++) {
+            Entry *entry = (Entry *)events[i].data.ptr;
+            if (!entry->removed) {
+                entry->handler(events[i].events);
+            }
+        }
+        graveyard.clear();
+    }
+    return 0;
+}
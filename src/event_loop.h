@@ -0,0 +1,77 @@
+/*
+ * ShiwaPTPTool - Single-thread epoll event loop
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_EVENT_LOOP_H
+#define SHIWA_EVENT_LOOP_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Level-triggered epoll loop for one thread. PHC descriptors, sockets,
+// timers and signals are all plain descriptors here, so a single thread
+// can serve every device on the host and still stop promptly: stop() takes
+// effect after the handlers of the current wakeup return.
+//
+// Handlers must not block. Descriptors added with add() are not owned;
+// timers and the signal descriptor are created and closed by the loop.
+class EventLoop {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    bool valid() const { return epfd >= 0; }
+
+    // All return 0 or a negative errno.
+    int add(int fd, uint32_t events, Handler handler);
+    int remove(int fd);
+
+    // Blocks the signals and delivers them through a signalfd.
+    int addSignals(std::initializer_list<int> signals, std::function<void(int)> handler);
+
+    // Timer on 'clock'; the handler receives the expiration count. Returns
+    // the timer descriptor (for rearming with timerfd_settime) or -errno.
+    int addTimer(clockid_t clock, std::function<void(uint64_t)> handler);
+    int removeTimer(int tfd);
+
+    // Dispatches until stop() or until 'timeout_ms' passes without events
+    // (-1 waits forever). Returns 0, -ETIMEDOUT or a negative errno.
+    int run(int timeout_ms = -1);
+    void stop() { stopping = true; }
+    bool stopped() const { return stopping; }
+
+private:
+    struct Entry {
+        int fd;
+        Handler handler;
+        bool removed;
+    };
+
+    int epfd = -1;
+    int sigfd = -1;
+    sigset_t sigmask;
+    bool stopping = false;
+    std::map<int, std::unique_ptr<Entry>> entries;
+    std::vector<std::unique_ptr<Entry>> graveyard;
+    std::vector<int> timers;
+};
+
+#endif // SHIWA_EVENT_LOOP_H
@@ -0,0 +1,246 @@
+/*
+ * ShiwaPTPTool - External timestamp capture files
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "extts_capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+static const size_t HEADER_SIZE = sizeof(ExttsStreamHeader);
+
+static std::string indexPath(const char *path) {
+    return std::string(path) + ".idx";
+}
+
+int ExttsCaptureWriter::open(const char *path, int device, unsigned int indexStride) {
+    close();
+    stride = indexStride ? indexStride : 1;
+    nextIndexSec = INT64_MIN;
+    count = 0;
+
+    dataFd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dataFd < 0) {
+        return -errno;
+    }
+    indexFd = ::open(indexPath(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (indexFd < 0) {
+        int err = -errno;
+        close();
+        return err;
+    }
+
+    int err = grow();
+    if (err) {
+        close();
+        return err;
+    }
+
+    ExttsStreamHeader hdr = {};
+    hdr.magic = EXTTS_STREAM_MAGIC;
+    hdr.version = EXTTS_STREAM_VERSION;
+    hdr.record_size = sizeof(ExttsRecord);
+    hdr.device = device;
+    memcpy(map, &hdr, sizeof(hdr));
+
+    ExttsIndexHeader ih = {};
+    ih.magic = EXTTS_INDEX_MAGIC;
+    ih.version = EXTTS_INDEX_VERSION;
+    ih.entry_size = sizeof(ExttsIndexEntry);
+    ih.stride = stride;
+    if (write(indexFd, &ih, sizeof(ih)) != (ssize_t)sizeof(ih)) {
+        err = errno ? -errno : -EIO;
+        close();
+        return err;
+    }
+    return 0;
+}
+
+// Extends the file by one chunk and maps the new length.
+int ExttsCaptureWriter::grow() {
+    size_t size = capacity + CHUNK_SIZE;
+    if (ftruncate(dataFd, size)) {
+        return -errno;
+    }
+    void *addr = map ? mremap(map, capacity, size, MREMAP_MAYMOVE)
+                     : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, dataFd, 0);
+    if (addr == MAP_FAILED) {
+        return -errno;
+    }
+    map = (char *)addr;
+    capacity = size;
+    return 0;
+}
+
+int ExttsCaptureWriter::append(const ExttsRecord &rec) {
+    size_t offset = HEADER_SIZE + count * sizeof(rec);
+    if (offset + sizeof(rec) > capacity) {
+        int err = grow();
+        if (err) {
+            return err;
+        }
+    }
+
+    if (rec.sec >= nextIndexSec) {
+        ExttsIndexEntry entry = {rec.sec, count};
+        if (write(indexFd, &entry, sizeof(entry)) != (ssize_t)sizeof(entry)) {
+            return errno ? -errno : -EIO;
+        }
+        nextIndexSec = rec.sec + stride;
+    }
+
+    memcpy(map + offset, &rec, sizeof(rec));
+    count++;
+    return 0;
+}
+
+int ExttsCaptureWriter::close() {
+    int err = 0;
+    if (map) {
+        munmap(map, capacity);
+        map = nullptr;
+        if (ftruncate(dataFd, HEADER_SIZE + count * sizeof(ExttsRecord))) {
+            err = -errno;
+        }
+    }
+    capacity = 0;
+    if (dataFd >= 0) {
+        ::close(dataFd);
+        dataFd = -1;
+    }
+    if (indexFd >= 0) {
+        ::close(indexFd);
+        indexFd = -1;
+    }
+    return err;
+}
+
+int ExttsCaptureReader::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int err = -errno;
+        ::close(fd);
+        return err;
+    }
+    if ((size_t)st.st_size < HEADER_SIZE) {
+        ::close(fd);
+        return -EPROTO;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return -err;
+    }
+    data = (const char *)addr;
+    dataSize = st.st_size;
+
+    const ExttsStreamHeader &hdr = header();
+    if (hdr.magic != EXTTS_STREAM_MAGIC || hdr.version != EXTTS_STREAM_VERSION ||
+        hdr.record_size != sizeof(ExttsRecord)) {
+        close();
+        return -EPROTO;
+    }
+    records = (const ExttsRecord *)(data + HEADER_SIZE);
+    count = (dataSize - HEADER_SIZE) / sizeof(ExttsRecord);
+
+    // A writer that did not reach close() leaves the unused part of its
+    // last chunk zero-filled.
+    while (count && !records[count - 1].sec && !records[count - 1].nsec &&
+           !records[count - 1].host_ns) {
+        count--;
+    }
+
+    openIndex(path);
+    return 0;
+}
+
+void ExttsCaptureReader::openIndex(const char *path) {
+    int fd = ::open(indexPath(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(ExttsIndexHeader)) {
+        ::close(fd);
+        return;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return;
+    }
+    const ExttsIndexHeader *ih = (const ExttsIndexHeader *)addr;
+    if (ih->magic != EXTTS_INDEX_MAGIC || ih->version != EXTTS_INDEX_VERSION ||
+        ih->entry_size != sizeof(ExttsIndexEntry)) {
+        munmap(addr, st.st_size);
+        return;
+    }
+    indexMap = (const char *)addr;
+    indexSize = st.st_size;
+    index = (const ExttsIndexEntry *)(indexMap + sizeof(ExttsIndexHeader));
+    entries = (indexSize - sizeof(ExttsIndexHeader)) / sizeof(ExttsIndexEntry);
+    // Entries written after the data was cut short point past the end.
+    while (entries && index[entries - 1].record >= count) {
+        entries--;
+    }
+}
+
+void ExttsCaptureReader::close() {
+    if (data) {
+        munmap((void *)data, dataSize);
+    }
+    if (indexMap) {
+        munmap((void *)indexMap, indexSize);
+    }
+    data = indexMap = nullptr;
+    records = nullptr;
+    index = nullptr;
+    dataSize = indexSize = 0;
+    count = entries = 0;
+}
+
+uint64_t ExttsCaptureReader::seek(int64_t sec) const {
+    uint64_t lo = 0, hi = count;
+    if (index && entries) {
+        // Last entry at or before 'sec' bounds the scan from below, the
+        // next one from above.
+        uint64_t a = 0, b = entries;
+        while (a < b) {
+            uint64_t mid = a + (b - a) / 2;
+            if (index[mid].sec <= sec) {
+                a = mid + 1;
+            } else {
+                b = mid;
+            }
+        }
+        lo = a ? index[a - 1].record : 0;
+        hi = a < entries ? index[a].record : count;
+    }
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (records[mid].sec < sec) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
@@ -0,0 +1,116 @@
+/*
+ * ShiwaPTPTool - External timestamp capture files
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_EXTTS_CAPTURE_H
+#define SHIWA_EXTTS_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "extts_io.h"
+
+#define EXTTS_INDEX_MAGIC 0x49434850u  /* "PHCI" */
+#define EXTTS_INDEX_VERSION 1
+
+// A capture is two files:
+//
+//   <name>      the record stream of extts_io.h (header + ExttsRecord[]),
+//               so --decode reads captures too
+//   <name>.idx  ExttsIndexHeader followed by one ExttsIndexEntry each time
+//               the PTP seconds advance by 'stride' or more
+//
+// The index is sparse and sorted, which makes seeking to a PTP second a
+// binary search over the entries plus a short scan of the data.
+struct ExttsIndexHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint32_t stride;    // PTP seconds between entries
+    uint32_t reserved;
+};
+
+struct ExttsIndexEntry {
+    int64_t sec;        // PTP second of the first record at or after it
+    uint64_t record;    // record number of that event
+};
+
+static_assert(sizeof(ExttsIndexHeader) == 16, "ExttsIndexHeader layout changed");
+static_assert(sizeof(ExttsIndexEntry) == 16, "ExttsIndexEntry layout changed");
+
+// Append-only capture writer. The data file is mapped in large chunks so an
+// event costs a copy into the page cache; the file is cut to its real
+// length on close().
+class ExttsCaptureWriter {
+public:
+    static const size_t CHUNK_SIZE = 16 << 20;
+
+    ExttsCaptureWriter() = default;
+    ~ExttsCaptureWriter() { close(); }
+
+    ExttsCaptureWriter(const ExttsCaptureWriter &) = delete;
+    ExttsCaptureWriter &operator=(const ExttsCaptureWriter &) = delete;
+
+    // Returns 0 or a negative errno.
+    int open(const char *path, int device, unsigned int stride = 1);
+    int close();
+    bool isOpen() const { return map != nullptr; }
+
+    int append(const ExttsRecord &rec);
+    uint64_t records() const { return count; }
+
+private:
+    int dataFd = -1;
+    int indexFd = -1;
+    char *map = nullptr;
+    size_t capacity = 0;
+    uint64_t count = 0;
+    unsigned int stride = 1;
+    int64_t nextIndexSec = INT64_MIN;
+
+    int grow();
+};
+
+// Read-only view of a capture. Records are served straight from the
+// mapping; the index is loaded if present and otherwise seek() bisects the
+// records themselves.
+class ExttsCaptureReader {
+public:
+    ExttsCaptureReader() = default;
+    ~ExttsCaptureReader() { close(); }
+
+    ExttsCaptureReader(const ExttsCaptureReader &) = delete;
+    ExttsCaptureReader &operator=(const ExttsCaptureReader &) = delete;
+
+    int open(const char *path);
+    void close();
+
+    const ExttsStreamHeader &header() const { return *(const ExttsStreamHeader *)data; }
+    uint64_t size() const { return count; }
+    const ExttsRecord &record(uint64_t i) const { return records[i]; }
+    bool indexed() const { return index != nullptr; }
+
+    // Number of the first record with sec >= 'sec' (size() if none).
+    uint64_t seek(int64_t sec) const;
+
+private:
+    const char *data = nullptr;
+    size_t dataSize = 0;
+    const ExttsRecord *records = nullptr;
+    uint64_t count = 0;
+
+    const char *indexMap = nullptr;
+    size_t indexSize = 0;
+    const ExttsIndexEntry *index = nullptr;
+    uint64_t entries = 0;
+
+    void openIndex(const char *path);
+};
+
+#endif // SHIWA_EXTTS_CAPTURE_H
@@ -0,0 +1,171 @@
+/*
+ * ShiwaPTPTool - Binary external timestamp records
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "extts_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int writeAll(int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int ExttsWriter::open(const char *path, int device) {
+    close();
+    if (!strcmp(path, "-")) {
+        fd = STDOUT_FILENO;
+        ownsFd = false;
+    } else {
+        fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return -errno;
+        }
+        ownsFd = true;
+    }
+
+    buffer = (char *)malloc(BUFFER_SIZE);
+    if (!buffer) {
+        close();
+        return -ENOMEM;
+    }
+
+    ExttsStreamHeader hdr = {};
+    hdr.magic = EXTTS_STREAM_MAGIC;
+    hdr.version = EXTTS_STREAM_VERSION;
+    hdr.record_size = sizeof(ExttsRecord);
+    hdr.device = device;
+    memcpy(buffer, &hdr, sizeof(hdr));
+    used = headerBytes = sizeof(hdr);
+    written = 0;
+    return 0;
+}
+
+int ExttsWriter::flush() {
+    if (fd < 0 || !used) {
+        return 0;
+    }
+    int err = writeAll(fd, buffer, used);
+    if (!err) {
+        written += (used - headerBytes) / sizeof(ExttsRecord);
+    }
+    used = 0;
+    headerBytes = 0;
+    return err;
+}
+
+int ExttsWriter::close() {
+    int err = flush();
+    if (ownsFd && fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    ownsFd = false;
+    free(buffer);
+    buffer = nullptr;
+    return err;
+}
+
+int ExttsReader::open(const char *path) {
+    close();
+    if (!strcmp(path, "-")) {
+        fd = STDIN_FILENO;
+        ownsFd = false;
+    } else {
+        fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -errno;
+        }
+        ownsFd = true;
+    }
+
+    buffer = (char *)malloc(ExttsWriter::BUFFER_SIZE);
+    if (!buffer) {
+        close();
+        return -ENOMEM;
+    }
+
+    int err = fill(sizeof(hdr));
+    if (err < 0) {
+        return err;
+    }
+    if (len - pos < sizeof(hdr)) {
+        return -EPROTO;
+    }
+    memcpy(&hdr, buffer + pos, sizeof(hdr));
+    pos += sizeof(hdr);
+    if (hdr.magic != EXTTS_STREAM_MAGIC || hdr.version != EXTTS_STREAM_VERSION ||
+        hdr.record_size != sizeof(ExttsRecord)) {
+        return -EPROTO;
+    }
+    return 0;
+}
+
+void ExttsReader::close() {
+    if (ownsFd && fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    ownsFd = false;
+    free(buffer);
+    buffer = nullptr;
+    pos = len = 0;
+}
+
+// Tops the buffer up until at least 'want' bytes are available or the
+// stream ends.
+int ExttsReader::fill(size_t want) {
+    if (len - pos >= want) {
+        return 0;
+    }
+    memmove(buffer, buffer + pos, len - pos);
+    len -= pos;
+    pos = 0;
+    while (len < want) {
+        ssize_t n = read(fd, buffer + len, ExttsWriter::BUFFER_SIZE - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    return 0;
+}
+
+int ExttsReader::next(ExttsRecord *rec) {
+    int err = fill(sizeof(*rec));
+    if (err) {
+        return err;
+    }
+    if (len - pos < sizeof(*rec)) {
+        return 0;
+    }
+    memcpy(rec, buffer + pos, sizeof(*rec));
+    pos += sizeof(*rec);
+    return 1;
+}
@@ -0,0 +1,110 @@
+/*
+ * ShiwaPTPTool - Binary external timestamp records
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_EXTTS_IO_H
+#define SHIWA_EXTTS_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EXTTS_STREAM_MAGIC 0x58434850u  /* "PHCX" */
+#define EXTTS_STREAM_VERSION 1
+
+// Fixed-size event record. A stream is one ExttsStreamHeader followed by
+// records in the order they were read; all fields are host endian.
+struct ExttsRecord {
+    uint32_t channel;   // extts channel (event.index)
+    uint32_t nsec;      // PTP timestamp, nanoseconds
+    int64_t sec;        // PTP timestamp, seconds
+    int64_t host_ns;    // CLOCK_REALTIME when the event was read (ns)
+};
+
+struct ExttsStreamHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    int32_t device;     // PHC index the events came from
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ExttsRecord) == 24, "ExttsRecord layout changed");
+static_assert(sizeof(ExttsStreamHeader) == 16, "ExttsStreamHeader layout changed");
+
+// Appends records to a file or pipe through one large buffer so that the
+// capture loop issues a write() per megabyte instead of per event.
+class ExttsWriter {
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    ExttsWriter() = default;
+    ~ExttsWriter() { close(); }
+
+    ExttsWriter(const ExttsWriter &) = delete;
+    ExttsWriter &operator=(const ExttsWriter &) = delete;
+
+    // "-" selects stdout. Returns 0 or a negative errno.
+    int open(const char *path, int device);
+    int close();
+    bool isOpen() const { return fd >= 0; }
+
+    int append(const ExttsRecord &rec) {
+        if (used + sizeof(rec) > BUFFER_SIZE) {
+            int err = flush();
+            if (err) {
+                return err;
+            }
+        }
+        *(ExttsRecord *)(buffer + used) = rec;
+        used += sizeof(rec);
+        return 0;
+    }
+
+    int flush();
+    uint64_t records() const { return written; }
+
+private:
+    int fd = -1;
+    bool ownsFd = false;
+    char *buffer = nullptr;
+    size_t used = 0;
+    size_t headerBytes = 0;  // stream header still at the front of the buffer
+    uint64_t written = 0;
+};
+
+// Reads a record stream back through the same large buffering.
+class ExttsReader {
+public:
+    ExttsReader() = default;
+    ~ExttsReader() { close(); }
+
+    ExttsReader(const ExttsReader &) = delete;
+    ExttsReader &operator=(const ExttsReader &) = delete;
+
+    // "-" selects stdin. Validates the header; returns 0 or a negative errno.
+    int open(const char *path);
+    void close();
+
+    const ExttsStreamHeader &header() const { return hdr; }
+
+    // Returns 1 and the next record, 0 at end of stream or a negative errno.
+    int next(ExttsRecord *rec);
+
+private:
+    int fd = -1;
+    bool ownsFd = false;
+    char *buffer = nullptr;
+    size_t pos = 0;
+    size_t len = 0;
+    ExttsStreamHeader hdr = {};
+
+    int fill(size_t want);
+};
+
+#endif // SHIWA_EXTTS_IO_H
@@ -0,0 +1,116 @@
+/*
+ * ShiwaPTPTool - Latency histogram
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_LATENCY_HISTOGRAM_H
+#define SHIWA_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Bucket layout of the log-linear histograms. Values below 2^SubBits are
+// counted exactly; every power-of-two range above that is split into
+// 2^SubBits buckets, which bounds the relative error to 2^-SubBits.
+template <int SubBits>
+struct LogLinearBuckets {
+    static constexpr int SUB_BITS = SubBits;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    static int bucketOf(uint64_t v) {
+        if (v < SUB_COUNT) {
+            return (int)v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        return ((shift + 1) << SUB_BITS) + (int)((v >> shift) - SUB_COUNT);
+    }
+
+    static uint64_t bucketHigh(int index) {
+        int group = index >> SUB_BITS;
+        uint64_t sub = index & (SUB_COUNT - 1);
+        if (group == 0) {
+            return sub;
+        }
+        int shift = group - 1;
+        return ((SUB_COUNT + sub + 1) << shift) - 1;
+    }
+
+    // Upper bound of the bucket holding the p-th percentile (0 < p <= 100)
+    // of 'total' values, clamped to 'max'. 'count(i)' returns the count of
+    // bucket i.
+    template <typename Count>
+    static uint64_t percentile(Count count, uint64_t total, double p, uint64_t max) {
+        uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+        if (rank < 1) {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += count(i);
+            if (seen >= rank) {
+                uint64_t high = bucketHigh(i);
+                return high < max ? high : max;
+            }
+        }
+        return max;
+    }
+};
+
+// Histogram of nanosecond values with 64 buckets per power of two (about
+// 1.6% relative error). Recording is a handful of integer operations and
+// never allocates.
+class LatencyHistogram {
+public:
+    typedef LogLinearBuckets<6> Layout;
+
+    LatencyHistogram() { reset(); }
+
+    void reset() {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        minValue = INT64_MAX;
+        maxValue = INT64_MIN;
+    }
+
+    // Negative values (e.g. early wakeups) are tracked by min() but counted
+    // in the zero bucket.
+    void record(int64_t value) {
+        if (value < minValue) {
+            minValue = value;
+        }
+        if (value > maxValue) {
+            maxValue = value;
+        }
+        counts[Layout::bucketOf(value < 0 ? 0 : (uint64_t)value)]++;
+        total++;
+    }
+
+    uint64_t count() const { return total; }
+    int64_t min() const { return total ? minValue : 0; }
+    int64_t max() const { return total ? maxValue : 0; }
+
+    // Upper bound of the bucket holding the p-th percentile (0 < p <= 100),
+    // clamped to the largest recorded value.
+    int64_t percentile(double p) const {
+        if (!total || maxValue <= 0) {
+            return max();
+        }
+        return (int64_t)Layout::percentile([this](int i) { return counts[i]; }, total, p,
+                                           (uint64_t)maxValue);
+    }
+
+private:
+    uint64_t counts[Layout::BUCKETS];
+    uint64_t total;
+    int64_t minValue;
+    int64_t maxValue;
+};
+
+#endif // SHIWA_LATENCY_HISTOGRAM_H
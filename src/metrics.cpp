@@ -0,0 +1,278 @@
+/*
+ * ShiwaPTPTool - Prometheus metrics
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "metrics.h"
+#include "rt_profile.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+// Bounds how long stop() waits for the serving thread.
+static const int POLL_INTERVAL_MS = 200;
+
+MetricsRegistry &MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Entry *MetricsRegistry::find(const char *name, const std::string &labels,
+                                              Type type, const char *help) {
+    for (Entry &e : entries) {
+        if (e.name == name && e.labels == labels) {
+            return e.type == type ? &e : nullptr;
+        }
+    }
+    entries.emplace_back();
+    Entry &e = entries.back();
+    e.name = name;
+    e.help = help;
+    e.labels = labels;
+    e.type = type;
+    return &e;
+}
+
+MetricCounter *MetricsRegistry::counter(const char *name, const char *help,
+                                        const std::string &labels) {
+    std::lock_guard<std::mutex> guard(lock);
+    Entry *e = find(name, labels, COUNTER, help);
+    if (!e) {
+        return nullptr;
+    }
+    if (!e->counter) {
+        e->counter.reset(new MetricCounter);
+    }
+    return e->counter.get();
+}
+
+MetricGauge *MetricsRegistry::gauge(const char *name, const char *help,
+                                    const std::string &labels) {
+    std::lock_guard<std::mutex> guard(lock);
+    Entry *e = find(name, labels, GAUGE, help);
+    if (!e) {
+        return nullptr;
+    }
+    if (!e->gauge) {
+        e->gauge.reset(new MetricGauge);
+    }
+    return e->gauge.get();
+}
+
+MetricHistogram *MetricsRegistry::histogram(const char *name, const char *help,
+                                            const std::string &labels) {
+    std::lock_guard<std::mutex> guard(lock);
+    Entry *e = find(name, labels, HISTOGRAM, help);
+    if (!e) {
+        return nullptr;
+    }
+    if (!e->histogram) {
+        e->histogram.reset(new MetricHistogram);
+    }
+    return e->histogram.get();
+}
+
+std::string MetricsRegistry::label(const char *key, const std::string &value) {
+    std::string out = key;
+    out += "=\"";
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+    return out;
+}
+
+static void appendf(std::string *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string *out, const char *fmt, ...) {
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    out->append(buf, std::min(n, (int)sizeof(buf) - 1));
+}
+
+static std::string withLabels(const std::string &labels, const std::string &extra) {
+    if (labels.empty() && extra.empty()) {
+        return "";
+    }
+    if (labels.empty() || extra.empty()) {
+        return "{" + labels + extra + "}";
+    }
+    return "{" + labels + "," + extra + "}";
+}
+
+std::string MetricsRegistry::render() const {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Samples of one metric family have to be adjacent.
+    std::vector<const Entry *> sorted;
+    for (const Entry &e : entries) {
+        sorted.push_back(&e);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const Entry *a, const Entry *b) { return a->name < b->name; });
+
+    static const char *const TYPES[] = {"counter", "gauge", "histogram"};
+    std::string out;
+    const std::string *family = nullptr;
+    for (const Entry *e : sorted) {
+        if (!family || *family != e->name) {
+            family = &e->name;
+            appendf(&out, "# HELP %s %s\n# TYPE %s %s\n", e->name.c_str(), e->help.c_str(),
+                    e->name.c_str(), TYPES[e->type]);
+        }
+        const char *name = e->name.c_str();
+        switch (e->type) {
+            case COUNTER:
+                appendf(&out, "%s%s %llu\n", name, withLabels(e->labels, "").c_str(),
+                        (unsigned long long)e->counter->value());
+                break;
+            case GAUGE:
+                appendf(&out, "%s%s %.17g\n", name, withLabels(e->labels, "").c_str(),
+                        e->gauge->value());
+                break;
+            case HISTOGRAM: {
+                const MetricHistogram &h = *e->histogram;
+                uint64_t cumulative = 0;
+                for (int b = 0; b < MetricHistogram::BUCKETS; b++) {
+                    cumulative += h.bucket(b);
+                    char le[48];
+                    snprintf(le, sizeof(le), "le=\"%.9g\"", MetricHistogram::bound(b) * 1e-9);
+                    appendf(&out, "%s_bucket%s %llu\n", name, withLabels(e->labels, le).c_str(),
+                            (unsigned long long)cumulative);
+                }
+                cumulative += h.bucket(MetricHistogram::BUCKETS);
+                appendf(&out, "%s_bucket%s %llu\n", name,
+                        withLabels(e->labels, "le=\"+Inf\"").c_str(),
+                        (unsigned long long)cumulative);
+                appendf(&out, "%s_sum%s %.9f\n", name, withLabels(e->labels, "").c_str(),
+                        h.total() * 1e-9);
+                appendf(&out, "%s_count%s %llu\n", name, withLabels(e->labels, "").c_str(),
+                        (unsigned long long)cumulative);
+                break;
+            }
+        }
+    }
+    return out;
+}
+
+bool MetricsServer::start(const char *spec) {
+    std::string host = "127.0.0.1";
+    const char *port = spec;
+    const char *colon = strrchr(spec, ':');
+    if (colon) {
+        host.assign(spec, colon - spec);
+        port = colon + 1;
+    }
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port));
+    if (!addr.sin_port || inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid metrics address '%s'\n", spec);
+        return false;
+    }
+
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        perror("metrics socket");
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listenFd, 8)) {
+        perror("metrics bind");
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    stopping = false;
+    worker = std::thread([this] { serve(); });
+    return true;
+}
+
+void MetricsServer::stop() {
+    stopping = true;
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (listenFd >= 0) {
+        close(listenFd);
+        listenFd = -1;
+    }
+}
+
+void MetricsServer::serve() {
+    // Signals belong to the command being monitored
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+    RealtimeProfile::releaseThread();
+
+    while (!stopping) {
+        struct pollfd pfd = {listenFd, POLLIN, 0};
+        if (poll(&pfd, 1, POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        // The request itself does not matter; read what is there so the
+        // client does not see a reset, but never wait long for it.
+        struct timeval tv = {0, POLL_INTERVAL_MS * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        char request[1024];
+        (void)!recv(fd, request, sizeof(request), 0);
+
+        std::string body = MetricsRegistry::instance().render();
+        char header[160];
+        int n = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\n"
+                         "Content-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: %zu\r\n"
+                         "Connection: close\r\n\r\n",
+                         body.size());
+        std::string response(header, n);
+        response += body;
+        const char *p = response.data();
+        size_t left = response.size();
+        while (left) {
+            ssize_t sent = send(fd, p, left, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                break;
+            }
+            p += sent;
+            left -= sent;
+        }
+        close(fd);
+    }
+}
@@ -0,0 +1,136 @@
+/*
+ * ShiwaPTPTool - Prometheus metrics
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_METRICS_H
+#define SHIWA_METRICS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Metrics are registered once, outside the hot path, and then updated with
+// relaxed atomics only. A scrape walks the registry under the registry
+// lock, which updates never take, so the measured loops are never blocked
+// by the HTTP thread.
+
+class MetricCounter {
+public:
+    void inc(uint64_t n = 1) { v.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return v.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> v{0};
+};
+
+class MetricGauge {
+public:
+    void set(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        v.store(bits, std::memory_order_relaxed);
+    }
+    double value() const {
+        uint64_t bits = v.load(std::memory_order_relaxed);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+private:
+    std::atomic<uint64_t> v{0};
+};
+
+// Nanosecond durations in power-of-two buckets from 64 ns to about 1 s,
+// exported in seconds as a Prometheus histogram.
+class MetricHistogram {
+public:
+    static const int FIRST_SHIFT = 6;
+    static const int BUCKETS = 25;
+
+    void observe(int64_t ns) {
+        uint64_t v = ns > 0 ? (uint64_t)ns : 0;
+        // Buckets are inclusive of their bound, so 2^k belongs below it
+        int b = v <= (1ull << FIRST_SHIFT) ? 0 : 64 - __builtin_clzll(v - 1) - FIRST_SHIFT;
+        counts[b < BUCKETS ? b : BUCKETS].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    // Upper bound of bucket 'b' in ns.
+    static uint64_t bound(int b) { return 1ull << (FIRST_SHIFT + b); }
+
+    uint64_t bucket(int b) const { return counts[b].load(std::memory_order_relaxed); }
+    uint64_t total() const { return sum.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS + 1] = {};
+    std::atomic<uint64_t> sum{0};
+};
+
+class MetricsRegistry {
+public:
+    static MetricsRegistry &instance();
+
+    // Returns the metric for 'name' and 'labels' (e.g. "device=\"0\""),
+    // creating it on first use. The pointer stays valid until exit.
+    MetricCounter *counter(const char *name, const char *help, const std::string &labels = "");
+    MetricGauge *gauge(const char *name, const char *help, const std::string &labels = "");
+    MetricHistogram *histogram(const char *name, const char *help,
+                               const std::string &labels = "");
+
+    // Prometheus text exposition format, version 0.0.4.
+    std::string render() const;
+
+    // Quotes a label value.
+    static std::string label(const char *key, const std::string &value);
+
+private:
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+    struct Entry {
+        std::string name;
+        std::string help;
+        std::string labels;
+        Type type;
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::unique_ptr<MetricHistogram> histogram;
+    };
+
+    mutable std::mutex lock;
+    std::deque<Entry> entries;
+
+    Entry *find(const char *name, const std::string &labels, Type type, const char *help);
+};
+
+// Serves the registry over HTTP from its own thread. Every request gets
+// the full exposition, whatever its path.
+class MetricsServer {
+public:
+    MetricsServer() = default;
+    ~MetricsServer() { stop(); }
+
+    // 'spec' is "port" (binds 127.0.0.1) or "addr:port".
+    bool start(const char *spec);
+    void stop();
+
+private:
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread worker;
+
+    void serve();
+};
+
+#endif // SHIWA_METRICS_H
@@ -0,0 +1,220 @@
+/*
+ * ShiwaPTPTool - Interpolated PHC clock model
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "phc_clock_model.h"
+#include "rt_profile.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <chrono>
+
+// Bracketed reads taken per sample when no precise cross timestamp exists.
+static const int BRACKET_READS = 5;
+
+// Frequency uncertainty assumed before two samples are available.
+static const double UNKNOWN_RATE_ERROR = 1e-3;
+
+// A sample further than this from the prediction means the PHC was stepped
+// and the history is discarded.
+static const int64_t STEP_THRESHOLD_NS = 10000;
+
+static int64_t tsns(const struct timespec &ts) {
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+PhcClockModel::PhcClockModel(const PhcDevice &phc) : phc(phc) {
+    struct ptp_sys_offset_precise xts;
+    memset(&xts, 0, sizeof(xts));
+    precise = phc.sysOffsetPrecise(&xts) == 0;
+}
+
+PhcClockModel::~PhcClockModel() {
+    stop();
+}
+
+bool PhcClockModel::takeSample(Sample *s) {
+    if (precise) {
+        struct ptp_sys_offset_precise xts;
+        memset(&xts, 0, sizeof(xts));
+        if (phc.sysOffsetPrecise(&xts)) {
+            return false;
+        }
+        s->raw = PhcDevice::toNs(&xts.sys_monoraw);
+        s->phc = PhcDevice::toNs(&xts.device);
+        s->delay = 0;
+        return true;
+    }
+
+    s->delay = INT64_MAX;
+    for (int i = 0; i < BRACKET_READS; i++) {
+        struct timespec t1, tp, t2;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+        if (phc.getTime(&tp)) {
+            return false;
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+        int64_t delay = tsns(t2) - tsns(t1);
+        if (delay < s->delay) {
+            s->delay = delay;
+            s->raw = tsns(t1) + delay / 2;
+            s->phc = tsns(tp);
+        }
+    }
+    return true;
+}
+
+bool PhcClockModel::refresh() {
+    Sample s;
+    if (!takeSample(&s)) {
+        return false;
+    }
+
+    Params prev;
+    if (snapshot(&prev) && prev.sequence) {
+        int64_t predicted, error;
+        at(s.raw, &predicted, &error);
+        if (llabs(s.phc - predicted) > STEP_THRESHOLD_NS + error) {
+            count = 0;
+            head = 0;
+        }
+    }
+
+    samples[head] = s;
+    head = (head + 1) % WINDOW;
+    if (count < WINDOW) {
+        count++;
+    }
+
+    // Fit (phc - raw) against raw, both relative to the newest sample, so
+    // the doubles only carry the window span rather than absolute time.
+    const Sample &latest = s;
+    double mx = 0, my = 0;
+    for (int i = 0; i < count; i++) {
+        const Sample &c = samples[i];
+        mx += (double)(c.raw - latest.raw);
+        my += (double)((c.phc - c.raw) - (latest.phc - latest.raw));
+    }
+    mx /= count;
+    my /= count;
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < count; i++) {
+        const Sample &c = samples[i];
+        double x = (double)(c.raw - latest.raw) - mx;
+        double y = (double)((c.phc - c.raw) - (latest.phc - latest.raw)) - my;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    Params p = {};
+    p.rawRef = latest.raw;
+    p.sequence = prev.sequence + 1;
+    // Two points always fit exactly, so the residuals say nothing about
+    // the error until a third sample exists.
+    if (count < 3 || sxx <= 0) {
+        p.phcRef = latest.phc;
+        p.rate = prev.rate;
+        p.rateError = UNKNOWN_RATE_ERROR;
+        p.baseError = (latest.delay + 1) / 2;
+        publish(p);
+        return true;
+    }
+
+    double slope = sxy / sxx;
+    double intercept = my - slope * mx;
+    double ss = 0;
+    for (int i = 0; i < count; i++) {
+        const Sample &c = samples[i];
+        double x = (double)(c.raw - latest.raw);
+        double y = (double)((c.phc - c.raw) - (latest.phc - latest.raw));
+        double r = y - (intercept + slope * x);
+        ss += r * r;
+    }
+    double sigma = fmax(sqrt(ss / (count - 2)), 1.0);
+
+    p.phcRef = latest.phc + (int64_t)llround(intercept);
+    p.rate = slope;
+    p.rateError = 3 * sigma / sqrt(sxx);
+    p.baseError = (int64_t)ceil(3 * sigma * sqrt(1.0 / count + mx * mx / sxx) +
+                                latest.delay / 2.0);
+    publish(p);
+    return true;
+}
+
+void PhcClockModel::publish(const Params &p) {
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    params = p;
+    seq.store(s + 2, std::memory_order_release);
+}
+
+bool PhcClockModel::snapshot(Params *out) const {
+    for (;;) {
+        uint32_t s1 = seq.load(std::memory_order_acquire);
+        if (s1 & 1) {
+            continue;
+        }
+        *out = params;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq.load(std::memory_order_relaxed) == s1) {
+            return true;
+        }
+    }
+}
+
+int PhcClockModel::at(int64_t raw_ns, int64_t *phc_ns, int64_t *error_ns) const {
+    Params p;
+    snapshot(&p);
+    if (!p.sequence) {
+        return -EAGAIN;
+    }
+    double dt = (double)(raw_ns - p.rawRef);
+    *phc_ns = p.phcRef + (raw_ns - p.rawRef) + (int64_t)(dt * p.rate);
+    *error_ns = p.baseError + (int64_t)(fabs(dt) * p.rateError);
+    return 0;
+}
+
+int PhcClockModel::now(int64_t *phc_ns, int64_t *error_ns) const {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return at(tsns(ts), phc_ns, error_ns);
+}
+
+bool PhcClockModel::start(int interval_ms) {
+    if (refresher.joinable() || interval_ms <= 0) {
+        return false;
+    }
+    if (!refresh()) {
+        return false;
+    }
+    stopping = false;
+    refresher = std::thread([this, interval_ms] {
+        RealtimeProfile::releaseThread();
+        std::unique_lock<std::mutex> guard(lock);
+        while (!wake.wait_for(guard, std::chrono::milliseconds(interval_ms),
+                              [this] { return stopping; })) {
+            refresh();
+        }
+    });
+    return true;
+}
+
+void PhcClockModel::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (refresher.joinable()) {
+        refresher.join();
+    }
+}
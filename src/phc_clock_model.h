@@ -0,0 +1,97 @@
+/*
+ * ShiwaPTPTool - Interpolated PHC clock model
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_CLOCK_MODEL_H
+#define SHIWA_PHC_CLOCK_MODEL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "phc_device.h"
+
+// Linear model of the PHC against CLOCK_MONOTONIC_RAW:
+//
+//   phc(raw) = phcRef + (raw - rawRef) * (1 + rate)
+//
+// refresh() takes a cross timestamp (PTP_SYS_OFFSET_PRECISE when the driver
+// supports it, otherwise the tightest of several bracketed PHC reads) and
+// refits the model over the most recent samples. now() answers from the
+// vDSO clock without entering the kernel and returns an error bound that
+// grows with the time since the last refresh.
+//
+// Readers never block: the parameters are published through a seqlock, so
+// now() may run concurrently with a refresh thread.
+class PhcClockModel {
+public:
+    struct Params {
+        int64_t rawRef;     // CLOCK_MONOTONIC_RAW at the reference point (ns)
+        int64_t phcRef;     // PHC time at the reference point (ns)
+        double rate;        // fractional frequency offset of the PHC
+        double rateError;   // 3-sigma uncertainty of 'rate'
+        int64_t baseError;  // uncertainty at the reference point (ns)
+        uint64_t sequence;  // number of completed refreshes
+    };
+
+    static const int WINDOW = 16;
+
+    explicit PhcClockModel(const PhcDevice &phc);
+    ~PhcClockModel();
+
+    PhcClockModel(const PhcClockModel &) = delete;
+    PhcClockModel &operator=(const PhcClockModel &) = delete;
+
+    // Takes one sample and publishes the refitted parameters. Only one
+    // thread may refresh at a time.
+    bool refresh();
+
+    // Refreshes every 'interval_ms' from a background thread until stop().
+    bool start(int interval_ms);
+    void stop();
+
+    // Returns 0 and the interpolated PHC time, or -EAGAIN before the first
+    // refresh.
+    int now(int64_t *phc_ns, int64_t *error_ns) const;
+    int at(int64_t raw_ns, int64_t *phc_ns, int64_t *error_ns) const;
+
+    bool snapshot(Params *out) const;
+    bool usesPreciseTimestamps() const { return precise; }
+
+private:
+    struct Sample {
+        int64_t raw;
+        int64_t phc;
+        int64_t delay;
+    };
+
+    const PhcDevice &phc;
+    bool precise = false;
+
+    Sample samples[WINDOW];
+    int count = 0;
+    int head = 0;
+
+    std::atomic<uint32_t> seq{0};
+    Params params = {};
+
+    std::thread refresher;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    bool takeSample(Sample *s);
+    void publish(const Params &p);
+};
+
+#endif // SHIWA_PHC_CLOCK_MODEL_H
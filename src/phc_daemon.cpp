@@ -0,0 +1,446 @@
+/*
+ * ShiwaPTPTool - PHC control daemon
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "phc_daemon.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const int EXTTS_BATCH = 32;
+
+// Copies a fixed-size request payload; shorter payloads are rejected.
+template <typename T>
+static bool take(const char *payload, size_t len, T *out) {
+    if (len < sizeof(T)) {
+        return false;
+    }
+    memcpy(out, payload, sizeof(T));
+    return true;
+}
+
+template <typename T>
+static void reply(char *resp, size_t *respLen, const T &value) {
+    memcpy(resp, &value, sizeof(T));
+    *respLen = sizeof(T);
+}
+
+PhcDaemon::PhcDaemon(EventLoop &loop, const PhcSimConfig &simConfig)
+    : loop(loop), simConfig(simConfig) {
+    MetricsRegistry &m = MetricsRegistry::instance();
+    clientsGauge = m.gauge("shiwaptp_daemon_clients", "Connected daemon clients");
+    requestsTotal = m.counter("shiwaptp_daemon_requests_total", "Requests served by the daemon");
+    pushedTotal = m.counter("shiwaptp_daemon_pushed_total",
+                            "Subscription messages pushed to daemon clients");
+    droppedTotal = m.counter("shiwaptp_daemon_dropped_total",
+                             "Subscription messages dropped for slow daemon clients");
+}
+
+PhcDaemon::~PhcDaemon() {
+    while (!clients.empty()) {
+        disconnect(*clients.begin()->second);
+    }
+    if (listenFd >= 0) {
+        loop.remove(listenFd);
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+}
+
+int PhcDaemon::start(const char *path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+    int err = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ? -errno : 0;
+    if (err == -EADDRINUSE) {
+        // Replace the file only if nobody answers on it
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && !connect(probe, (struct sockaddr *)&addr, sizeof(addr));
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (!live) {
+            unlink(path);
+            err = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ? -errno : 0;
+        }
+    }
+    if (!err && (chmod(path, 0660) || listen(fd, 16))) {
+        err = -errno;
+    }
+    if (!err) {
+        err = loop.add(fd, EPOLLIN, [this](uint32_t) { accept(); });
+    }
+    if (err) {
+        close(fd);
+        return err;
+    }
+    listenFd = fd;
+    socketPath = path;
+    return 0;
+}
+
+void PhcDaemon::accept() {
+    int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+            perror("accept");
+        }
+        return;
+    }
+    int err = loop.add(fd, EPOLLIN, [this, fd](uint32_t events) { receive(fd, events); });
+    if (err) {
+        fprintf(stderr, "epoll_ctl: %s\n", strerror(-err));
+        close(fd);
+        return;
+    }
+    std::unique_ptr<Client> client(new Client);
+    client->fd = fd;
+    clients[fd] = std::move(client);
+    clientsGauge->set((double)clients.size());
+}
+
+void PhcDaemon::receive(int fd, uint32_t) {
+    auto it = clients.find(fd);
+    if (it == clients.end()) {
+        return;
+    }
+    Client &client = *it->second;
+
+    char buf[PHC_MAX_MESSAGE];
+    ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (n < (ssize_t)sizeof(PhcMsgHeader)) {
+        // Hangup, error or garbage: the connection is useless either way
+        disconnect(client);
+        return;
+    }
+    PhcMsgHeader hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    requestsTotal->inc();
+
+    char out[PHC_MAX_MESSAGE];
+    size_t respLen = 0;
+    int status = handle(client, hdr, buf + sizeof(hdr), n - sizeof(hdr), out + sizeof(hdr),
+                        &respLen);
+    PhcMsgHeader resp = {hdr.op, PHC_PROTOCOL_VERSION, hdr.seq, status, 0};
+    memcpy(out, &resp, sizeof(resp));
+    if (status) {
+        respLen = 0;
+    }
+    // The client waits for this response, so failing to queue it (a full
+    // socket buffer) leaves the connection out of step: drop it.
+    if (send(fd, out, sizeof(resp) + respLen, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        disconnect(client);
+    }
+}
+
+void PhcDaemon::disconnect(Client &client) {
+    int fd = client.fd;
+    for (unsigned int ch = 0; ch < MAX_CHANNELS; ch++) {
+        if (client.extts & (1u << ch)) {
+            setExtts(client, PhcExttsRequest{ch, 0, 0});
+        }
+    }
+    if (client.timer >= 0) {
+        loop.removeTimer(client.timer);
+    }
+    loop.remove(fd);
+    close(fd);
+    clients.erase(fd);
+    clientsGauge->set((double)clients.size());
+}
+
+int PhcDaemon::handle(Client &client, const PhcMsgHeader &hdr, const char *payload, size_t len,
+                      char *resp, size_t *respLen) {
+    if (hdr.version != PHC_PROTOCOL_VERSION) {
+        return -EPROTONOSUPPORT;
+    }
+    if (hdr.op == PHC_OP_OPEN) {
+        PhcOpenRequest req;
+        return take(payload, len, &req) ? open(client, req) : -EINVAL;
+    }
+    if (!client.dev) {
+        return -EBADF;
+    }
+
+    const PhcDevice &phc = client.dev->phc;
+    int err;
+    switch (hdr.op) {
+        case PHC_OP_GETCAPS: {
+            struct ptp_clock_caps caps;
+            err = phc.getCaps(&caps);
+            reply(resp, respLen, caps);
+            return err;
+        }
+        case PHC_OP_GETTIME: {
+            struct timespec ts;
+            err = phc.getTime(&ts);
+            reply(resp, respLen, PhcTimeMsg{ts.tv_sec, ts.tv_nsec});
+            return err;
+        }
+        case PHC_OP_SETTIME: {
+            PhcTimeMsg msg;
+            if (!take(payload, len, &msg)) {
+                return -EINVAL;
+            }
+            struct timespec ts = {(time_t)msg.sec, (long)msg.nsec};
+            return phc.setTime(&ts);
+        }
+        case PHC_OP_ADJTIME: {
+            PhcAdjTimeMsg msg;
+            return take(payload, len, &msg) ? phc.adjustTime(msg.ns) : -EINVAL;
+        }
+        case PHC_OP_ADJFREQ: {
+            PhcFreqMsg msg;
+            return take(payload, len, &msg) ? phc.adjustFrequency(msg.ppb) : -EINVAL;
+        }
+        case PHC_OP_READFREQ: {
+            PhcFreqMsg msg;
+            err = phc.readFrequency(&msg.ppb);
+            reply(resp, respLen, msg);
+            return err;
+        }
+        case PHC_OP_SYS_OFFSET: {
+            struct ptp_sys_offset req;
+            if (!take(payload, len, &req)) {
+                return -EINVAL;
+            }
+            err = phc.sysOffset(&req);
+            reply(resp, respLen, req);
+            return err;
+        }
+        case PHC_OP_SYS_OFFSET_EXTENDED: {
+            struct ptp_sys_offset_extended req;
+            if (!take(payload, len, &req)) {
+                return -EINVAL;
+            }
+            err = phc.sysOffsetExtended(&req);
+            reply(resp, respLen, req);
+            return err;
+        }
+        case PHC_OP_SYS_OFFSET_PRECISE: {
+            struct ptp_sys_offset_precise req;
+            if (!take(payload, len, &req)) {
+                return -EINVAL;
+            }
+            err = phc.sysOffsetPrecise(&req);
+            reply(resp, respLen, req);
+            return err;
+        }
+        case PHC_OP_EXTTS: {
+            PhcExttsRequest req;
+            return take(payload, len, &req) ? setExtts(client, req) : -EINVAL;
+        }
+        case PHC_OP_PEROUT: {
+            struct ptp_perout_request req;
+            return take(payload, len, &req) ? phc.setPerout(&req) : -EINVAL;
+        }
+        case PHC_OP_GETPIN: {
+            struct ptp_pin_desc desc;
+            if (!take(payload, len, &desc)) {
+                return -EINVAL;
+            }
+            err = phc.getPin(&desc);
+            reply(resp, respLen, desc);
+            return err;
+        }
+        case PHC_OP_SETPIN: {
+            PhcPinRequest req;
+            return take(payload, len, &req) ? phc.setPin(req.index, req.func, req.chan) : -EINVAL;
+        }
+        case PHC_OP_PPS: {
+            PhcPpsRequest req;
+            return take(payload, len, &req) ? phc.enablePps(req.enable != 0) : -EINVAL;
+        }
+        case PHC_OP_SUBSCRIBE_OFFSET: {
+            PhcOffsetSubscribe req;
+            return take(payload, len, &req) ? subscribeOffset(client, req) : -EINVAL;
+        }
+        default:
+            return -EOPNOTSUPP;
+    }
+}
+
+int PhcDaemon::open(Client &client, const PhcOpenRequest &req) {
+    if (client.dev) {
+        return -EISCONN;
+    }
+    if (req.index < 0) {
+        return -EINVAL;
+    }
+    bool sim = req.flags & PHC_OPEN_SIM;
+    auto key = std::make_pair(sim, (int)req.index);
+    auto it = devices.find(key);
+    if (it == devices.end()) {
+        std::unique_ptr<Device> dev(new Device);
+        int err = sim ? dev->phc.openSim(req.index, simConfig) : dev->phc.open(req.index);
+        if (!err) {
+            err = dev->phc.setNonblocking(true);
+        }
+        if (err) {
+            return err;
+        }
+        it = devices.emplace(key, std::move(dev)).first;
+    }
+    client.dev = it->second.get();
+    return 0;
+}
+
+int PhcDaemon::setExtts(Client &client, const PhcExttsRequest &req) {
+    if (req.channel >= MAX_CHANNELS) {
+        return -EINVAL;
+    }
+    Device &dev = *client.dev;
+    unsigned int ch = req.channel;
+    uint32_t bit = 1u << ch;
+
+    if (!req.enable) {
+        if (!(client.extts & bit)) {
+            return 0;
+        }
+        client.extts &= ~bit;
+        if (--dev.exttsUsers[ch] == 0) {
+            dev.phc.disableExtts(ch);
+            dev.exttsActive &= ~bit;
+            if (!dev.exttsActive && dev.polled) {
+                loop.remove(dev.phc.fd());
+                dev.polled = false;
+            }
+        }
+        return 0;
+    }
+
+    if (client.extts & bit) {
+        return 0;
+    }
+    if (!dev.exttsUsers[ch]) {
+        int err = dev.phc.enableExtts(ch, req.flags);
+        if (err) {
+            return err;
+        }
+        if (!dev.polled) {
+            Device *d = &dev;
+            err = loop.add(dev.phc.fd(), EPOLLIN, [this, d](uint32_t) { readDevice(*d); });
+            if (err) {
+                dev.phc.disableExtts(ch);
+                return err;
+            }
+            dev.polled = true;
+        }
+        dev.exttsActive |= bit;
+    }
+    dev.exttsUsers[ch]++;
+    client.extts |= bit;
+    return 0;
+}
+
+// One read per notification: PTP character devices block in read() while
+// their queue is empty, even with O_NONBLOCK.
+void PhcDaemon::readDevice(Device &dev) {
+    struct ptp_extts_event events[EXTTS_BATCH];
+    int cnt = dev.phc.readExtts(events, EXTTS_BATCH);
+    if (cnt == -EAGAIN || cnt == -EINTR) {
+        return;
+    }
+    if (cnt < 0) {
+        // Stop polling rather than spin; the next subscriber retries
+        fprintf(stderr, "ptp%d: read: %s\n", dev.phc.index(), strerror(-cnt));
+        loop.remove(dev.phc.fd());
+        dev.polled = false;
+        return;
+    }
+    for (int i = 0; i < cnt; i++) {
+        unsigned int ch = events[i].index;
+        if (ch >= MAX_CHANNELS || !(dev.exttsActive & (1u << ch))) {
+            continue;
+        }
+        for (const auto &entry : clients) {
+            Client &client = *entry.second;
+            if (client.dev == &dev && (client.extts & (1u << ch))) {
+                push(client, PHC_PUSH_EXTTS, &events[i], sizeof(events[i]));
+            }
+        }
+    }
+}
+
+int PhcDaemon::subscribeOffset(Client &client, const PhcOffsetSubscribe &req) {
+    if (client.timer >= 0) {
+        loop.removeTimer(client.timer);
+        client.timer = -1;
+    }
+    if (!req.interval_ms) {
+        return 0;
+    }
+    if (req.samples < 1 || req.samples > PTP_MAX_SAMPLES) {
+        return -EINVAL;
+    }
+
+    int fd = client.fd;
+    int tfd = loop.addTimer(CLOCK_MONOTONIC, [this, fd](uint64_t) {
+        auto it = clients.find(fd);
+        if (it != clients.end()) {
+            pushOffset(*it->second);
+        }
+    });
+    if (tfd < 0) {
+        return tfd;
+    }
+    struct itimerspec its = {};
+    its.it_interval.tv_sec = req.interval_ms / 1000;
+    its.it_interval.tv_nsec = (long)(req.interval_ms % 1000) * 1000000;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(tfd, 0, &its, nullptr)) {
+        int err = -errno;
+        loop.removeTimer(tfd);
+        return err;
+    }
+    client.timer = tfd;
+    client.samples = req.samples;
+    return 0;
+}
+
+void PhcDaemon::pushOffset(Client &client) {
+    PhcOffsetSample sample;
+    int err = client.dev->phc.sampleOffset(client.samples, &sample);
+    if (err) {
+        fprintf(stderr, "ptp%d: PTP_SYS_OFFSET: %s\n", client.dev->phc.index(), strerror(-err));
+        return;
+    }
+    push(client, PHC_PUSH_OFFSET, &sample, sizeof(sample));
+}
+
+bool PhcDaemon::push(Client &client, uint16_t op, const void *payload, size_t len) {
+    char buf[sizeof(PhcMsgHeader) + sizeof(PhcOffsetSample) + sizeof(struct ptp_extts_event)];
+    PhcMsgHeader hdr = {op, PHC_PROTOCOL_VERSION, 0, 0, 0};
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), payload, len);
+    if (send(client.fd, buf, sizeof(hdr) + len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        droppedTotal->inc();
+        return false;
+    }
+    pushedTotal->inc();
+    return true;
+}
@@ -0,0 +1,98 @@
+/*
+ * ShiwaPTPTool - PHC control daemon
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_DAEMON_H
+#define SHIWA_PHC_DAEMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "event_loop.h"
+#include "metrics.h"
+#include "phc_device.h"
+#include "phc_protocol.h"
+#include "phc_sim.h"
+
+// Serves the protocol of phc_protocol.h on a Unix socket from the caller's
+// event loop. Devices are opened on first use and stay open until the
+// daemon is destroyed, so clients skip the open and capability probing and
+// pay one socket round trip per operation.
+//
+// EXTTS channels are reference counted across connections: the device
+// channel is enabled by the first subscriber (with its flags) and disabled
+// when the last one leaves, and every event is copied to each subscriber
+// of its channel. Pushes never block the loop; a client that does not
+// drain its socket loses events, which are counted.
+class PhcDaemon {
+public:
+    static const unsigned int MAX_CHANNELS = 32;
+
+    PhcDaemon(EventLoop &loop, const PhcSimConfig &simConfig);
+    ~PhcDaemon();
+
+    PhcDaemon(const PhcDaemon &) = delete;
+    PhcDaemon &operator=(const PhcDaemon &) = delete;
+
+    // Binds and listens on 'path'. A stale socket file is replaced, a live
+    // one is reported as -EADDRINUSE. Returns 0 or a negative errno.
+    int start(const char *path);
+
+    size_t clientCount() const { return clients.size(); }
+
+private:
+    struct Device {
+        PhcDevice phc;
+        unsigned int exttsUsers[MAX_CHANNELS] = {};
+        uint32_t exttsActive = 0;      // channels with at least one user
+        bool polled = false;           // descriptor registered with the loop
+    };
+
+    struct Client {
+        int fd = -1;
+        Device *dev = nullptr;
+        uint32_t extts = 0;            // subscribed channel mask
+        int timer = -1;                // offset subscription timer
+        unsigned int samples = 0;
+    };
+
+    EventLoop &loop;
+    PhcSimConfig simConfig;
+    int listenFd = -1;
+    std::string socketPath;
+
+    std::map<std::pair<bool, int>, std::unique_ptr<Device>> devices;
+    std::map<int, std::unique_ptr<Client>> clients;
+
+    MetricGauge *clientsGauge;
+    MetricCounter *requestsTotal;
+    MetricCounter *pushedTotal;
+    MetricCounter *droppedTotal;
+
+    void accept();
+    void receive(int fd, uint32_t events);
+    void disconnect(Client &client);
+
+    int handle(Client &client, const PhcMsgHeader &hdr, const char *payload, size_t len,
+               char *resp, size_t *respLen);
+    int open(Client &client, const PhcOpenRequest &req);
+    int setExtts(Client &client, const PhcExttsRequest &req);
+    int subscribeOffset(Client &client, const PhcOffsetSubscribe &req);
+
+    void readDevice(Device &dev);
+    void pushOffset(Client &client);
+    bool push(Client &client, uint16_t op, const void *payload, size_t len);
+};
+
+#endif // SHIWA_PHC_DAEMON_H
@@ -0,0 +1,374 @@
+/*
+ * ShiwaPTPTool - PHC device access library
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "phc_device.h"
+#include "phc_remote.h"
+#include "phc_sim.h"
+#include "phc_trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/timex.h>
+#include <unistd.h>
+
+#include <new>
+
+#ifndef ADJ_SETOFFSET
+#define ADJ_SETOFFSET 0x0100
+#endif
+
+#ifndef ADJ_NANO
+#define ADJ_NANO 0x2000
+#endif
+
+int PhcDevice::open(int index, int flags) {
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/ptp%d", index);
+    int err = openPath(path, flags);
+    if (!err) {
+        devIndex = index;
+    }
+    return err;
+}
+
+int PhcDevice::openPath(const char *path, int flags) {
+    close();
+    int fd = ::open(path, flags | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    devFd = fd;
+    devIndex = -1;
+    clkid = fdToClockId(fd);
+    return 0;
+}
+
+int PhcDevice::openSim(int index, const PhcSimConfig &config, int flags) {
+    close();
+    PhcSim *s = new (std::nothrow) PhcSim(config, flags & O_NONBLOCK);
+    if (!s) {
+        return -ENOMEM;
+    }
+    if (s->fd() < 0) {
+        int err = -errno;
+        delete s;
+        return err;
+    }
+    sim = s;
+    devFd = s->fd();
+    devIndex = index;
+    return 0;
+}
+
+int PhcDevice::openRemote(const char *path, int index, bool simulated, int flags) {
+    close();
+    PhcRemote *r = new (std::nothrow) PhcRemote;
+    if (!r) {
+        return -ENOMEM;
+    }
+    int err = r->connect(path, index, simulated, flags & O_NONBLOCK);
+    if (err) {
+        delete r;
+        return err;
+    }
+    remote = r;
+    devFd = r->fd();
+    devIndex = index;
+    return 0;
+}
+
+void PhcDevice::close() {
+    if (sim) {
+        delete sim;
+        sim = nullptr;
+    } else if (remote) {
+        delete remote;
+        remote = nullptr;
+    } else if (devFd >= 0) {
+        ::close(devFd);
+    }
+    devFd = -1;
+    devIndex = -1;
+    clkid = CLOCK_INVALID;
+}
+
+static inline int result(int rc) {
+    return rc < 0 ? -errno : 0;
+}
+
+int PhcDevice::setNonblocking(bool enable) {
+    if (remote) {
+        return remote->setNonblocking(enable);
+    }
+    if (sim) {
+        return sim->setNonblocking(enable);
+    }
+    int flags = fcntl(devFd, F_GETFL);
+    if (flags < 0) {
+        return -errno;
+    }
+    flags = enable ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    return result(fcntl(devFd, F_SETFL, flags));
+}
+
+int PhcDevice::getCaps(struct ptp_clock_caps *caps) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_GETCAPS);
+    if (remote) {
+        return remote->getCaps(caps);
+    }
+    if (sim) {
+        return sim->getCaps(caps);
+    }
+    memset(caps, 0, sizeof(*caps));
+    return result(ioctl(devFd, PTP_CLOCK_GETCAPS, caps));
+}
+
+int PhcDevice::getTime(struct timespec *ts) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_GETTIME);
+    if (remote) {
+        return remote->getTime(ts);
+    }
+    if (sim) {
+        return sim->getTime(ts);
+    }
+    return result(clock_gettime(clkid, ts));
+}
+
+int PhcDevice::setTime(const struct timespec *ts) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_SETTIME);
+    if (remote) {
+        return remote->setTime(ts);
+    }
+    if (sim) {
+        return sim->setTime(ts);
+    }
+    return result(clock_settime(clkid, ts));
+}
+
+int PhcDevice::adjustTime(int64_t ns) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_ADJTIME);
+    if (remote) {
+        return remote->adjustTime(ns);
+    }
+    if (sim) {
+        return sim->adjustTime(ns);
+    }
+    struct timex tx;
+    memset(&tx, 0, sizeof(tx));
+    tx.modes = ADJ_SETOFFSET | ADJ_NANO;
+    tx.time.tv_sec = ns / 1000000000LL;
+    tx.time.tv_usec = ns % 1000000000LL;
+    // The kernel requires a non-negative fractional part.
+    if (tx.time.tv_usec < 0) {
+        tx.time.tv_sec -= 1;
+        tx.time.tv_usec += 1000000000LL;
+    }
+    return result(clock_adjtime(clkid, &tx));
+}
+
+int PhcDevice::adjustFrequency(double ppb) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_ADJFREQ);
+    if (remote) {
+        return remote->adjustFrequency(ppb);
+    }
+    if (sim) {
+        return sim->adjustFrequency(ppb);
+    }
+    struct timex tx;
+    memset(&tx, 0, sizeof(tx));
+    tx.modes = ADJ_FREQUENCY;
+    tx.freq = ppbToScaledPpm(ppb);
+    return result(clock_adjtime(clkid, &tx));
+}
+
+int PhcDevice::readFrequency(double *ppb) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_READFREQ);
+    if (remote) {
+        return remote->readFrequency(ppb);
+    }
+    if (sim) {
+        return sim->readFrequency(ppb);
+    }
+    struct timex tx;
+    memset(&tx, 0, sizeof(tx));
+    int err = result(clock_adjtime(clkid, &tx));
+    if (!err) {
+        *ppb = tx.freq / 65.536;
+    }
+    return err;
+}
+
+int PhcDevice::sysOffset(struct ptp_sys_offset *req) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_SYS_OFFSET);
+    if (remote) {
+        return remote->sysOffset(req);
+    }
+    if (sim) {
+        return sim->sysOffset(req);
+    }
+    return result(ioctl(devFd, PTP_SYS_OFFSET, req));
+}
+
+int PhcDevice::sysOffsetExtended(struct ptp_sys_offset_extended *req) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_SYS_OFFSET_EXTENDED);
+    if (remote) {
+        return remote->sysOffsetExtended(req);
+    }
+    if (sim) {
+        return sim->sysOffsetExtended(req);
+    }
+    return result(ioctl(devFd, PTP_SYS_OFFSET_EXTENDED, req));
+}
+
+int PhcDevice::sysOffsetPrecise(struct ptp_sys_offset_precise *req) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_SYS_OFFSET_PRECISE);
+    if (remote) {
+        return remote->sysOffsetPrecise(req);
+    }
+    if (sim) {
+        return sim->sysOffsetPrecise(req);
+    }
+    return result(ioctl(devFd, PTP_SYS_OFFSET_PRECISE, req));
+}
+
+int PhcDevice::sampleOffset(int samples, PhcOffsetSample *best) const {
+    struct ptp_sys_offset sysoff;
+    memset(&sysoff, 0, sizeof(sysoff));
+    sysoff.n_samples = samples;
+    int err = sysOffset(&sysoff);
+    if (err) {
+        return err;
+    }
+
+    best->delay_ns = INT64_MAX;
+    for (unsigned int i = 0; i < sysoff.n_samples; i++) {
+        int64_t t1 = toNs(&sysoff.ts[2 * i]);
+        int64_t tp = toNs(&sysoff.ts[2 * i + 1]);
+        int64_t t2 = toNs(&sysoff.ts[2 * i + 2]);
+        if (t2 - t1 < best->delay_ns) {
+            best->delay_ns = t2 - t1;
+            best->sys_ns = t1 + (t2 - t1) / 2;
+            best->phc_ns = tp;
+        }
+    }
+    return 0;
+}
+
+int PhcDevice::enableExtts(unsigned int channel, unsigned int flags) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_EXTTS_REQUEST);
+    if (remote) {
+        return remote->enableExtts(channel, flags, true);
+    }
+    if (sim) {
+        return sim->enableExtts(channel, true);
+    }
+    struct ptp_extts_request req;
+    memset(&req, 0, sizeof(req));
+    req.index = channel;
+    req.flags = flags | PTP_ENABLE_FEATURE;
+    return result(ioctl(devFd, PTP_EXTTS_REQUEST, &req));
+}
+
+int PhcDevice::disableExtts(unsigned int channel) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_EXTTS_REQUEST);
+    if (remote) {
+        return remote->enableExtts(channel, 0, false);
+    }
+    if (sim) {
+        return sim->enableExtts(channel, false);
+    }
+    struct ptp_extts_request req;
+    memset(&req, 0, sizeof(req));
+    req.index = channel;
+    return result(ioctl(devFd, PTP_EXTTS_REQUEST, &req));
+}
+
+int PhcDevice::readExtts(struct ptp_extts_event *events, int max) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_EXTTS_READ);
+    if (remote) {
+        return remote->readExtts(events, max);
+    }
+    if (sim) {
+        return sim->readExtts(events, max);
+    }
+    ssize_t cnt = read(devFd, events, max * sizeof(*events));
+    if (cnt < 0) {
+        return -errno;
+    }
+    return (int)(cnt / sizeof(*events));
+}
+
+int PhcDevice::setPerout(const struct ptp_perout_request *req) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_PEROUT);
+    if (remote) {
+        return remote->setPerout(req);
+    }
+    if (sim) {
+        return sim->setPerout(req);
+    }
+    // Drivers that predate PTP_PEROUT_REQUEST2 only accept flag-less
+    // requests on the original ioctl.
+    unsigned long cmd = req->flags ? PTP_PEROUT_REQUEST2 : PTP_PEROUT_REQUEST;
+    return result(ioctl(devFd, cmd, req));
+}
+
+int PhcDevice::getPin(struct ptp_pin_desc *desc) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_PIN);
+    if (remote) {
+        return remote->getPin(desc);
+    }
+    if (sim) {
+        return sim->getPin(desc);
+    }
+    return result(ioctl(devFd, PTP_PIN_GETFUNC, desc));
+}
+
+int PhcDevice::setPin(unsigned int index, unsigned int func, unsigned int chan) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_PIN);
+    if (remote) {
+        return remote->setPin(index, func, chan);
+    }
+    if (sim) {
+        return sim->setPin(index, func, chan);
+    }
+    struct ptp_pin_desc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.index = index;
+    desc.func = func;
+    desc.chan = chan;
+    return result(ioctl(devFd, PTP_PIN_SETFUNC, &desc));
+}
+
+int PhcDevice::enablePps(bool enable) const {
+    PHC_TRACE_SCOPE(PHC_TRACE_PPS);
+    if (remote) {
+        return remote->enablePps(enable);
+    }
+    if (sim) {
+        return sim->enablePps(enable);
+    }
+    return result(ioctl(devFd, PTP_ENABLE_PPS, enable ? 1 : 0));
+}
+
+int PhcDevice::subscribeOffset(unsigned int interval_ms, unsigned int samples) const {
+    if (!remote) {
+        return -EOPNOTSUPP;
+    }
+    return remote->subscribeOffset(interval_ms, samples);
+}
+
+int PhcDevice::readOffset(PhcOffsetSample *sample) const {
+    if (!remote) {
+        return -EOPNOTSUPP;
+    }
+    return remote->readOffset(sample);
+}
@@ -0,0 +1,150 @@
+/*
+ * ShiwaPTPTool - PHC device access library
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_DEVICE_H
+#define SHIWA_PHC_DEVICE_H
+
+#include <fcntl.h>
+#include <linux/ptp_clock.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <utility>
+
+class PhcRemote;
+class PhcSim;
+struct PhcSimConfig;
+
+// Best sample of a PTP_SYS_OFFSET measurement: the one with the shortest
+// system clock read window.
+struct PhcOffsetSample {
+    int64_t sys_ns;    // CLOCK_REALTIME at the middle of the read window
+    int64_t phc_ns;    // PHC time
+    int64_t delay_ns;  // width of the system clock read window
+};
+
+// Handle to one /dev/ptpN character device.
+//
+// The API is meant to be linked into latency-sensitive programs: nothing
+// throws, nothing allocates, and every operation returns 0 (or a count) on
+// success and a negative errno on failure. The handle owns the descriptor
+// and closes it on destruction.
+//
+// openSim() backs the handle with a software clock (phc_sim.h) instead of a
+// character device; every call below then works without hardware or root,
+// except that clockId() is CLOCK_INVALID.
+//
+// openRemote() forwards every call to a device kept open by the daemon
+// (phc_daemon.h) over its Unix socket; clockId() is CLOCK_INVALID as well
+// and fd() is the socket, readable when pushed events arrive.
+class PhcDevice {
+public:
+    static const clockid_t CLOCK_INVALID = -1;
+
+    PhcDevice() = default;
+    ~PhcDevice() { close(); }
+
+    PhcDevice(const PhcDevice &) = delete;
+    PhcDevice &operator=(const PhcDevice &) = delete;
+
+    int open(int index, int flags = O_RDWR);
+    int openPath(const char *path, int flags = O_RDWR);
+    int openSim(int index, const PhcSimConfig &config, int flags = O_RDWR);
+    int openRemote(const char *path, int index, bool simulated, int flags = O_RDWR);
+    void close();
+
+    // Exchanges the open handles of two devices, e.g. to lend a device to
+    // another owner for a while.
+    void swap(PhcDevice &other) {
+        std::swap(devFd, other.devFd);
+        std::swap(devIndex, other.devIndex);
+        std::swap(clkid, other.clkid);
+        std::swap(sim, other.sim);
+        std::swap(remote, other.remote);
+    }
+
+    // Character devices ignore O_NONBLOCK for read(), so event loops must
+    // read once per readiness notification. The simulator honours it.
+    int setNonblocking(bool enable);
+
+    bool isOpen() const { return devFd >= 0; }
+    bool isSimulated() const { return sim != nullptr; }
+    bool isRemote() const { return remote != nullptr; }
+    int fd() const { return devFd; }
+    int index() const { return devIndex; }
+    clockid_t clockId() const { return clkid; }
+
+    // Clock
+    int getCaps(struct ptp_clock_caps *caps) const;
+    int getTime(struct timespec *ts) const;
+    int setTime(const struct timespec *ts) const;
+    int adjustTime(int64_t ns) const;
+    int adjustFrequency(double ppb) const;
+    int readFrequency(double *ppb) const;
+
+    // Offset to the system clock
+    int sysOffset(struct ptp_sys_offset *req) const;
+    int sysOffsetExtended(struct ptp_sys_offset_extended *req) const;
+    int sysOffsetPrecise(struct ptp_sys_offset_precise *req) const;
+    int sampleOffset(int samples, PhcOffsetSample *best) const;
+
+    // External timestamps. readExtts() returns the number of events read.
+    int enableExtts(unsigned int channel, unsigned int flags) const;
+    int disableExtts(unsigned int channel) const;
+    int readExtts(struct ptp_extts_event *events, int max) const;
+
+    // Periodic output, pins and PPS
+    int setPerout(const struct ptp_perout_request *req) const;
+    int getPin(struct ptp_pin_desc *desc) const;
+    int setPin(unsigned int index, unsigned int func, unsigned int chan) const;
+    int enablePps(bool enable) const;
+
+    // Offset stream pushed by the daemon; -EOPNOTSUPP on local devices.
+    int subscribeOffset(unsigned int interval_ms, unsigned int samples) const;
+    int readOffset(PhcOffsetSample *sample) const;
+
+    static clockid_t fdToClockId(int fd) { return (~(clockid_t)fd << 3) | 3; }
+    static int64_t toNs(const struct ptp_clock_time *t) {
+        return t->sec * 1000000000LL + t->nsec;
+    }
+    static int64_t toNs(const struct timespec *ts) {
+        return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+    }
+    static struct ptp_clock_time fromNs(int64_t ns) {
+        struct ptp_clock_time t = {};
+        t.sec = ns / 1000000000LL;
+        t.nsec = (uint32_t)(ns % 1000000000LL);
+        return t;
+    }
+    // First instant at or after 'ns' on the grid phase + k * period
+    // (PHC time, k integer), i.e. the next edge of an output with that
+    // period on the PTP epoch grid shifted by 'phase'. The grid is only
+    // aligned to the second when the period divides 1 s or is a multiple
+    // of it.
+    static int64_t nextEdge(int64_t ns, int64_t period, int64_t phase) {
+        int64_t k = (ns - phase) / period;
+        int64_t edge = phase + k * period;
+        return edge < ns ? edge + period : edge;
+    }
+    static long ppbToScaledPpm(double ppb) {
+        // The timex 'freq' field is ppm with a 16 bit binary fraction.
+        return (long)(ppb * 65.536);
+    }
+
+private:
+    int devFd = -1;
+    int devIndex = -1;
+    clockid_t clkid = CLOCK_INVALID;
+    PhcSim *sim = nullptr;
+    PhcRemote *remote = nullptr;
+};
+
+#endif // SHIWA_PHC_DEVICE_H
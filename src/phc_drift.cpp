@@ -0,0 +1,124 @@
+/*
+ * ShiwaPTPTool - Sliding-window PHC drift estimation
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "phc_drift.h"
+
+#include <math.h>
+#include <string.h>
+
+// Four doubles per step: one AVX register, or two SSE2 registers on the
+// baseline x86-64 build. On x86-64 the kernel is also cloned for AVX2 and
+// the dynamic loader picks the variant the CPU supports.
+typedef double PhcVec __attribute__((vector_size(32)));
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define PHC_FIT_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define PHC_FIT_CLONES
+#endif
+
+#define PHC_VEC_SUM(v) ((v)[0] + (v)[1] + (v)[2] + (v)[3])
+
+PHC_FIT_CLONES
+bool phcFitLine(const double *x, const double *y, size_t n, PhcLineFit *fit) {
+    if (n < 2) {
+        return false;
+    }
+    const size_t lanes = sizeof(PhcVec) / sizeof(double);
+
+    PhcVec vx, vy, sx = {}, sy = {};
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        memcpy(&vx, x + i, sizeof(vx));
+        memcpy(&vy, y + i, sizeof(vy));
+        sx += vx;
+        sy += vy;
+    }
+    double mx = PHC_VEC_SUM(sx), my = PHC_VEC_SUM(sy);
+    for (; i < n; i++) {
+        mx += x[i];
+        my += y[i];
+    }
+    mx /= n;
+    my /= n;
+
+    // Centred sums keep the precision when x carries a large offset.
+    PhcVec cx = {mx, mx, mx, mx}, cy = {my, my, my, my};
+    PhcVec vxx = {}, vxy = {}, vyy = {};
+    for (i = 0; i + lanes <= n; i += lanes) {
+        memcpy(&vx, x + i, sizeof(vx));
+        memcpy(&vy, y + i, sizeof(vy));
+        PhcVec dx = vx - cx, dy = vy - cy;
+        vxx += dx * dx;
+        vxy += dx * dy;
+        vyy += dy * dy;
+    }
+    double sxx = PHC_VEC_SUM(vxx), sxy = PHC_VEC_SUM(vxy), syy = PHC_VEC_SUM(vyy);
+    for (; i < n; i++) {
+        double dx = x[i] - mx, dy = y[i] - my;
+        sxx += dx * dx;
+        sxy += dx * dy;
+        syy += dy * dy;
+    }
+    if (sxx <= 0) {
+        return false;
+    }
+
+    fit->slope = sxy / sxx;
+    fit->intercept = my - fit->slope * mx;
+    double ss = fmax(syy - fit->slope * sxy, 0.0);
+    fit->residual = sqrt(ss / n);
+    fit->slopeError = n > 2 ? sqrt(ss / (n - 2) / sxx) : 0;
+    fit->n = n;
+    return true;
+}
+
+PhcDriftEstimator::PhcDriftEstimator(size_t window)
+    : window(window < 3 ? 3 : window), t(2 * this->window), off(2 * this->window) {}
+
+void PhcDriftEstimator::reset() {
+    head = 0;
+    count = 0;
+}
+
+void PhcDriftEstimator::add(const PhcOffsetSample &sample) {
+    int64_t offset = sample.phc_ns - sample.sys_ns;
+    if (!count) {
+        sys0 = sample.sys_ns;
+        offset0 = offset;
+    }
+    double ts = (sample.sys_ns - sys0) * 1e-9;
+    double os = (double)(offset - offset0);
+    t[head] = t[head + window] = ts;
+    off[head] = off[head + window] = os;
+    head = (head + 1) % window;
+    if (count < window) {
+        count++;
+    }
+}
+
+bool PhcDriftEstimator::estimate(Estimate *out) const {
+    if (count < 3) {
+        return false;
+    }
+    size_t first = head + window - count;
+    PhcLineFit fit;
+    if (!phcFitLine(&t[first], &off[first], count, &fit)) {
+        return false;
+    }
+    // The offset is in ns and the time in s, so the slope is in ppb.
+    const double newest = t[head + window - 1];
+    out->ppb = fit.slope;
+    out->ppbError = 3 * fit.slopeError;
+    out->residual = fit.residual;
+    out->offset = offset0 + (int64_t)llround(fit.intercept + fit.slope * newest);
+    out->samples = count;
+    return true;
+}
@@ -0,0 +1,68 @@
+/*
+ * ShiwaPTPTool - Sliding-window PHC drift estimation
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_DRIFT_H
+#define SHIWA_PHC_DRIFT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "phc_device.h"
+
+// Least-squares fit of y = intercept + slope * x.
+struct PhcLineFit {
+    double slope;
+    double intercept;
+    double slopeError;  // standard error of 'slope' (1 sigma)
+    double residual;    // RMS of the residuals
+    size_t n;
+};
+
+// Fits 'n' points in two vectorized passes (means, then centred sums).
+// Returns false for fewer than two points or constant x.
+bool phcFitLine(const double *x, const double *y, size_t n, PhcLineFit *fit);
+
+// Frequency error of the PHC against CLOCK_REALTIME, fitted over the last
+// 'window' offset samples. Samples are stored twice in a ring of twice
+// the window so the fitted window is always one contiguous run and the
+// kernel never has to handle the wrap.
+class PhcDriftEstimator {
+public:
+    struct Estimate {
+        double ppb;        // PHC frequency error
+        double ppbError;   // 3-sigma uncertainty of 'ppb'
+        double residual;   // RMS offset residual (ns)
+        int64_t offset;    // fitted PHC - system offset at the newest sample (ns)
+        size_t samples;
+    };
+
+    explicit PhcDriftEstimator(size_t window);
+
+    void add(const PhcOffsetSample &sample);
+    void reset();
+
+    // Returns false until the window holds at least three samples.
+    bool estimate(Estimate *out) const;
+
+    size_t size() const { return count; }
+
+private:
+    size_t window;
+    std::vector<double> t;    // seconds since the first sample
+    std::vector<double> off;  // offset change since the first sample (ns)
+    size_t head = 0;
+    size_t count = 0;
+    int64_t sys0 = 0;
+    int64_t offset0 = 0;
+};
+
+#endif // SHIWA_PHC_DRIFT_H
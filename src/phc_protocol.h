@@ -0,0 +1,116 @@
+/*
+ * ShiwaPTPTool - PHC daemon wire protocol
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_PROTOCOL_H
+#define SHIWA_PHC_PROTOCOL_H
+
+#include <linux/ptp_clock.h>
+#include <stdint.h>
+
+// Requests and responses travel over an AF_UNIX SOCK_SEQPACKET socket, one
+// message per packet, so there is no framing beyond the header. Each
+// connection serves one device, selected by PHC_OP_OPEN before anything
+// else. Every request is answered by exactly one response with the same op
+// and sequence number; 'status' is 0 or a negative errno and the payload
+// mirrors the matching PhcDevice call. PHC_PUSH_* messages are sent
+// unsolicited for subscriptions and may arrive between a request and its
+// response. Structures are in host byte order: the socket is local.
+
+#define PHC_PROTOCOL_VERSION 1
+#define PHC_DEFAULT_SOCKET "/run/shiwaptptool.sock"
+
+enum PhcOp : uint16_t {
+    PHC_OP_OPEN = 1,
+    PHC_OP_GETCAPS,
+    PHC_OP_GETTIME,
+    PHC_OP_SETTIME,
+    PHC_OP_ADJTIME,
+    PHC_OP_ADJFREQ,
+    PHC_OP_READFREQ,
+    PHC_OP_SYS_OFFSET,
+    PHC_OP_SYS_OFFSET_EXTENDED,
+    PHC_OP_SYS_OFFSET_PRECISE,
+    PHC_OP_EXTTS,
+    PHC_OP_PEROUT,
+    PHC_OP_GETPIN,
+    PHC_OP_SETPIN,
+    PHC_OP_PPS,
+    PHC_OP_SUBSCRIBE_OFFSET,
+
+    PHC_PUSH_EXTTS = 0x100,  // struct ptp_extts_event
+    PHC_PUSH_OFFSET,         // struct PhcOffsetSample
+};
+
+struct PhcMsgHeader {
+    uint16_t op;
+    uint16_t version;
+    uint32_t seq;
+    int32_t status;          // responses only
+    uint32_t reserved;
+};
+
+// PHC_OP_OPEN
+#define PHC_OPEN_SIM 1       // a simulated clock (sim:N) of the daemon
+struct PhcOpenRequest {
+    int32_t index;
+    uint32_t flags;
+};
+
+// PHC_OP_GETTIME (response), PHC_OP_SETTIME
+struct PhcTimeMsg {
+    int64_t sec;
+    int64_t nsec;
+};
+
+// PHC_OP_ADJTIME
+struct PhcAdjTimeMsg {
+    int64_t ns;
+};
+
+// PHC_OP_ADJFREQ, PHC_OP_READFREQ (response)
+struct PhcFreqMsg {
+    double ppb;
+};
+
+// PHC_OP_EXTTS: enables the channel for this connection; events of every
+// enabled channel are pushed as PHC_PUSH_EXTTS. The device channel stays
+// enabled while any connection has it enabled.
+struct PhcExttsRequest {
+    uint32_t channel;
+    uint32_t flags;
+    uint32_t enable;
+};
+
+// PHC_OP_SYS_OFFSET*, PHC_OP_PEROUT and PHC_OP_GETPIN carry the kernel
+// structures (ptp_sys_offset, ptp_perout_request, ptp_pin_desc) both ways.
+
+// PHC_OP_SETPIN
+struct PhcPinRequest {
+    uint32_t index;
+    uint32_t func;
+    uint32_t chan;
+};
+
+// PHC_OP_PPS
+struct PhcPpsRequest {
+    uint32_t enable;
+};
+
+// PHC_OP_SUBSCRIBE_OFFSET: the daemon pushes the best of 'samples'
+// PTP_SYS_OFFSET readings every 'interval_ms'; 0 cancels.
+struct PhcOffsetSubscribe {
+    uint32_t interval_ms;
+    uint32_t samples;
+};
+
+// Upper bound of any message; the largest payload is ptp_sys_offset_extended.
+#define PHC_MAX_MESSAGE 2048
+
+#endif // SHIWA_PHC_PROTOCOL_H
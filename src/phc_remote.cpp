@@ -0,0 +1,291 @@
+/*
+ * ShiwaPTPTool - PHC daemon client
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "phc_remote.h"
+#include "phc_protocol.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+PhcRemote::~PhcRemote() {
+    for (int fd : {pollFd, pendingFd, sock}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+int PhcRemote::connect(const char *path, int index, bool simulated, bool nonblock) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -errno;
+    }
+    if (::connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+        int err = -errno;
+        close(sock);
+        sock = -1;
+        return err;
+    }
+    this->nonblock = nonblock;
+
+    pendingFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (pendingFd < 0 || pollFd < 0) {
+        return -errno;
+    }
+    for (int fd : {sock, pendingFd}) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &ev)) {
+            return -errno;
+        }
+    }
+
+    PhcOpenRequest req = {index, simulated ? PHC_OPEN_SIM : 0u};
+    return call(PHC_OP_OPEN, &req, sizeof(req), nullptr, 0);
+}
+
+int PhcRemote::setNonblocking(bool enable) {
+    nonblock = enable;
+    return 0;
+}
+
+// Reads one message. Pushed events are queued and return 0; a response
+// returns 1 with its payload copied to 'resp'.
+int PhcRemote::receive(bool wait, uint32_t *seqOut, void *resp, size_t respLen, int *status) {
+    char buf[PHC_MAX_MESSAGE];
+    ssize_t n = recv(sock, buf, sizeof(buf), wait ? 0 : MSG_DONTWAIT);
+    if (n < 0) {
+        return -errno;
+    }
+    if (n == 0) {
+        return -ECONNRESET;
+    }
+    if ((size_t)n < sizeof(PhcMsgHeader)) {
+        return -EPROTO;
+    }
+    PhcMsgHeader hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    const char *payload = buf + sizeof(hdr);
+    size_t len = n - sizeof(hdr);
+
+    if (hdr.op == PHC_PUSH_EXTTS && len >= sizeof(struct ptp_extts_event)) {
+        if (exttsCount == EXTTS_QUEUE) {
+            drops++;
+            return 0;
+        }
+        memcpy(&extts[(exttsHead + exttsCount++) % EXTTS_QUEUE], payload,
+               sizeof(struct ptp_extts_event));
+        updatePending();
+        return 0;
+    }
+    if (hdr.op == PHC_PUSH_OFFSET && len >= sizeof(PhcOffsetSample)) {
+        if (offsetCount == OFFSET_QUEUE) {
+            drops++;
+            return 0;
+        }
+        memcpy(&offsets[(offsetHead + offsetCount++) % OFFSET_QUEUE], payload,
+               sizeof(PhcOffsetSample));
+        updatePending();
+        return 0;
+    }
+    if (hdr.op >= PHC_PUSH_EXTTS) {
+        return 0;
+    }
+
+    *seqOut = hdr.seq;
+    *status = hdr.status;
+    if (resp && hdr.status == 0) {
+        if (len < respLen) {
+            return -EPROTO;
+        }
+        memcpy(resp, payload, respLen);
+    }
+    return 1;
+}
+
+// Keeps the eventfd readable exactly while a ring holds events.
+void PhcRemote::updatePending() {
+    bool queued = exttsCount || offsetCount;
+    if (queued == pending) {
+        return;
+    }
+    uint64_t value = 1;
+    ssize_t rc = queued ? write(pendingFd, &value, sizeof(value))
+                        : read(pendingFd, &value, sizeof(value));
+    if (rc == sizeof(value)) {
+        pending = queued;
+    }
+}
+
+int PhcRemote::call(uint16_t op, const void *req, size_t reqLen, void *resp, size_t respLen) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (sock < 0) {
+        return -EBADF;
+    }
+
+    char buf[PHC_MAX_MESSAGE];
+    PhcMsgHeader hdr = {op, PHC_PROTOCOL_VERSION, ++seq, 0, 0};
+    memcpy(buf, &hdr, sizeof(hdr));
+    if (reqLen) {
+        memcpy(buf + sizeof(hdr), req, reqLen);
+    }
+    if (send(sock, buf, sizeof(hdr) + reqLen, MSG_NOSIGNAL) < 0) {
+        return errno == EPIPE ? -ECONNRESET : -errno;
+    }
+
+    for (;;) {
+        uint32_t got;
+        int status;
+        int r = receive(true, &got, resp, respLen, &status);
+        if (r < 0) {
+            return r;
+        }
+        if (r == 1 && got == seq) {
+            return status;
+        }
+    }
+}
+
+int PhcRemote::getCaps(struct ptp_clock_caps *caps) {
+    return call(PHC_OP_GETCAPS, nullptr, 0, caps, sizeof(*caps));
+}
+
+int PhcRemote::getTime(struct timespec *ts) {
+    PhcTimeMsg msg;
+    int err = call(PHC_OP_GETTIME, nullptr, 0, &msg, sizeof(msg));
+    if (!err) {
+        ts->tv_sec = msg.sec;
+        ts->tv_nsec = msg.nsec;
+    }
+    return err;
+}
+
+int PhcRemote::setTime(const struct timespec *ts) {
+    PhcTimeMsg msg = {ts->tv_sec, ts->tv_nsec};
+    return call(PHC_OP_SETTIME, &msg, sizeof(msg), nullptr, 0);
+}
+
+int PhcRemote::adjustTime(int64_t ns) {
+    PhcAdjTimeMsg msg = {ns};
+    return call(PHC_OP_ADJTIME, &msg, sizeof(msg), nullptr, 0);
+}
+
+int PhcRemote::adjustFrequency(double ppb) {
+    PhcFreqMsg msg = {ppb};
+    return call(PHC_OP_ADJFREQ, &msg, sizeof(msg), nullptr, 0);
+}
+
+int PhcRemote::readFrequency(double *ppb) {
+    PhcFreqMsg msg;
+    int err = call(PHC_OP_READFREQ, nullptr, 0, &msg, sizeof(msg));
+    if (!err) {
+        *ppb = msg.ppb;
+    }
+    return err;
+}
+
+int PhcRemote::sysOffset(struct ptp_sys_offset *req) {
+    return call(PHC_OP_SYS_OFFSET, req, sizeof(*req), req, sizeof(*req));
+}
+
+int PhcRemote::sysOffsetExtended(struct ptp_sys_offset_extended *req) {
+    return call(PHC_OP_SYS_OFFSET_EXTENDED, req, sizeof(*req), req, sizeof(*req));
+}
+
+int PhcRemote::sysOffsetPrecise(struct ptp_sys_offset_precise *req) {
+    return call(PHC_OP_SYS_OFFSET_PRECISE, req, sizeof(*req), req, sizeof(*req));
+}
+
+int PhcRemote::enableExtts(unsigned int channel, unsigned int flags, bool enable) {
+    PhcExttsRequest msg = {channel, flags, enable ? 1u : 0u};
+    return call(PHC_OP_EXTTS, &msg, sizeof(msg), nullptr, 0);
+}
+
+int PhcRemote::readExtts(struct ptp_extts_event *events, int max) {
+    std::lock_guard<std::mutex> guard(lock);
+    while (!exttsCount) {
+        uint32_t got;
+        int status;
+        int r = receive(!nonblock, &got, nullptr, 0, &status);
+        if (r < 0) {
+            return r;
+        }
+    }
+    // Collect what else has already arrived, one event per packet
+    while ((int)exttsCount < max) {
+        uint32_t got;
+        int status;
+        if (receive(false, &got, nullptr, 0, &status) < 0) {
+            break;
+        }
+    }
+    int n = 0;
+    for (; n < max && exttsCount; n++, exttsCount--) {
+        events[n] = extts[exttsHead];
+        exttsHead = (exttsHead + 1) % EXTTS_QUEUE;
+    }
+    updatePending();
+    return n;
+}
+
+int PhcRemote::setPerout(const struct ptp_perout_request *req) {
+    return call(PHC_OP_PEROUT, req, sizeof(*req), nullptr, 0);
+}
+
+int PhcRemote::getPin(struct ptp_pin_desc *desc) {
+    return call(PHC_OP_GETPIN, desc, sizeof(*desc), desc, sizeof(*desc));
+}
+
+int PhcRemote::setPin(unsigned int index, unsigned int func, unsigned int chan) {
+    PhcPinRequest msg = {index, func, chan};
+    return call(PHC_OP_SETPIN, &msg, sizeof(msg), nullptr, 0);
+}
+
+int PhcRemote::enablePps(bool enable) {
+    PhcPpsRequest msg = {enable ? 1u : 0u};
+    return call(PHC_OP_PPS, &msg, sizeof(msg), nullptr, 0);
+}
+
+int PhcRemote::subscribeOffset(unsigned int interval_ms, unsigned int samples) {
+    PhcOffsetSubscribe msg = {interval_ms, samples};
+    return call(PHC_OP_SUBSCRIBE_OFFSET, &msg, sizeof(msg), nullptr, 0);
+}
+
+int PhcRemote::readOffset(PhcOffsetSample *sample) {
+    std::lock_guard<std::mutex> guard(lock);
+    while (!offsetCount) {
+        uint32_t got;
+        int status;
+        int r = receive(!nonblock, &got, nullptr, 0, &status);
+        if (r < 0) {
+            return r;
+        }
+    }
+    *sample = offsets[offsetHead];
+    offsetHead = (offsetHead + 1) % OFFSET_QUEUE;
+    offsetCount--;
+    updatePending();
+    return 0;
+}
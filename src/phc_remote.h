@@ -0,0 +1,94 @@
+/*
+ * ShiwaPTPTool - PHC daemon client
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_REMOTE_H
+#define SHIWA_PHC_REMOTE_H
+
+#include <linux/ptp_clock.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <mutex>
+
+#include "phc_device.h"
+
+// One device served by the daemon (phc_daemon.h) over its Unix socket.
+// Every operation mirrors the matching PhcDevice call and returns 0 or a
+// negative errno; a lost connection reports -ECONNRESET.
+//
+// Pushed events are queued in fixed rings while a call waits for its
+// response and handed out by readExtts() / readOffset(). The descriptor
+// is an epoll instance over the socket and an eventfd that stays readable
+// while a ring holds events, so event loops can poll it like a character
+// device and still see events a call has already taken off the socket.
+// Calls are serialized, so a model refresh thread may share the handle.
+class PhcRemote {
+public:
+    PhcRemote() = default;
+    ~PhcRemote();
+
+    PhcRemote(const PhcRemote &) = delete;
+    PhcRemote &operator=(const PhcRemote &) = delete;
+
+    int connect(const char *path, int index, bool simulated, bool nonblock);
+
+    int fd() const { return pollFd; }
+    int setNonblocking(bool enable);
+
+    int getCaps(struct ptp_clock_caps *caps);
+    int getTime(struct timespec *ts);
+    int setTime(const struct timespec *ts);
+    int adjustTime(int64_t ns);
+    int adjustFrequency(double ppb);
+    int readFrequency(double *ppb);
+
+    int sysOffset(struct ptp_sys_offset *req);
+    int sysOffsetExtended(struct ptp_sys_offset_extended *req);
+    int sysOffsetPrecise(struct ptp_sys_offset_precise *req);
+
+    int enableExtts(unsigned int channel, unsigned int flags, bool enable);
+    int readExtts(struct ptp_extts_event *events, int max);
+
+    int setPerout(const struct ptp_perout_request *req);
+    int getPin(struct ptp_pin_desc *desc);
+    int setPin(unsigned int index, unsigned int func, unsigned int chan);
+    int enablePps(bool enable);
+
+    int subscribeOffset(unsigned int interval_ms, unsigned int samples);
+    int readOffset(PhcOffsetSample *sample);
+
+    // Pushed messages dropped because a ring was full.
+    uint64_t dropped() const { return drops; }
+
+private:
+    static const int EXTTS_QUEUE = 256;
+    static const int OFFSET_QUEUE = 64;
+
+    int sock = -1;
+    int pendingFd = -1;            // eventfd, readable while events are queued
+    int pollFd = -1;
+    bool pending = false;
+    bool nonblock = false;
+    uint32_t seq = 0;
+    std::mutex lock;
+
+    struct ptp_extts_event extts[EXTTS_QUEUE];
+    unsigned int exttsHead = 0, exttsCount = 0;
+    PhcOffsetSample offsets[OFFSET_QUEUE];
+    unsigned int offsetHead = 0, offsetCount = 0;
+    uint64_t drops = 0;
+
+    int call(uint16_t op, const void *req, size_t reqLen, void *resp, size_t respLen);
+    int receive(bool wait, uint32_t *seqOut, void *resp, size_t respLen, int *status);
+    void updatePending();
+};
+
+#endif // SHIWA_PHC_REMOTE_H
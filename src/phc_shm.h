@@ -0,0 +1,146 @@
+/*
+ * ShiwaPTPTool - Shared-memory PHC time reader
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+/*
+ * Header-only reader for the PHC time page published by
+ * `shiwaptptool-cli -d N --publish-shm NAME`. The page lives in /dev/shm and
+ * holds the publisher's linear model of the PHC against CLOCK_MONOTONIC_RAW:
+ *
+ *   phc(raw) = raw + offset_ns + (raw - raw_ref) * (freq_ratio - 1)
+ *
+ * Readers map the page read-only and evaluate the model locally, so getting
+ * PHC time costs one vDSO clock read and no system call:
+ *
+ *   const struct phc_shm_page *page;
+ *   if (phc_shm_open("ptp0", &page) == 0) {
+ *       int64_t phc, err;
+ *       if (phc_shm_now(page, &phc, &err) == 0)
+ *           ...
+ *       phc_shm_close(page);
+ *   }
+ *
+ * The page is updated under a sequence lock: 'seq' is odd while the
+ * publisher writes and readers retry until they copy a stable snapshot.
+ * Only C and the GCC/Clang __atomic builtins are used so the header can be
+ * included from C programs too.
+ */
+
+#ifndef SHIWA_PHC_SHM_H
+#define SHIWA_PHC_SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PHC_SHM_MAGIC 0x53434850u /* "PHCS" */
+#define PHC_SHM_VERSION 1
+
+/* A page is stale once it missed this many publication intervals. */
+#define PHC_SHM_STALE_INTERVALS 4
+
+struct phc_shm_mapping {
+    int64_t raw_ref;        /* CLOCK_MONOTONIC_RAW at the reference point (ns) */
+    int64_t offset_ns;      /* PHC minus CLOCK_MONOTONIC_RAW at raw_ref (ns) */
+    double freq_ratio;      /* PHC ns per CLOCK_MONOTONIC_RAW ns */
+    double ratio_error;     /* 3-sigma uncertainty of freq_ratio */
+    int64_t base_error_ns;  /* uncertainty at raw_ref (ns) */
+    uint64_t update_seq;    /* publisher update counter, 0 = not yet valid */
+    int64_t interval_ns;    /* publication interval (ns) */
+};
+
+struct phc_shm_page {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    int32_t device;         /* PHC index the publisher reads */
+    struct phc_shm_mapping mapping;
+    char pad[4096 - 16 - sizeof(struct phc_shm_mapping)];
+};
+
+static inline int64_t phc_shm_raw_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Maps /dev/shm/<name>. Returns 0 or a negative errno. */
+static inline int phc_shm_open(const char *name, const struct phc_shm_page **page) {
+    char path[256] = "/";
+    strncat(path, name, sizeof(path) - 2);
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+    void *addr = mmap(NULL, sizeof(struct phc_shm_page), PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return -err;
+    }
+    const struct phc_shm_page *p = (const struct phc_shm_page *)addr;
+    if (p->magic != PHC_SHM_MAGIC || p->version != PHC_SHM_VERSION) {
+        munmap(addr, sizeof(struct phc_shm_page));
+        return -EPROTO;
+    }
+    *page = p;
+    return 0;
+}
+
+static inline void phc_shm_close(const struct phc_shm_page *page) {
+    munmap((void *)page, sizeof(struct phc_shm_page));
+}
+
+/* Copies a consistent snapshot of the mapping. Returns 0, -EAGAIN before the
+ * first update or -ESTALE when the publisher stopped updating (the snapshot
+ * is still filled in). */
+static inline int phc_shm_read(const struct phc_shm_page *page, struct phc_shm_mapping *out) {
+    uint32_t s1, s2;
+    do {
+        s1 = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        memcpy(out, (const void *)&page->mapping, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+    } while ((s1 & 1) || s1 != s2);
+
+    if (!out->update_seq) {
+        return -EAGAIN;
+    }
+    if (phc_shm_raw_now() - out->raw_ref > PHC_SHM_STALE_INTERVALS * out->interval_ns) {
+        return -ESTALE;
+    }
+    return 0;
+}
+
+/* Evaluates the mapping at a CLOCK_MONOTONIC_RAW time. */
+static inline void phc_shm_at(const struct phc_shm_mapping *m, int64_t raw_ns,
+                              int64_t *phc_ns, int64_t *error_ns) {
+    int64_t dt = raw_ns - m->raw_ref;
+    double drift = (double)dt * (m->freq_ratio - 1.0);
+    *phc_ns = raw_ns + m->offset_ns + (int64_t)drift;
+    *error_ns = m->base_error_ns + (int64_t)((dt < 0 ? -dt : dt) * m->ratio_error);
+}
+
+/* Current PHC time and its error bound. Same return values as phc_shm_read. */
+static inline int phc_shm_now(const struct phc_shm_page *page, int64_t *phc_ns,
+                              int64_t *error_ns) {
+    struct phc_shm_mapping m;
+    int err = phc_shm_read(page, &m);
+    if (err == -EAGAIN) {
+        return err;
+    }
+    phc_shm_at(&m, phc_shm_raw_now(), phc_ns, error_ns);
+    return err;
+}
+
+#endif /* SHIWA_PHC_SHM_H */
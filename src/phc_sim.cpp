@@ -0,0 +1,430 @@
+/*
+ * ShiwaPTPTool - Simulated PHC device
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "phc_sim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// Pulses older than this many periods are dropped, like a full driver queue.
+static const int64_t EXTTS_QUEUE = 128;
+
+// Channel n pulses n microseconds after channel 0.
+static const int64_t CHANNEL_SKEW_NS = 1000;
+
+static int64_t readClock(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void toClockTime(int64_t ns, struct ptp_clock_time *t) {
+    t->sec = ns / 1000000000LL;
+    t->nsec = (uint32_t)(ns % 1000000000LL);
+    t->reserved = 0;
+}
+
+static int64_t floorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+bool PhcSimConfig::parse(const char *spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char *save = nullptr;
+    for (char *item = strtok_r(buf, ",", &save); item; item = strtok_r(nullptr, ",", &save)) {
+        char *value = strchr(item, '=');
+        if (!value) {
+            fprintf(stderr, "Invalid simulator setting '%s' (expected key=value)\n", item);
+            return false;
+        }
+        *value++ = '\0';
+        if (!strcmp(item, "offset")) {
+            offset = atoll(value);
+        } else if (!strcmp(item, "freq")) {
+            freq = atof(value);
+        } else if (!strcmp(item, "noise")) {
+            noise = atoll(value);
+        } else if (!strcmp(item, "latency")) {
+            latency = atoll(value);
+        } else if (!strcmp(item, "period")) {
+            period = atoll(value);
+        } else if (!strcmp(item, "jitter")) {
+            jitter = atoll(value);
+        } else if (!strcmp(item, "channels")) {
+            channels = atoi(value);
+        } else if (!strcmp(item, "max_adj")) {
+            max_adj = atoi(value);
+        } else {
+            fprintf(stderr, "Unknown simulator setting '%s'\n", item);
+            return false;
+        }
+    }
+    if (period <= 0 || channels < 0 || channels > 32 || noise < 0 || jitter < 0 ||
+        latency < 0) {
+        fprintf(stderr, "Simulator setting out of range\n");
+        return false;
+    }
+    return true;
+}
+
+PhcSim::PhcSim(const PhcSimConfig &config, bool nonblock)
+    : cfg(config), nonblock(nonblock), rng(readClock(CLOCK_MONOTONIC)) {
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (nonblock ? TFD_NONBLOCK : 0));
+    refMono = monoNow();
+    refPhc = readClock(CLOCK_REALTIME) + cfg.offset;
+}
+
+PhcSim::~PhcSim() {
+    if (timerFd >= 0) {
+        close(timerFd);
+    }
+}
+
+int PhcSim::setNonblocking(bool enable) {
+    int flags = fcntl(timerFd, F_GETFL);
+    if (flags < 0) {
+        return -errno;
+    }
+    flags = enable ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    if (fcntl(timerFd, F_SETFL, flags)) {
+        return -errno;
+    }
+    nonblock = enable;
+    return 0;
+}
+
+int64_t PhcSim::monoNow() {
+    return readClock(CLOCK_MONOTONIC);
+}
+
+// Busy-waits for the configured operation latency; a real ioctl holds the
+// CPU in the kernel rather than sleeping.
+void PhcSim::spin() {
+    if (cfg.latency <= 0) {
+        return;
+    }
+    int64_t until = monoNow() + cfg.latency;
+    while (monoNow() < until) {
+    }
+}
+
+int64_t PhcSim::noise(int64_t sigma) {
+    return sigma > 0 ? (int64_t)llround(gauss(rng) * sigma) : 0;
+}
+
+int64_t PhcSim::phcAt(int64_t mono) const {
+    int64_t dt = mono - refMono;
+    return refPhc + dt + (int64_t)llround(dt * (cfg.freq + adj) * 1e-9);
+}
+
+int64_t PhcSim::monoAt(int64_t phc) const {
+    double rate = 1.0 + (cfg.freq + adj) * 1e-9;
+    return refMono + (int64_t)ceil((phc - refPhc) / rate);
+}
+
+void PhcSim::rebase(int64_t mono) {
+    refPhc = phcAt(mono);
+    refMono = mono;
+}
+
+int64_t PhcSim::readPhc() {
+    return phcAt(monoNow()) + noise(cfg.noise);
+}
+
+// First pulse of 'channel' strictly after 'phc'
+int64_t PhcSim::firstPulse(unsigned int channel, int64_t phc) const {
+    const Perout &out = perout[channel];
+    if (out.period) {
+        if (phc < out.start) {
+            return out.start;
+        }
+        return out.oneShot ? INT64_MAX
+                           : out.start + (floorDiv(phc - out.start, out.period) + 1) * out.period;
+    }
+    int64_t skew = channel * CHANNEL_SKEW_NS;
+    return (floorDiv(phc - skew, cfg.period) + 1) * cfg.period + skew;
+}
+
+int PhcSim::getCaps(struct ptp_clock_caps *caps) {
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    memset(caps, 0, sizeof(*caps));
+    caps->max_adj = cfg.max_adj;
+    caps->n_ext_ts = cfg.channels;
+    caps->n_per_out = cfg.channels;
+    caps->n_pins = cfg.channels;
+    caps->pps = 1;
+    caps->cross_timestamping = 1;
+    return 0;
+}
+
+int PhcSim::getTime(struct timespec *ts) {
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    int64_t ns = readPhc();
+    ts->tv_sec = ns / 1000000000LL;
+    ts->tv_nsec = ns % 1000000000LL;
+    return 0;
+}
+
+int PhcSim::setTime(const struct timespec *ts) {
+    if (ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000L) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    refMono = monoNow();
+    refPhc = ts->tv_sec * 1000000000LL + ts->tv_nsec;
+    for (int i = 0; i < cfg.channels; i++) {
+        nextPulse[i] = firstPulse(i, refPhc);
+    }
+    return rearm();
+}
+
+int PhcSim::adjustTime(int64_t ns) {
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    rebase(monoNow());
+    refPhc += ns;
+    for (int i = 0; i < cfg.channels; i++) {
+        nextPulse[i] = firstPulse(i, refPhc);
+    }
+    return rearm();
+}
+
+int PhcSim::adjustFrequency(double ppb) {
+    if (fabs(ppb) > cfg.max_adj) {
+        return -ERANGE;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    rebase(monoNow());
+    adj = ppb;
+    return rearm();
+}
+
+int PhcSim::readFrequency(double *ppb) {
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    *ppb = adj;
+    return 0;
+}
+
+int PhcSim::sysOffset(struct ptp_sys_offset *req) {
+    if (req->n_samples < 1 || req->n_samples > PTP_MAX_SAMPLES) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    for (unsigned int i = 0; i < req->n_samples; i++) {
+        toClockTime(readClock(CLOCK_REALTIME), &req->ts[2 * i]);
+        spin();
+        toClockTime(readPhc(), &req->ts[2 * i + 1]);
+    }
+    toClockTime(readClock(CLOCK_REALTIME), &req->ts[2 * req->n_samples]);
+    return 0;
+}
+
+int PhcSim::sysOffsetExtended(struct ptp_sys_offset_extended *req) {
+    if (req->n_samples < 1 || req->n_samples > PTP_MAX_SAMPLES) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    for (unsigned int i = 0; i < req->n_samples; i++) {
+        spin();
+        toClockTime(readClock(CLOCK_REALTIME), &req->ts[i][0]);
+        toClockTime(readPhc(), &req->ts[i][1]);
+        toClockTime(readClock(CLOCK_REALTIME), &req->ts[i][2]);
+    }
+    return 0;
+}
+
+int PhcSim::sysOffsetPrecise(struct ptp_sys_offset_precise *req) {
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    int64_t raw = readClock(CLOCK_MONOTONIC_RAW);
+    toClockTime(readPhc(), &req->device);
+    toClockTime(readClock(CLOCK_REALTIME), &req->sys_realtime);
+    toClockTime(raw, &req->sys_monoraw);
+    return 0;
+}
+
+int PhcSim::enableExtts(unsigned int channel, bool enable) {
+    if (channel >= (unsigned int)cfg.channels) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    if (enable) {
+        exttsEnabled |= 1u << channel;
+        nextPulse[channel] = firstPulse(channel, phcAt(monoNow()));
+    } else {
+        exttsEnabled &= ~(1u << channel);
+    }
+    return rearm();
+}
+
+// Points the timerfd at the next pulse, or disarms it when no channel is
+// enabled, so the descriptor polls readable exactly when events are due.
+int PhcSim::rearm() {
+    if (!exttsEnabled) {
+        struct itimerspec its = {};
+        return timerfd_settime(timerFd, 0, &its, nullptr) ? -errno : 0;
+    }
+    int64_t due;
+    return nextDue(&due);
+}
+
+// Monotonic time of the earliest pending pulse, with the timerfd armed for
+// it, or disarmed when no pulse is coming. Returns -EINVAL when no channel
+// is enabled.
+int PhcSim::nextDue(int64_t *mono) {
+    if (!exttsEnabled) {
+        return -EINVAL;
+    }
+    int64_t due = INT64_MAX;
+    for (int i = 0; i < cfg.channels; i++) {
+        if ((exttsEnabled & (1u << i)) && nextPulse[i] < due) {
+            due = nextPulse[i];
+        }
+    }
+    struct itimerspec its = {};
+    if (due == INT64_MAX) {
+        *mono = INT64_MAX;
+        return timerfd_settime(timerFd, 0, &its, nullptr) ? -errno : 0;
+    }
+    *mono = monoAt(due);
+
+    its.it_value.tv_sec = *mono / 1000000000LL;
+    its.it_value.tv_nsec = *mono % 1000000000LL;
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, nullptr)) {
+        return -errno;
+    }
+    return 0;
+}
+
+int PhcSim::readExtts(struct ptp_extts_event *events, int max) {
+    for (;;) {
+        int64_t due;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            spin();
+            int64_t now = phcAt(monoNow());
+            int n = 0;
+            while (n < max) {
+                int ch = -1;
+                for (int i = 0; i < cfg.channels; i++) {
+                    if ((exttsEnabled & (1u << i)) && nextPulse[i] <= now &&
+                        (ch < 0 || nextPulse[i] < nextPulse[ch])) {
+                        ch = i;
+                    }
+                }
+                if (ch < 0) {
+                    break;
+                }
+                int64_t period = perout[ch].period ? perout[ch].period : cfg.period;
+                if (nextPulse[ch] < now - EXTTS_QUEUE * period) {
+                    nextPulse[ch] = firstPulse(ch, now - EXTTS_QUEUE * period);
+                    if (nextPulse[ch] > now) {
+                        continue;
+                    }
+                }
+                memset(&events[n], 0, sizeof(events[n]));
+                events[n].index = ch;
+                toClockTime(nextPulse[ch] + noise(cfg.jitter), &events[n].t);
+                nextPulse[ch] = firstPulse(ch, nextPulse[ch]);
+                n++;
+            }
+            int err = nextDue(&due);
+            if (err) {
+                return err;
+            }
+            if (n) {
+                return n;
+            }
+        }
+        if (nonblock) {
+            return -EAGAIN;
+        }
+        uint64_t expirations;
+        if (read(timerFd, &expirations, sizeof(expirations)) < 0) {
+            return -errno;
+        }
+    }
+}
+
+int PhcSim::setPerout(const struct ptp_perout_request *req) {
+    if (req->index >= (unsigned int)cfg.channels) {
+        return -EINVAL;
+    }
+    // The checks of the kernel's PTP_PEROUT_REQUEST2 handling
+    if (req->flags & ~PTP_PEROUT_VALID_FLAGS) {
+        return -EOPNOTSUPP;
+    }
+    int64_t period = req->period.sec * 1000000000LL + req->period.nsec;
+    if ((req->flags & PTP_PEROUT_DUTY_CYCLE) &&
+        req->on.sec * 1000000000LL + req->on.nsec >= period) {
+        return -ERANGE;
+    }
+    if (period < 0) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    Perout &out = perout[req->index];
+    out.period = period;
+    out.oneShot = req->flags & PTP_PEROUT_ONE_SHOT;
+    if (req->flags & PTP_PEROUT_PHASE) {
+        // The first edge of the grid phase + k * period after now
+        int64_t phase = req->phase.sec * 1000000000LL + req->phase.nsec;
+        int64_t now = phcAt(monoNow());
+        out.start = period ? phase + (floorDiv(now - phase, period) + 1) * period : 0;
+    } else {
+        out.start = req->start.sec * 1000000000LL + req->start.nsec;
+    }
+    nextPulse[req->index] = firstPulse(req->index, phcAt(monoNow()));
+    return rearm();
+}
+
+int PhcSim::getPin(struct ptp_pin_desc *desc) {
+    if (desc->index >= (unsigned int)cfg.channels) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    snprintf(desc->name, sizeof(desc->name), "SIM%u", desc->index);
+    desc->func = pinFunc[desc->index];
+    desc->chan = pinChan[desc->index];
+    return 0;
+}
+
+int PhcSim::setPin(unsigned int index, unsigned int func, unsigned int chan) {
+    if (index >= (unsigned int)cfg.channels || func > PTP_PF_PHYSYNC) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    pinFunc[index] = func;
+    pinChan[index] = chan;
+    return 0;
+}
+
+int PhcSim::enablePps(bool) {
+    std::lock_guard<std::mutex> guard(lock);
+    spin();
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * ShiwaPTPTool - Simulated PHC device
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_SIM_H
+#define SHIWA_PHC_SIM_H
+
+#include <linux/ptp_clock.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <mutex>
+#include <random>
+
+// Parameters of a simulated clock. parse() accepts a comma separated
+// "key=value" list with the member names below, e.g.
+// "freq=250,noise=20,latency=1500,period=1000000".
+struct PhcSimConfig {
+    int64_t offset = 0;         // ns added to CLOCK_REALTIME at open
+    double freq = 0;            // intrinsic frequency error (ppb)
+    int64_t noise = 0;          // standard deviation of read noise (ns)
+    int64_t latency = 0;        // busy time spent in every operation (ns)
+    int64_t period = 1000000000; // synthetic EXTTS pulse period (ns)
+    int64_t jitter = 0;         // standard deviation of pulse jitter (ns)
+    int channels = 2;           // EXTTS channels / pins
+    int max_adj = 500000000;    // reported maximum adjustment (ppb)
+
+    // Returns false and names the offending key on stderr.
+    bool parse(const char *spec);
+};
+
+// Software model of a PTP hardware clock driven by CLOCK_MONOTONIC:
+//
+//   phc(mono) = ref_phc + (mono - ref_mono) * (1 + (freq + adj) / 1e9)
+//
+// Every operation mirrors the matching PhcDevice call and returns 0 or a
+// negative errno. External timestamps are generated on a PHC time grid
+// of 'period' ns, channel n shifted by n microseconds. While periodic
+// output n is on, EXTTS channel n timestamps its edges instead, as if the
+// output were wired back to the input. The pollable descriptor is a
+// CLOCK_MONOTONIC timerfd armed for the next pulse.
+class PhcSim {
+public:
+    PhcSim(const PhcSimConfig &config, bool nonblock);
+    ~PhcSim();
+
+    PhcSim(const PhcSim &) = delete;
+    PhcSim &operator=(const PhcSim &) = delete;
+
+    int fd() const { return timerFd; }
+    int setNonblocking(bool enable);
+
+    int getCaps(struct ptp_clock_caps *caps);
+    int getTime(struct timespec *ts);
+    int setTime(const struct timespec *ts);
+    int adjustTime(int64_t ns);
+    int adjustFrequency(double ppb);
+    int readFrequency(double *ppb);
+
+    int sysOffset(struct ptp_sys_offset *req);
+    int sysOffsetExtended(struct ptp_sys_offset_extended *req);
+    int sysOffsetPrecise(struct ptp_sys_offset_precise *req);
+
+    int enableExtts(unsigned int channel, bool enable);
+    int readExtts(struct ptp_extts_event *events, int max);
+
+    int setPerout(const struct ptp_perout_request *req);
+    int getPin(struct ptp_pin_desc *desc);
+    int setPin(unsigned int index, unsigned int func, unsigned int chan);
+    int enablePps(bool enable);
+
+private:
+    static const int MAX_CHANNELS = 32;
+
+    // Programmed periodic output, looped back to the EXTTS channel
+    struct Perout {
+        int64_t start = 0;      // first edge (PHC ns)
+        int64_t period = 0;     // 0 while the output is off
+        bool oneShot = false;
+    };
+
+    PhcSimConfig cfg;
+    bool nonblock;
+    int timerFd = -1;
+
+    std::mutex lock;
+    std::mt19937_64 rng;
+    std::normal_distribution<double> gauss{0.0, 1.0};
+    int64_t refMono = 0;
+    int64_t refPhc = 0;
+    double adj = 0;             // ppb set through adjustFrequency()
+    uint32_t exttsEnabled = 0;
+    int64_t nextPulse[MAX_CHANNELS] = {};   // INT64_MAX when none is coming
+    Perout perout[MAX_CHANNELS];
+    unsigned int pinFunc[MAX_CHANNELS] = {};
+    unsigned int pinChan[MAX_CHANNELS] = {};
+
+    void spin();
+    int64_t noise(int64_t sigma);
+    static int64_t monoNow();
+    int64_t phcAt(int64_t mono) const;
+    int64_t monoAt(int64_t phc) const;
+    void rebase(int64_t mono);
+    int64_t readPhc();
+    int64_t firstPulse(unsigned int channel, int64_t phc) const;
+    int nextDue(int64_t *mono);
+    int rearm();
+};
+
+#endif // SHIWA_PHC_SIM_H
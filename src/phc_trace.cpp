@@ -0,0 +1,121 @@
+/*
+ * ShiwaPTPTool - Hot-path latency tracing
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "phc_trace.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#if SHIWA_TRACE
+
+#include <thread>
+
+PhcTraceHistogram phcTraceHistograms[PHC_TRACE_OPS];
+
+static const char *const OP_NAMES[PHC_TRACE_OPS] = {
+    "PTP_CLOCK_GETCAPS",
+    "clock_gettime",
+    "clock_settime",
+    "clock_adjtime(SETOFFSET)",
+    "clock_adjtime(FREQUENCY)",
+    "clock_adjtime(read)",
+    "PTP_SYS_OFFSET",
+    "PTP_SYS_OFFSET_EXTENDED",
+    "PTP_SYS_OFFSET_PRECISE",
+    "PTP_EXTTS_REQUEST",
+    "extts read",
+    "PTP_PEROUT_REQUEST",
+    "PTP_PIN_GET/SETFUNC",
+    "PTP_ENABLE_PPS",
+    "send",
+    "server reply",
+    "event processing",
+};
+
+static int64_t monoNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Counter reading and time at program start, for the cycles-to-ns ratio.
+static const uint64_t startTicks = phcTraceNow();
+static const int64_t startNs = monoNs();
+
+static double nsPerTick() {
+#if defined(__x86_64__) || defined(__i386__)
+    // Give the ratio at least 10 ms of baseline.
+    int64_t now = monoNs();
+    if (now - startNs < 10000000) {
+        struct timespec pause = {0, (long)(10000000 - (now - startNs))};
+        nanosleep(&pause, nullptr);
+    }
+    uint64_t ticks = phcTraceNow();
+    now = monoNs();
+    return (double)(now - startNs) / (double)(ticks - startTicks);
+#else
+    return 1.0;
+#endif
+}
+
+void phcTraceDump(FILE *out) {
+    double scale = nsPerTick();
+    fprintf(out, "%-26s %10s %9s %9s %9s %9s %9s\n", "operation (ns)", "count", "min", "p50",
+            "p99", "p99.9", "max");
+    for (int op = 0; op < PHC_TRACE_OPS; op++) {
+        const PhcTraceHistogram &h = phcTraceHistograms[op];
+        uint64_t total = h.total();
+        if (!total) {
+            continue;
+        }
+        fprintf(out, "%-26s %10llu %9.0f %9.0f %9.0f %9.0f %9.0f\n", OP_NAMES[op],
+                (unsigned long long)total, h.min() * scale, h.percentile(total, 50) * scale,
+                h.percentile(total, 99) * scale, h.percentile(total, 99.9) * scale,
+                h.max() * scale);
+    }
+    fflush(out);
+}
+
+int phcTraceDumpOnSignal(int signo) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+    int err = pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    if (err) {
+        return -err;
+    }
+    std::thread([mask] {
+        // Leave every other signal to the threads that handle them; a
+        // process-directed SIGTERM must not pick this thread.
+        sigset_t all;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, nullptr);
+        for (;;) {
+            int sig;
+            if (sigwait(&mask, &sig) == 0) {
+                phcTraceDump(stderr);
+            }
+        }
+    }).detach();
+    return 0;
+}
+
+#else
+
+void phcTraceDump(FILE *out) {
+    fputs("Tracing is compiled out (SHIWA_TRACE=0)\n", out);
+}
+
+int phcTraceDumpOnSignal(int) {
+    return -ENOTSUP;
+}
+
+#endif // SHIWA_TRACE
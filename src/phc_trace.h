@@ -0,0 +1,141 @@
+/*
+ * ShiwaPTPTool - Hot-path latency tracing
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_TRACE_H
+#define SHIWA_PHC_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Build with -DSHIWA_TRACE=0 (make TRACE=0) to compile every trace point
+// out; PHC_TRACE_SCOPE then expands to nothing.
+#ifndef SHIWA_TRACE
+#define SHIWA_TRACE 1
+#endif
+
+// Traced operations. The PHC calls are timed inside PhcDevice, so the
+// histograms show what the driver and kernel cost; SEND, REPLY and EVENT are
+// timed by the caller and show the cost of our own loops.
+enum PhcTraceOp {
+    PHC_TRACE_GETCAPS,
+    PHC_TRACE_GETTIME,
+    PHC_TRACE_SETTIME,
+    PHC_TRACE_ADJTIME,
+    PHC_TRACE_ADJFREQ,
+    PHC_TRACE_READFREQ,
+    PHC_TRACE_SYS_OFFSET,
+    PHC_TRACE_SYS_OFFSET_EXTENDED,
+    PHC_TRACE_SYS_OFFSET_PRECISE,
+    PHC_TRACE_EXTTS_REQUEST,
+    PHC_TRACE_EXTTS_READ,
+    PHC_TRACE_PEROUT,
+    PHC_TRACE_PIN,
+    PHC_TRACE_PPS,
+    PHC_TRACE_SEND,             // -E forwarding of events
+    PHC_TRACE_REPLY,            // -G server responses
+    PHC_TRACE_EVENT,
+    PHC_TRACE_OPS
+};
+
+// Prints count and min/p50/p99/p99.9/max in ns for every operation that ran.
+void phcTraceDump(FILE *out);
+
+// Blocks 'signo' in the calling thread and dumps to stderr from a helper
+// thread each time it arrives. Call before starting other threads so they
+// inherit the mask. Returns 0, or -ENOTSUP when tracing is compiled out.
+int phcTraceDumpOnSignal(int signo);
+
+#if SHIWA_TRACE
+
+#include <atomic>
+
+#include "latency_histogram.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// Log-linear histogram of cycle counts with relaxed atomic buckets, safe to
+// record from any thread. 16 sub-buckets per power of two keep the
+// relative error under 6.25%.
+class PhcTraceHistogram {
+public:
+    typedef LogLinearBuckets<4> Layout;
+
+    void record(uint64_t v) {
+        counts[Layout::bucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+        uint64_t m = maxValue.load(std::memory_order_relaxed);
+        while (v > m && !maxValue.compare_exchange_weak(m, v, std::memory_order_relaxed)) {
+        }
+        m = minValue.load(std::memory_order_relaxed);
+        while (v < m && !minValue.compare_exchange_weak(m, v, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t bucket(int i) const { return counts[i].load(std::memory_order_relaxed); }
+    uint64_t min() const { return minValue.load(std::memory_order_relaxed); }
+    uint64_t max() const { return maxValue.load(std::memory_order_relaxed); }
+
+    uint64_t total() const {
+        uint64_t n = 0;
+        for (int i = 0; i < Layout::BUCKETS; i++) {
+            n += bucket(i);
+        }
+        return n;
+    }
+
+    uint64_t percentile(uint64_t total, double p) const {
+        return Layout::percentile([this](int i) { return bucket(i); }, total, p, max());
+    }
+
+private:
+    std::atomic<uint64_t> counts[Layout::BUCKETS] = {};
+    std::atomic<uint64_t> minValue{UINT64_MAX};
+    std::atomic<uint64_t> maxValue{0};
+};
+
+extern PhcTraceHistogram phcTraceHistograms[PHC_TRACE_OPS];
+
+// Time stamp counter where available (converted to ns when dumping),
+// otherwise CLOCK_MONOTONIC_RAW in ns.
+static inline uint64_t phcTraceNow() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+class PhcTraceScope {
+public:
+    explicit PhcTraceScope(PhcTraceOp op) : op(op), start(phcTraceNow()) {}
+    ~PhcTraceScope() { phcTraceHistograms[op].record(phcTraceNow() - start); }
+
+    PhcTraceScope(const PhcTraceScope &) = delete;
+    PhcTraceScope &operator=(const PhcTraceScope &) = delete;
+
+private:
+    PhcTraceOp op;
+    uint64_t start;
+};
+
+#define PHC_TRACE_SCOPE(op) PhcTraceScope phc_trace_scope_(op)
+
+#else
+
+#define PHC_TRACE_SCOPE(op) ((void)0)
+
+#endif // SHIWA_TRACE
+
+#endif // SHIWA_PHC_TRACE_H
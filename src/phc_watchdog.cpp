@@ -0,0 +1,106 @@
+/*
+ * ShiwaPTPTool - PHC health watchdog
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "phc_watchdog.h"
+
+#include <math.h>
+
+// Averaging lengths (samples) of the fast and slow offset rates; the read
+// latency uses the fast one. All start as plain means so the first
+// samples are not over-weighted.
+static const double FAST_LENGTH = 4;
+static const double SLOW_LENGTH = 64;
+
+// A PHC that advances by less than this fraction of the system clock
+// between samples is considered stalled.
+static const int64_t STALL_RATIO = 1000;
+
+static const char *CHECK_NAMES[PHC_WD_CHECKS] = {"step", "frequency", "stall", "latency", "read"};
+
+const char *PhcWatchdog::checkName(PhcWatchdogCheck check) {
+    return check < PHC_WD_CHECKS ? CHECK_NAMES[check] : "?";
+}
+
+PhcWatchdog::PhcWatchdog(const PhcWatchdogConfig &config) : cfg(config) {}
+
+void PhcWatchdog::transition(PhcWatchdogCheck check, bool on, double value, double limit,
+                             PhcWatchdogAlert *alerts, int *n) {
+    if (state[check] == on) {
+        return;
+    }
+    state[check] = on;
+    if (on) {
+        counts[check]++;
+    }
+    alerts[(*n)++] = {check, on, value, limit};
+}
+
+int PhcWatchdog::readFailed(PhcWatchdogAlert *alerts) {
+    int n = 0;
+    transition(PHC_WD_READ, true, 0, 0, alerts, &n);
+    return n;
+}
+
+int PhcWatchdog::add(const PhcOffsetSample &sample, int64_t latencyNs, PhcWatchdogAlert *alerts) {
+    int n = 0;
+    transition(PHC_WD_READ, false, 0, 0, alerts, &n);
+    // A single late read is scheduling noise, a slow average is not.
+    latencyAvg += (latencyNs - latencyAvg) / fmin(count + 1, FAST_LENGTH);
+    double latencyLimit = state[PHC_WD_LATENCY] ? cfg.latencyNs / 2.0 : cfg.latencyNs;
+    transition(PHC_WD_LATENCY, latencyAvg > latencyLimit, latencyAvg, (double)cfg.latencyNs,
+               alerts, &n);
+
+    int64_t dSys = sample.sys_ns - prevSys;
+    int64_t dPhc = sample.phc_ns - prevPhc;
+    prevSys = sample.sys_ns;
+    prevPhc = sample.phc_ns;
+    if (count++ == 0) {
+        return n;
+    }
+
+    bool stalled = dSys > 0 && llabs(dPhc) < dSys / STALL_RATIO;
+    transition(PHC_WD_STALL, stalled, (double)dPhc, (double)(dSys / STALL_RATIO), alerts, &n);
+    if (stalled) {
+        return n;
+    }
+
+    // Offset change the recent rate does not explain. A second outlier in
+    // a row is a rate change rather than a step: the fast rate restarts
+    // from it and the frequency check takes over.
+    double change = (double)(dPhc - dSys);
+    double residual = change - fastRate * 1e-9 * dSys;
+    bool outlier = rateSamples > 0 && fabs(residual) > cfg.stepNs;
+    if (outlier && !lastOutlier) {
+        lastOutlier = true;
+        counts[PHC_WD_STEP]++;
+        alerts[n++] = {PHC_WD_STEP, true, residual, (double)cfg.stepNs};
+        return n;
+    }
+    lastOutlier = false;
+    if (dSys <= 0) {
+        return n;
+    }
+
+    double rate = change / dSys * 1e9;
+    rateSamples++;
+    if (outlier) {
+        fastRate = rate;
+    } else {
+        fastRate += (rate - fastRate) / fmin(rateSamples, FAST_LENGTH);
+    }
+    slowRate += (rate - slowRate) / fmin(rateSamples, SLOW_LENGTH);
+
+    if (rateSamples >= WARMUP) {
+        double deviation = fastRate - slowRate;
+        double limit = state[PHC_WD_FREQ] ? cfg.freqPpb / 2 : cfg.freqPpb;
+        transition(PHC_WD_FREQ, fabs(deviation) > limit, deviation, cfg.freqPpb, alerts, &n);
+    }
+    return n;
+}
@@ -0,0 +1,92 @@
+/*
+ * ShiwaPTPTool - PHC health watchdog
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_PHC_WATCHDOG_H
+#define SHIWA_PHC_WATCHDOG_H
+
+#include <stdint.h>
+
+#include "phc_device.h"
+
+enum PhcWatchdogCheck {
+    PHC_WD_STEP,        // offset changed by more than the drift explains
+    PHC_WD_FREQ,        // short-term rate left the long-term average
+    PHC_WD_STALL,       // PHC did not advance between samples
+    PHC_WD_LATENCY,     // offset samples take too long to read
+    PHC_WD_READ,        // offset sample could not be read
+    PHC_WD_CHECKS
+};
+
+struct PhcWatchdogConfig {
+    int64_t stepNs = 100000;
+    double freqPpb = 10000;
+    int64_t latencyNs = 100000;
+};
+
+// A condition that was raised or cleared. Steps are single events and
+// are only ever raised.
+struct PhcWatchdogAlert {
+    PhcWatchdogCheck check;
+    bool raised;
+    double value;       // ns, or ppb for PHC_WD_FREQ
+    double limit;
+};
+
+// Detects misbehaviour of a PHC from a stream of PHC/system offset
+// samples. All state is a handful of running values: the offset rate is
+// tracked by a fast and a slow exponential average, so every check costs
+// O(1) per sample whatever the run length. Conditions other than steps
+// alert once when they start and once when they end, and clear only at
+// half their limit so a value near the limit does not flap.
+class PhcWatchdog {
+public:
+    explicit PhcWatchdog(const PhcWatchdogConfig &config);
+
+    // Feeds a sample that took 'latencyNs' to read; the latency check uses
+    // the average of the last few reads. Writes the resulting
+    // transitions to 'alerts' (room for PHC_WD_CHECKS) and returns their
+    // number.
+    int add(const PhcOffsetSample &sample, int64_t latencyNs, PhcWatchdogAlert *alerts);
+
+    // Records a failed read; same contract as add().
+    int readFailed(PhcWatchdogAlert *alerts);
+
+    bool active(PhcWatchdogCheck check) const { return state[check]; }
+    uint64_t raised(PhcWatchdogCheck check) const { return counts[check]; }
+    uint64_t samples() const { return count; }
+
+    // Long-term offset rate, i.e. the PHC frequency error against the
+    // system clock (ppb).
+    double frequency() const { return slowRate; }
+
+    static const char *checkName(PhcWatchdogCheck check);
+
+private:
+    // Rate samples before the frequency check starts
+    static const unsigned int WARMUP = 8;
+
+    PhcWatchdogConfig cfg;
+    bool state[PHC_WD_CHECKS] = {};
+    uint64_t counts[PHC_WD_CHECKS] = {};
+    uint64_t count = 0;
+    unsigned int rateSamples = 0;
+    bool lastOutlier = false;
+
+    int64_t prevSys = 0;
+    int64_t prevPhc = 0;
+    double fastRate = 0;
+    double slowRate = 0;
+    double latencyAvg = 0;
+
+    void transition(PhcWatchdogCheck check, bool on, double value, double limit,
+                    PhcWatchdogAlert *alerts, int *n);
+};
+
+#endif // SHIWA_PHC_WATCHDOG_H
@@ -22,21 +22,28 @@
 #include <math.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/timex.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
+#include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <mutex>
@@ -47,6 +54,24 @@
 #include <memory>
 #include <functional>
 
+#include "device_config.h"
+#include "extts_capture.h"
+#include "event_loop.h"
+#include "extts_io.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "phc_device.h"
+#include "phc_clock_model.h"
+#include "phc_daemon.h"
+#include "phc_drift.h"
+#include "phc_trace.h"
+#include "phc_watchdog.h"
+#include "record_writer.h"
+#include "stability.h"
+#include "phc_shm.h"
+#include "phc_sim.h"
+#include "rt_profile.h"
+
 // ShiwaPTPTool CLI Class
 class PTPToolCLI {
 private:
@@ -56,17 +81,20 @@ private:
     };
 
     std::map<std::string, Msg> data;
-    int sendSocket;
+    int sendSocket = -1;
     
     // Configuration
     int device = -1;
-    clockid_t clkid;
-    int fd = -1;
+    PhcDevice phc;
+    bool simulate = false;       // -d sim:N
+    bool remote = false;         // -d remote:N, served by --daemon
+    PhcSimConfig simConfig;
     bool run_srv = false;
     static bool server_running;
     char *addr_client = nullptr;
     char *hostname = nullptr;
     int portNum = 9001;
+    static const size_t SERVER_MAX_HOSTS = 64;  // senders with their own -G metrics
 
     // Command line options
     int adjfreq = 0x7fffffff;
@@ -76,37 +104,209 @@ private:
     int gettime = 0;
     int index = 0;
     int list_pins = 0;
-    int oneshot = 0;
+    double oneshot = 0;
     int pct_offset = 0;
     int n_samples = 0;
-    int periodic = 0;
-    int perout = -1;
+    double periodic = 0;
+    long timer_count = 0;
+    long long perout = -1;            // period (ns), 0 disables
+    long long perout_phase = 0;       // edges at phase + k * period of PHC time
+    long long perout_duty = 0;        // on time (ns), 0 = driver default
+    bool perout_one_shot = false;
+    bool perout_kernel_phase = false; // let the driver pick the first edge
+    int perout_verify = -1;           // loopback EXTTS channel
+    long long perout_tolerance = 1000;
+
+    // EXTTS-triggered outputs
+    long trigger_count = 0;
+    int trigger_out = 0;              // output channel
+    long long trigger_delay = 1000000; // ns from the input edge to the output
+
+    // Clock health watchdog
+    int watchdog_interval = 0;        // milliseconds between samples, 0 = off
+    PhcWatchdogConfig watchdogConfig;
+    bool watchdog_syslog = false;
+    char *watchdog_hook = nullptr;
     int pin_index = -1, pin_func;
     int pps = -1;
     int seconds = 0;
     int settime = 0;
 
-    static const int CLOCK_INVALID = -1;
+    // Frequency response sweep
+    bool freq_sweep = false;
+    int sweep_min = 0, sweep_max = 0, sweep_step = 0;
+    int sweep_dwell = 10;        // seconds spent at each step
+    int sweep_interval = 100;    // milliseconds between offset samples
+    int sweep_tolerance = 20;    // ppb band that counts as settled
+    static volatile sig_atomic_t interrupted;
+
+    // Declarative configuration
+    char *apply_file = nullptr;
+    char *state_file = nullptr;       // default: /run/shiwaptptool-<device>.state
+    bool dry_run = false;
+
+    // Control daemon and its offset subscription
+    bool run_daemon = false;
+    const char *socket_path = PHC_DEFAULT_SOCKET;
+    long watch_offset = 0;
+    int watch_interval = 1000;        // milliseconds between pushed offsets
+
+    // Sliding-window drift estimation
+    long drift_samples = 0;
+    int drift_window = 100;
+    int drift_interval = 1000;        // microseconds between offset samples
+
+    // Frequency stability (ADEV/MDEV/TDEV) analysis
+    char *stability_file = nullptr;
+    long long stability_samples = 0;
+    int stability_interval = 100;     // milliseconds between live offset samples
+    long long stability_period = 0;   // nominal EXTTS period (ns), 0 = inferred
+
+    // PHC read-cost benchmark
+    bool run_bench = false;
+    int bench_iterations = 0;
+
+    // Interpolated clock model check
+    int interp_checks = 0;
+    int model_interval = 100;    // milliseconds between model refreshes
+
+    // Shared-memory PHC time publication
+    char *shm_publish = nullptr;
+    char *shm_read = nullptr;
+
+    // Binary external timestamp records
+    char *extts_out = nullptr;
+    char *decode_file = nullptr;
+    ExttsWriter exttsWriter;
+
+    // Capture files and replay
+    char *capture_file = nullptr;
+    char *replay_file = nullptr;
+    long long replay_from = 0;   // PTP second to start the replay at
+    double replay_speed = 1.0;   // 0 = as fast as possible
+    ExttsCaptureWriter captureWriter;
+
+    // Multi-channel capture: events are demultiplexed by event.index into
+    // per-channel state, allocated the first time a channel is seen.
+    static const int EXTTS_MAX_CHANNELS = 32;
+    // Exact running statistics of the intervals between events. Pulse
+    // trains differ by tens of ns on periods of up to seconds, finer than
+    // any log-scale histogram bucket, so the spread is kept as Welford's
+    // running mean and sum of squared deviations.
+    struct IntervalStats {
+        uint64_t count = 0;
+        int64_t min = INT64_MAX;
+        int64_t max = INT64_MIN;
+        double mean = 0;
+        double m2 = 0;
+
+        void add(int64_t ns) {
+            count++;
+            min = std::min(min, ns);
+            max = std::max(max, ns);
+            double delta = ns - mean;
+            mean += delta / count;
+            m2 += delta * (ns - mean);
+        }
+        double stddev() const { return count > 1 ? sqrt(m2 / (count - 1)) : 0; }
+    };
+    struct ExttsChannel {
+        uint64_t events = 0;
+        long remaining = 0;      // event budget left in a live capture
+        int64_t first = 0;       // PTP time of the first event (ns)
+        int64_t last = 0;        // PTP time of the latest event (ns)
+        IntervalStats intervals;
+        MetricCounter *eventsTotal = nullptr;
+    };
+    // One PHC whose events are captured: the -d device or one of --devices.
+    struct ExttsSource {
+        int device = -1;
+        PhcDevice *phc = nullptr;
+        std::unique_ptr<PhcDevice> owned;
+        uint32_t enabled = 0;
+        long pending = 0;        // events still wanted from this device
+        uint64_t dropped = 0;
+        std::unique_ptr<ExttsChannel> channels[EXTTS_MAX_CHANNELS];
+        MetricCounter *droppedTotal = nullptr;
+        MetricHistogram *readLatency = nullptr;
+
+        void registerMetrics() {
+            MetricsRegistry &m = MetricsRegistry::instance();
+            std::string dev = MetricsRegistry::label("device", std::to_string(device));
+            droppedTotal = m.counter("shiwaptp_extts_dropped_total",
+                                     "Events on channels not requested or already done", dev);
+            readLatency = m.histogram("shiwaptp_extts_read_seconds",
+                                      "Duration of extts read() calls", dev);
+        }
+
+        ExttsChannel *channel(unsigned int index) {
+            if (index >= EXTTS_MAX_CHANNELS) {
+                return nullptr;
+            }
+            if (!channels[index]) {
+                channels[index].reset(new ExttsChannel);
+                channels[index]->eventsTotal = MetricsRegistry::instance().counter(
+                    "shiwaptp_extts_events_total", "External timestamp events processed",
+                    MetricsRegistry::label("device", std::to_string(device)) + "," +
+                        MetricsRegistry::label("channel", std::to_string(index)));
+            }
+            return channels[index].get();
+        }
+    };
+    static const int EXTTS_BATCH = 64;
+    char *extts_channels = nullptr;
+    char *extts_devices = nullptr;
+    std::vector<std::unique_ptr<ExttsSource>> exttsSources;
+
+    // Scheduling and memory residency for the long-running modes
+    RealtimeProfile rt;
+
+    // Prometheus endpoint
+    char *metrics_addr = nullptr;
+    MetricsServer metricsServer;
+    MetricCounter *forwardedTotal = MetricsRegistry::instance().counter(
+        "shiwaptp_forwarded_events_total", "Events sent to the -E peer");
+    MetricCounter *forwardErrors = MetricsRegistry::instance().counter(
+        "shiwaptp_forward_errors_total", "Events the -E peer send() failed for");
 
+    // --format: structured output of capabilities, time, offset, pins, events
+    RecordWriter records{stdout};
 
+    // Print the per-operation latency histograms on exit
+    bool trace_dump = false;
+
+    // Script of steps run against one open device
+    char *batch_file = nullptr;
+    bool keep_going = false;
+    bool batch_step = false;    // parsing a script line: no usage text
 
 public:
     PTPToolCLI() = default;
     ~PTPToolCLI() {
-        if (fd >= 0) {
-            close(fd);
+        if (sendSocket >= 0) {
+            close(sendSocket);
         }
     }
 
     // Utility functions
-    static clockid_t get_clockid(int fd) {
-        #define CLOCKFD 3
-        #define FD_TO_CLOCKID(fd) ((~(clockid_t)(fd) << 3) | CLOCKFD)
-        return FD_TO_CLOCKID(fd);
+    static bool reportError(int err, const char *what) {
+        if (err < 0) {
+            fprintf(stderr, "%s: %s\n", what, strerror(-err));
+            return false;
+        }
+        return true;
+    }
+
+    // The -d device as given: /dev/ptpN, sim:N, remote:N or remote:sim:N
+    std::string deviceName() const {
+        char name[32];
+        snprintf(name, sizeof(name), "%s%s%d", remote ? "remote:" : "",
+                 simulate ? "sim:" : remote ? "" : "/dev/ptp", device);
+        return name;
     }
 
-    static void handle_alarm(int s) { 
-        printf("received signal %d\n", s); 
+    static void handle_interrupt(int) {
+        interrupted = 1;
     }
 
     static void handle_stop_signal(int s) {
@@ -130,14 +330,6 @@ public:
         return 0;
     }
 
-    static long ppb_to_scaled_ppm(int ppb) {
-        return (long)(ppb * 65.536);
-    }
-
-    static int64_t pctns(struct ptp_clock_time *t) {
-        return t->sec * 1000000000LL + t->nsec;
-    }
-
     int optArgToInt() {
         try {
             return std::stoi(optarg);
@@ -147,10 +339,71 @@ public:
         }
     }
 
-    std::string getPHCFileName(int phc_index) {
-        std::stringstream s;
-        s << "/dev/ptp" << phc_index;
-        return s.str();
+    enum LongOption {
+        OPT_FREQ_SWEEP = 256,
+        OPT_SWEEP_DWELL,
+        OPT_SWEEP_INTERVAL,
+        OPT_SWEEP_TOLERANCE,
+        OPT_TIMER_COUNT,
+        OPT_RT_PRIO,
+        OPT_CPU,
+        OPT_MLOCK,
+        OPT_BENCH,
+        OPT_INTERP,
+        OPT_MODEL_INTERVAL,
+        OPT_PUBLISH_SHM,
+        OPT_READ_SHM,
+        OPT_EXTTS_OUT,
+        OPT_DECODE,
+        OPT_CAPTURE,
+        OPT_REPLAY,
+        OPT_REPLAY_FROM,
+        OPT_REPLAY_SPEED,
+        OPT_SIM_CONFIG,
+        OPT_CHANNELS,
+        OPT_DEVICES,
+        OPT_METRICS,
+        OPT_TRACE,
+        OPT_STABILITY,
+        OPT_STABILITY_SAMPLES,
+        OPT_STABILITY_INTERVAL,
+        OPT_STABILITY_PERIOD,
+        OPT_DRIFT,
+        OPT_DRIFT_WINDOW,
+        OPT_DRIFT_INTERVAL,
+        OPT_FORMAT,
+        OPT_BATCH,
+        OPT_KEEP_GOING,
+        OPT_DAEMON,
+        OPT_SOCKET,
+        OPT_WATCH_OFFSET,
+        OPT_WATCH_INTERVAL,
+        OPT_APPLY,
+        OPT_DRY_RUN,
+        OPT_STATE,
+        OPT_PEROUT_PHASE,
+        OPT_PEROUT_DUTY,
+        OPT_PEROUT_ONE_SHOT,
+        OPT_PEROUT_KERNEL_PHASE,
+        OPT_PEROUT_VERIFY,
+        OPT_PEROUT_TOLERANCE,
+        OPT_TRIGGER,
+        OPT_TRIGGER_OUT,
+        OPT_TRIGGER_DELAY,
+        OPT_WATCHDOG,
+        OPT_WATCHDOG_STEP,
+        OPT_WATCHDOG_FREQ,
+        OPT_WATCHDOG_LATENCY,
+        OPT_WATCHDOG_SYSLOG,
+        OPT_WATCHDOG_HOOK,
+    };
+
+    // Prints the option summary, except for a batch step where the getopt
+    // message and the script position say enough.
+    void badUsage(char *progname) const {
+        if (!batch_step) {
+            usage(progname);
+        }
     }
 
     static void usage(char *progname) {
@@ -158,7 +411,13 @@ public:
                 "ShiwaPTPTool CLI - Precision Time Protocol Management Tool\n\n"
                 "usage: %s [options]\n\n"
                 "Device Options:\n"
-                " -d name    device to open (PTP clock index)\n\n"
+                " -d name    device to open (PTP clock index, or sim:N for a\n"
+                "            simulated clock that needs neither hardware nor root);\n"
+                "            a remote: prefix (remote:N, remote:sim:N) goes through\n"
+                "            the --daemon socket\n"
+                " --sim-config key=val,...\n"
+                "            simulated clock settings: offset, freq (ppb), noise,\n"
+                "            latency, period, jitter (ns), channels, max_adj\n\n"
                 "Time Management:\n"
                 " -g         get the ptp clock time\n"
                 " -s         set the ptp clock time from the system time\n"
@@ -170,6 +429,35 @@ public:
                 " -c         query the ptp clock's capabilities\n"
                 " -k val     measure time offset between system and phc clock\n"
                 "            for 'val' times (Maximum 25)\n\n"
+                "Calibration:\n"
+                " --freq-sweep min:max:step\n"
+                "            step the frequency adjustment from 'min' to 'max' ppb\n"
+                "            and print the measured frequency response\n"
+                " --sweep-dwell sec      time spent at each step (default 10)\n"
+                " --sweep-interval ms    offset sampling interval (default 100)\n"
+                " --sweep-tolerance ppb  settling band (default 20)\n"
+                " --drift n  take 'n' PHC/system offset samples and print the\n"
+                "            frequency error fitted over a sliding window, with\n"
+                "            its 3-sigma bound, once per window\n"
+                " --drift-window n       samples per window (default 100)\n"
+                " --drift-interval us    sampling interval (default 1000)\n"
+                " --bench n  measure the cost of 'n' PHC reads per method\n"
+                "            against the vDSO CLOCK_REALTIME read\n"
+                " --interp n compare 'n' interpolated PHC reads against the PHC\n"
+                " --model-interval ms    clock model refresh interval (default 100)\n\n"
+                "Stability Analysis:\n"
+                " --stability file\n"
+                "            overlapping ADEV, MDEV and TDEV at octave taus of the\n"
+                "            '-i' channel of an event capture, against its pulse grid\n"
+                " --stability-samples n  the same for 'n' live PHC/system offsets\n"
+                " --stability-interval ms  live sampling interval (default 100)\n"
+                " --stability-period ns  capture pulse period (default: inferred)\n\n"
+                "Shared Memory:\n"
+                " --publish-shm name\n"
+                "            publish the PHC clock model in /dev/shm/'name' until\n"
+                "            interrupted (see src/phc_shm.h for the reader)\n"
+                " --read-shm name\n"
+                "            print the PHC time from a published page\n\n"
                 "Pin Management:\n"
                 " -l         list the current pin configuration\n"
                 " -L pin,val configure pin index 'pin' with function 'val'\n"
@@ -180,18 +468,102 @@ public:
                 "            2 - periodic output\n\n"
                 "Event Management:\n"
                 " -e val     read 'val' external time stamp events\n"
+                " --extts-out file\n"
+                "            write the events as binary records to 'file'\n"
+                "            ('-' for stdout) instead of printing them\n"
+                " --decode file\n"
+                "            print the records of a binary event file ('-' for stdin)\n"
+                " --capture file\n"
+                "            record the events to an indexed capture ('file' and\n"
+                "            'file.idx') instead of printing them\n"
+                " --replay file\n"
+                "            feed a capture back through the event processing\n"
+                "            (printing, -E forwarding, --extts-out, statistics)\n"
+                " --replay-from sec      start at PTP second 'sec'\n"
+                " --replay-speed x       replay 'x' times faster than captured\n"
+                "                        (default 1, 0 = no pacing)\n"
                 " -i val     index for event/trigger\n"
-                " -p val     enable output with a period of 'val' nanoseconds\n\n"
+                " --channels list\n"
+                "            capture events on several channels at once, e.g.\n"
+                "            '0,2' or 'all'; -e then counts events per channel\n"
+                " --devices list\n"
+                "            capture on several PHCs from one thread, e.g. '0,1,sim:2'\n"
+                "            or 'all' (every /dev/ptp*); replaces -d for -e\n"
+                " -p val     program periodic output '-i' with a period of 'val'\n"
+                "            nanoseconds (0 disables it); edges lie on the grid\n"
+                "            phase + k * period from the PTP epoch, the first one is\n"
+                "            the next grid edge\n"
+                " --perout-phase ns      edge offset from the epoch grid (default 0)\n"
+                " --perout-duty ns       on time of each period\n"
+                " --perout-one-shot      a single edge\n"
+                " --perout-kernel-phase  pass the phase to the driver (PTP_PEROUT_PHASE)\n"
+                "                        instead of computing the start time\n"
+                " --perout-verify ch     timestamp the first edge on loopback EXTTS\n"
+                "                        channel 'ch' and check its alignment\n"
+                " --perout-tolerance ns  allowed first-edge error (default 1000)\n"
+                " --trigger n\n"
+                "            for each of 'n' edges on EXTTS channel '-i', start output\n"
+                "            --trigger-out at the edge plus --trigger-delay; one-shot\n"
+                "            unless -p gives a period. Prints the reaction latency\n"
+                "            from the event read to the completed request\n"
+                " --trigger-out ch       output channel (default 0)\n"
+                " --trigger-delay ns     output start after the edge (default 1000000)\n\n"
                 "Timer Functions:\n"
                 " -a val     request a one-shot alarm after 'val' seconds\n"
-                " -A val     request a periodic alarm every 'val' seconds\n\n"
+                " -A val     request a periodic alarm every 'val' seconds\n"
+                "            (fractions allowed, e.g. 0.001)\n"
+                " --timer-count n\n"
+                "            stop the periodic alarm after 'n' wakeups\n"
+                "            the wakeup lateness p50/p99/max is printed on exit\n\n"
                 "PPS Control:\n"
                 " -P val     enable or disable (val=1|0) the system clock PPS\n\n"
+                "Configuration:\n"
+                " --apply file\n"
+                "            bring pins, periodic outputs, PPS and frequency to the\n"
+                "            state described in 'file', changing only what differs\n"
+                " --dry-run  print the changes --apply would make\n"
+                " --state file           last applied outputs and PPS (default\n"
+                "                        /run/shiwaptptool-ptpN.state)\n\n"
                 "Network Functions:\n"
                 " -E addr    send timestamps to machine\n"
                 " -G addr    listen on addr\n"
                 " -n name    hostname for network operations\n\n"
+                "Real-time Profile (extts, trigger, timers, sweep, server):\n"
+                " --rt-prio val  run with SCHED_FIFO priority 'val'\n"
+                " --cpu val      pin the hot thread to CPU 'val'\n"
+                " --mlock        lock and prefault memory (mlockall)\n\n"
+                "Monitoring:\n"
+                " --metrics [addr:]port\n"
+                "            serve Prometheus metrics over HTTP (default address\n"
+                "            127.0.0.1) while the command runs\n"
+                " --trace    print cycle-counter latency histograms of every PHC\n"
+                "            call, send() and event on exit (also on SIGUSR1)\n"
+                " --watchdog ms\n"
+                "            sample the PHC/system offset every 'ms' until interrupted\n"
+                "            and alert on time steps, frequency anomalies, a stalled\n"
+                "            PHC, slow or failing reads\n"
+                " --watchdog-step ns     unexplained offset change (default 100000)\n"
+                " --watchdog-freq ppb    short-term frequency change (default 10000)\n"
+                " --watchdog-latency ns  offset read time (default 100000)\n"
+                " --watchdog-syslog      also send alerts to syslog\n"
+                " --watchdog-hook cmd    also run 'cmd' with /bin/sh for every alert,\n"
+                "                        described in SHIWA_* environment variables\n\n"
+                "Control Daemon:\n"
+                " --daemon   keep devices open and serve them to -d remote:N clients\n"
+                "            over a Unix socket until interrupted\n"
+                " --socket path          daemon socket (default " PHC_DEFAULT_SOCKET ")\n"
+                " --watch-offset n       print 'n' PHC/system offsets pushed by the\n"
+                "                        daemon (needs -d remote:N)\n"
+                " --watch-interval ms    push interval (default 1000)\n\n"
+                "Batch Mode:\n"
+                " --batch file\n"
+                "            run every line of 'file' ('-' for stdin) as its own set\n"
+                "            of options against the device opened once with -d, and\n"
+                "            report the time of each step; '#' starts a comment\n"
+                " --keep-going           continue after a failed step\n\n"
                 "Other:\n"
+                " --format text|json|csv|binary\n"
+                "            output of -c, -g, -k, -l and events (default text)\n"
                 " -h         prints this message\n"
                 " -v         verbose output\n\n"
                 "Examples:\n"
@@ -199,28 +571,99 @@ public:
                 "  %s -d 0 -c                    # Show capabilities of PTP device 0\n"
                 "  %s -d 0 -k 5                 # Measure offset 5 times\n"
                 "  %s -d 0 -l                    # List pin configuration\n"
+                "  %s -d 0 --freq-sweep -1000:1000:250 # Frequency response sweep\n"
                 "  %s -G                         # Start server mode\n"
                 "  %s -d 0 -e 10 -E 192.168.1.100 # Send 10 events to 192.168.1.100\n",
-                progname, progname, progname, progname, progname, progname, progname);
+                progname, progname, progname, progname, progname, progname, progname,
+                progname);
     }
 
     bool parseArguments(int argc, char *argv[]) {
         char *progname = strrchr(argv[0], '/');
         progname = progname ? 1 + progname : argv[0];
         
+        static const struct option long_options[] = {
+            {"freq-sweep", required_argument, nullptr, OPT_FREQ_SWEEP},
+            {"sweep-dwell", required_argument, nullptr, OPT_SWEEP_DWELL},
+            {"sweep-interval", required_argument, nullptr, OPT_SWEEP_INTERVAL},
+            {"sweep-tolerance", required_argument, nullptr, OPT_SWEEP_TOLERANCE},
+            {"timer-count", required_argument, nullptr, OPT_TIMER_COUNT},
+            {"rt-prio", required_argument, nullptr, OPT_RT_PRIO},
+            {"cpu", required_argument, nullptr, OPT_CPU},
+            {"mlock", no_argument, nullptr, OPT_MLOCK},
+            {"bench", required_argument, nullptr, OPT_BENCH},
+            {"interp", required_argument, nullptr, OPT_INTERP},
+            {"model-interval", required_argument, nullptr, OPT_MODEL_INTERVAL},
+            {"publish-shm", required_argument, nullptr, OPT_PUBLISH_SHM},
+            {"read-shm", required_argument, nullptr, OPT_READ_SHM},
+            {"extts-out", required_argument, nullptr, OPT_EXTTS_OUT},
+            {"decode", required_argument, nullptr, OPT_DECODE},
+            {"capture", required_argument, nullptr, OPT_CAPTURE},
+            {"replay", required_argument, nullptr, OPT_REPLAY},
+            {"replay-from", required_argument, nullptr, OPT_REPLAY_FROM},
+            {"replay-speed", required_argument, nullptr, OPT_REPLAY_SPEED},
+            {"sim-config", required_argument, nullptr, OPT_SIM_CONFIG},
+            {"channels", required_argument, nullptr, OPT_CHANNELS},
+            {"devices", required_argument, nullptr, OPT_DEVICES},
+            {"metrics", required_argument, nullptr, OPT_METRICS},
+            {"trace", no_argument, nullptr, OPT_TRACE},
+            {"stability", required_argument, nullptr, OPT_STABILITY},
+            {"stability-samples", required_argument, nullptr, OPT_STABILITY_SAMPLES},
+            {"stability-interval", required_argument, nullptr, OPT_STABILITY_INTERVAL},
+            {"stability-period", required_argument, nullptr, OPT_STABILITY_PERIOD},
+            {"drift", required_argument, nullptr, OPT_DRIFT},
+            {"drift-window", required_argument, nullptr, OPT_DRIFT_WINDOW},
+            {"drift-interval", required_argument, nullptr, OPT_DRIFT_INTERVAL},
+            {"format", required_argument, nullptr, OPT_FORMAT},
+            {"batch", required_argument, nullptr, OPT_BATCH},
+            {"keep-going", no_argument, nullptr, OPT_KEEP_GOING},
+            {"daemon", no_argument, nullptr, OPT_DAEMON},
+            {"socket", required_argument, nullptr, OPT_SOCKET},
+            {"watch-offset", required_argument, nullptr, OPT_WATCH_OFFSET},
+            {"watch-interval", required_argument, nullptr, OPT_WATCH_INTERVAL},
+            {"apply", required_argument, nullptr, OPT_APPLY},
+            {"dry-run", no_argument, nullptr, OPT_DRY_RUN},
+            {"state", required_argument, nullptr, OPT_STATE},
+            {"perout-phase", required_argument, nullptr, OPT_PEROUT_PHASE},
+            {"perout-duty", required_argument, nullptr, OPT_PEROUT_DUTY},
+            {"perout-one-shot", no_argument, nullptr, OPT_PEROUT_ONE_SHOT},
+            {"perout-kernel-phase", no_argument, nullptr, OPT_PEROUT_KERNEL_PHASE},
+            {"perout-verify", required_argument, nullptr, OPT_PEROUT_VERIFY},
+            {"perout-tolerance", required_argument, nullptr, OPT_PEROUT_TOLERANCE},
+            {"trigger", required_argument, nullptr, OPT_TRIGGER},
+            {"trigger-out", required_argument, nullptr, OPT_TRIGGER_OUT},
+            {"trigger-delay", required_argument, nullptr, OPT_TRIGGER_DELAY},
+            {"watchdog", required_argument, nullptr, OPT_WATCHDOG},
+            {"watchdog-step", required_argument, nullptr, OPT_WATCHDOG_STEP},
+            {"watchdog-freq", required_argument, nullptr, OPT_WATCHDOG_FREQ},
+            {"watchdog-latency", required_argument, nullptr, OPT_WATCHDOG_LATENCY},
+            {"watchdog-syslog", no_argument, nullptr, OPT_WATCHDOG_SYSLOG},
+            {"watchdog-hook", required_argument, nullptr, OPT_WATCHDOG_HOOK},
+            {nullptr, 0, nullptr, 0},
+        };
+
         int c;
-        while (EOF != (c = getopt(argc, argv, "a:A:cd:e:f:ghi:k:lL:p:P:sSt:T:vE:Gn:"))) {
+        while (EOF != (c = getopt_long(argc, argv, "a:A:cd:e:f:ghi:k:lL:p:P:sSt:T:vE:Gn:",
+                                       long_options, nullptr))) {
             switch (c) {
                 case 'a':
-                    oneshot = atoi(optarg);
+                    oneshot = atof(optarg);
                     break;
                 case 'A':
-                    periodic = atoi(optarg);
+                    periodic = atof(optarg);
                     break;
                 case 'c':
                     capabilities = 1;
                     break;
                 case 'd':
+                    if (!strncmp(optarg, "remote:", 7)) {
+                        remote = true;
+                        optarg += 7;
+                    }
+                    if (!strncmp(optarg, "sim:", 4)) {
+                        simulate = true;
+                        optarg += 4;
+                    }
                     device = optArgToInt();
                     break;
                 case 'e':
@@ -246,13 +689,13 @@ public:
                     {
                         int cnt = sscanf(optarg, "%d,%d", &pin_index, &pin_func);
                         if (cnt != 2) {
-                            usage(progname);
+                            badUsage(progname);
                             return false;
                         }
                     }
                     break;
                 case 'p':
-                    perout = atoi(optarg);
+                    perout = atoll(optarg);
                     break;
                 case 'P':
                     pps = atoi(optarg);
@@ -279,12 +722,198 @@ public:
                 case 'n':
                     hostname = optarg;
                     break;
+                case OPT_FREQ_SWEEP:
+                    {
+                        int cnt = sscanf(optarg, "%d:%d:%d", &sweep_min, &sweep_max,
+                                         &sweep_step);
+                        if (cnt != 3 || sweep_step <= 0 || sweep_max < sweep_min) {
+                            fprintf(stderr, "invalid sweep range: '%s'\n", optarg);
+                            return false;
+                        }
+                        freq_sweep = true;
+                    }
+                    break;
+                case OPT_SWEEP_DWELL:
+                    sweep_dwell = optArgToInt();
+                    break;
+                case OPT_SWEEP_INTERVAL:
+                    sweep_interval = optArgToInt();
+                    break;
+                case OPT_SWEEP_TOLERANCE:
+                    sweep_tolerance = optArgToInt();
+                    break;
+                case OPT_TIMER_COUNT:
+                    timer_count = atol(optarg);
+                    break;
+                case OPT_RT_PRIO:
+                    rt.priority = optArgToInt();
+                    break;
+                case OPT_CPU:
+                    rt.cpu = optArgToInt();
+                    break;
+                case OPT_MLOCK:
+                    rt.lockMemory = true;
+                    break;
+                case OPT_BENCH:
+                    run_bench = true;
+                    bench_iterations = optArgToInt();
+                    break;
+                case OPT_INTERP:
+                    interp_checks = optArgToInt();
+                    break;
+                case OPT_MODEL_INTERVAL:
+                    model_interval = optArgToInt();
+                    break;
+                case OPT_PUBLISH_SHM:
+                    shm_publish = optarg;
+                    break;
+                case OPT_READ_SHM:
+                    shm_read = optarg;
+                    break;
+                case OPT_EXTTS_OUT:
+                    extts_out = optarg;
+                    break;
+                case OPT_DECODE:
+                    decode_file = optarg;
+                    break;
+                case OPT_CAPTURE:
+                    capture_file = optarg;
+                    break;
+                case OPT_REPLAY:
+                    replay_file = optarg;
+                    break;
+                case OPT_REPLAY_FROM:
+                    replay_from = atoll(optarg);
+                    break;
+                case OPT_CHANNELS:
+                    extts_channels = optarg;
+                    break;
+                case OPT_DEVICES:
+                    extts_devices = optarg;
+                    break;
+                case OPT_METRICS:
+                    metrics_addr = optarg;
+                    break;
+                case OPT_TRACE:
+                    trace_dump = true;
+                    break;
+                case OPT_STABILITY:
+                    stability_file = optarg;
+                    break;
+                case OPT_STABILITY_SAMPLES:
+                    stability_samples = atoll(optarg);
+                    break;
+                case OPT_STABILITY_INTERVAL:
+                    stability_interval = optArgToInt();
+                    break;
+                case OPT_STABILITY_PERIOD:
+                    stability_period = atoll(optarg);
+                    break;
+                case OPT_DRIFT:
+                    drift_samples = atol(optarg);
+                    break;
+                case OPT_DRIFT_WINDOW:
+                    drift_window = optArgToInt();
+                    break;
+                case OPT_DRIFT_INTERVAL:
+                    drift_interval = optArgToInt();
+                    break;
+                case OPT_BATCH:
+                    batch_file = optarg;
+                    break;
+                case OPT_KEEP_GOING:
+                    keep_going = true;
+                    break;
+                case OPT_DAEMON:
+                    run_daemon = true;
+                    break;
+                case OPT_SOCKET:
+                    socket_path = optarg;
+                    break;
+                case OPT_WATCH_OFFSET:
+                    watch_offset = atol(optarg);
+                    break;
+                case OPT_WATCH_INTERVAL:
+                    watch_interval = optArgToInt();
+                    break;
+                case OPT_APPLY:
+                    apply_file = optarg;
+                    break;
+                case OPT_DRY_RUN:
+                    dry_run = true;
+                    break;
+                case OPT_STATE:
+                    state_file = optarg;
+                    break;
+                case OPT_PEROUT_PHASE:
+                    perout_phase = atoll(optarg);
+                    break;
+                case OPT_PEROUT_DUTY:
+                    perout_duty = atoll(optarg);
+                    break;
+                case OPT_PEROUT_ONE_SHOT:
+                    perout_one_shot = true;
+                    break;
+                case OPT_PEROUT_KERNEL_PHASE:
+                    perout_kernel_phase = true;
+                    break;
+                case OPT_PEROUT_VERIFY:
+                    perout_verify = optArgToInt();
+                    break;
+                case OPT_PEROUT_TOLERANCE:
+                    perout_tolerance = atoll(optarg);
+                    break;
+                case OPT_TRIGGER:
+                    trigger_count = atol(optarg);
+                    break;
+                case OPT_TRIGGER_OUT:
+                    trigger_out = optArgToInt();
+                    break;
+                case OPT_TRIGGER_DELAY:
+                    trigger_delay = atoll(optarg);
+                    break;
+                case OPT_WATCHDOG:
+                    watchdog_interval = optArgToInt();
+                    break;
+                case OPT_WATCHDOG_STEP:
+                    watchdogConfig.stepNs = atoll(optarg);
+                    break;
+                case OPT_WATCHDOG_FREQ:
+                    watchdogConfig.freqPpb = atof(optarg);
+                    break;
+                case OPT_WATCHDOG_LATENCY:
+                    watchdogConfig.latencyNs = atoll(optarg);
+                    break;
+                case OPT_WATCHDOG_SYSLOG:
+                    watchdog_syslog = true;
+                    break;
+                case OPT_WATCHDOG_HOOK:
+                    watchdog_hook = optarg;
+                    break;
+                case OPT_FORMAT:
+                    if (!records.setFormat(optarg)) {
+                        fprintf(stderr, "unknown output format '%s'\n", optarg);
+                        return false;
+                    }
+                    break;
+                case OPT_SIM_CONFIG:
+                    if (!simConfig.parse(optarg)) {
+                        return false;
+                    }
+                    break;
+                case OPT_REPLAY_SPEED:
+                    replay_speed = atof(optarg);
+                    if (replay_speed < 0) {
+                        badUsage(progname);
+                        return false;
+                    }
+                    break;
                 case 'h':
                     usage(progname);
                     return false;
                 case '?':
                 default:
-                    usage(progname);
+                    badUsage(progname);
                     return false;
             }
         }
@@ -295,13 +924,29 @@ public:
     bool initialize() {
         setbuf(stdout, NULL);
 
+        // Before any thread is started, so they all leave SIGUSR1 to the
+        // dump thread.
+        if (phcTraceDumpOnSignal(SIGUSR1) && trace_dump) {
+            fprintf(stderr, "Warning: built without tracing (SHIWA_TRACE=0)\n");
+        }
+
+        if (rt.enabled() && !rt.apply()) {
+            fprintf(stderr, "Warning: real-time profile is only partially applied\n");
+        }
+
+        if (metrics_addr && !metricsServer.start(metrics_addr)) {
+            return false;
+        }
+
         if (run_srv) {
             return startServer();
         }
 
-        if (geteuid() != 0) {
-            fprintf(stderr, "Error: user is not root. PTP operations require root privileges.\n");
-            return false;
+        // --devices opens its own handles in handleExternalTimestamps(),
+        // the daemon opens devices on behalf of its clients.
+        if (shm_read || decode_file || replay_file || stability_file || run_daemon ||
+            (extts && extts_devices)) {
+            return true;
         }
 
         if (device == -1) {
@@ -309,15 +954,35 @@ public:
             return false;
         }
 
-        fd = open(getPHCFileName(device).c_str(), O_RDWR);
-        if (fd < 0) {
-            fprintf(stderr, "Error opening /dev/ptp%d: %s\n", device, strerror(errno));
+        // The daemon checks permissions against its own credentials.
+        if (remote) {
+            int err = phc.openRemote(socket_path, device, simulate);
+            if (err) {
+                fprintf(stderr, "Error opening %s%d through %s: %s\n", simulate ? "sim:" : "",
+                        device, socket_path, strerror(-err));
+                return false;
+            }
+            return true;
+        }
+
+        if (simulate) {
+            int err = phc.openSim(device, simConfig);
+            if (err) {
+                fprintf(stderr, "Error creating simulated clock %d: %s\n", device,
+                        strerror(-err));
+                return false;
+            }
+            return true;
+        }
+
+        if (geteuid() != 0) {
+            fprintf(stderr, "Error: user is not root. PTP operations require root privileges.\n");
             return false;
         }
 
-        clkid = get_clockid(fd);
-        if (CLOCK_INVALID == clkid) {
-            fprintf(stderr, "Error: failed to read clock id\n");
+        int err = phc.open(device);
+        if (err) {
+            fprintf(stderr, "Error opening /dev/ptp%d: %s\n", device, strerror(-err));
             return false;
         }
 
@@ -369,6 +1034,29 @@ public:
         printf("Press Ctrl+C to stop the server.\n");
         
         server_running = true;
+
+        // Per-sender metrics, keyed by the Msg name or the source address.
+        // Names come from any datagram, so only the first SERVER_MAX_HOSTS
+        // senders get their own series and the rest share "other". That
+        // also bounds how often the loop registers a metric, which takes
+        // the registry lock.
+        struct HostMetrics {
+            MetricCounter *packets;
+            MetricGauge *lastSeen;
+        };
+        auto hostMetrics = [](const std::string &host) {
+            std::string label = MetricsRegistry::label("host", host);
+            return HostMetrics{
+                MetricsRegistry::instance().counter("shiwaptp_host_packets_total",
+                                                    "Datagrams received per sender", label),
+                MetricsRegistry::instance().gauge("shiwaptp_host_last_seen_seconds",
+                                                  "Unix time of the last datagram per sender",
+                                                  label)};
+        };
+        std::map<std::string, HostMetrics> hosts;
+        HostMetrics otherHosts = hostMetrics("other");
+        MetricCounter *packetsTotal = MetricsRegistry::instance().counter(
+            "shiwaptp_server_packets_total", "Datagrams received by the server");
         
         // Simple server loop
         char buffer[1024];
@@ -398,9 +1086,23 @@ public:
             buffer[received] = '\0';
             printf("Received PTP request from %s:%d\n", 
                    inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+
+            std::string host = inet_ntoa(client_addr.sin_addr);
+            if (received == sizeof(Msg) && buffer[offsetof(Msg, name)]) {
+                host.assign(buffer + offsetof(Msg, name), strnlen(buffer + offsetof(Msg, name), 63));
+            }
+            auto it = hosts.find(host);
+            if (it == hosts.end() && hosts.size() < SERVER_MAX_HOSTS && host != "other") {
+                it = hosts.emplace(host, hostMetrics(host)).first;
+            }
+            HostMetrics &hm = it != hosts.end() ? it->second : otherHosts;
+            packetsTotal->inc();
+            hm.packets->inc();
+            hm.lastSeen->set(time(nullptr));
             
             // Simple response - in real implementation this would be proper PTP protocol
             const char* response = "PTP_RESPONSE";
+            PHC_TRACE_SCOPE(PHC_TRACE_REPLY);
             sendto(sockfd, response, strlen(response), 0,
                    (struct sockaddr*)&client_addr, client_len);
         }
@@ -411,6 +1113,155 @@ public:
     }
 
     bool executeCommands() {
+        bool ok = batch_file ? runBatch() : runCommand();
+        if (rt.enabled()) {
+            rt.report();
+        }
+        if (trace_dump) {
+            phcTraceDump(stderr);
+        }
+        if (!reportError(records.flush(), "output")) {
+            ok = false;
+        }
+        return ok;
+    }
+
+private:
+    // Splits a script line into arguments in place. Whitespace separates
+    // arguments, single or double quotes group them and '#' outside quotes
+    // ends the line. Returns false on an unterminated quote.
+    static bool splitArguments(char *line, std::vector<char *> *args) {
+        char *out = line;
+        char *p = line;
+        for (;;) {
+            while (isspace((unsigned char)*p)) {
+                p++;
+            }
+            if (!*p || *p == '#') {
+                break;
+            }
+            args->push_back(out);
+            char quote = 0;
+            for (; *p && (quote || !isspace((unsigned char)*p)); p++) {
+                if (quote && *p == quote) {
+                    quote = 0;
+                } else if (!quote && (*p == '"' || *p == '\'')) {
+                    quote = *p;
+                } else {
+                    *out++ = *p;
+                }
+            }
+            if (quote) {
+                return false;
+            }
+            if (*p) {
+                p++;
+            }
+            *out++ = '\0';
+        }
+        args->push_back(nullptr);
+        return true;
+    }
+
+    // Runs one script step with default options, except for the output
+    // format, on the device this instance opened.
+    bool runStep(std::vector<char *> &args, int line_no) {
+        std::unique_ptr<PTPToolCLI> step(new PTPToolCLI);
+        step->records.setFormat(records.format());
+        step->batch_step = true;
+        optind = 0;
+        if (!step->parseArguments((int)args.size() - 1, args.data())) {
+            fprintf(stderr, "%s:%d: invalid options\n", batch_file, line_no);
+            return false;
+        }
+        if (step->device != -1 || step->batch_file || step->run_srv || step->run_daemon ||
+            step->metrics_addr || step->rt.enabled()) {
+            fprintf(stderr, "-d, -G, --batch, --daemon, --metrics and the real-time options "
+                            "apply to the whole batch\n");
+            return false;
+        }
+        step->device = device;
+        step->simulate = simulate;
+        step->remote = remote;
+        step->phc.swap(phc);
+        bool ok = step->runCommand();
+        step->phc.swap(phc);
+        if (!reportError(step->records.flush(), "output")) {
+            ok = false;
+        }
+        return ok;
+    }
+
+    bool runBatch() {
+        FILE *in = strcmp(batch_file, "-") ? fopen(batch_file, "r") : stdin;
+        if (!in) {
+            perror(batch_file);
+            return false;
+        }
+        install_handler(SIGINT, handle_interrupt);
+        install_handler(SIGTERM, handle_interrupt);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int line_no = 0, steps = 0, failed = 0;
+        char line[4096];
+        while (fgets(line, sizeof(line), in) && !interrupted) {
+            line_no++;
+            line[strcspn(line, "\r\n")] = '\0';
+            std::string command = line;
+            std::vector<char *> args;
+            char progname[] = "batch";
+            args.push_back(progname);
+            bool parsed = splitArguments(line, &args);
+            if (parsed && args.size() == 2) {
+                continue;
+            }
+            steps++;
+
+            struct timespec t1, t2;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            bool ok = parsed && runStep(args, line_no);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            if (!parsed) {
+                fprintf(stderr, "%s:%d: unterminated quote\n", batch_file, line_no);
+            }
+            double us = (tsns(&t2) - tsns(&t1)) / 1000.0;
+
+            if (records.structured()) {
+                records.restartHeader();
+                records.begin("step");
+                records.field("line", line_no);
+                records.field("command", command.c_str());
+                records.field("ok", ok ? 1 : 0);
+                records.field("elapsed_us", us);
+                records.end();
+                records.flush();
+            } else {
+                fprintf(stderr, "[%s:%d] %s: %s in %.1f us\n", batch_file, line_no,
+                        command.c_str(), ok ? "ok" : "FAILED", us);
+            }
+            if (!ok) {
+                failed++;
+                if (!keep_going) {
+                    break;
+                }
+            }
+        }
+        if (in != stdin) {
+            fclose(in);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stderr, "Batch: %d steps, %d failed%s, %.3f ms\n", steps, failed,
+                interrupted ? ", interrupted" : "", (tsns(&end) - tsns(&start)) / 1e6);
+        return failed == 0 && !interrupted;
+    }
+
+    bool runCommand() {
+        if (run_daemon) {
+            return runDaemon();
+        }
+
         if (capabilities) {
             return queryCapabilities();
         }
@@ -439,8 +1290,15 @@ public:
             return setTimeToValue();
         }
 
-        if (addr_client) {
-            return setupNetworkClient();
+        // The network client only forwards events, so it is set up first
+        // and the remaining options still run.
+        if (addr_client && !setupNetworkClient()) {
+            return false;
+        }
+
+        // Before -p, which only shapes the triggered output here
+        if (trigger_count > 0) {
+            return runTrigger();
         }
 
         if (extts) {
@@ -471,22 +1329,79 @@ public:
             return configurePPS();
         }
 
+        if (apply_file) {
+            return applyConfig();
+        }
+
         if (pct_offset) {
             return measureOffset();
         }
 
+        if (freq_sweep) {
+            return frequencySweep();
+        }
+
+        if (drift_samples > 0) {
+            return estimateDrift();
+        }
+
+        if (watch_offset > 0) {
+            return watchOffset();
+        }
+
+        if (watchdog_interval) {
+            return runWatchdog();
+        }
+
+        if (stability_file || stability_samples > 0) {
+            return analyzeStability();
+        }
+
+        if (run_bench) {
+            return benchmarkReads();
+        }
+
+        if (interp_checks) {
+            return checkInterpolation();
+        }
+
+        if (shm_publish) {
+            return publishSharedMemory();
+        }
+
+        if (shm_read) {
+            return readSharedMemory();
+        }
+
+        if (decode_file) {
+            return decodeExternalTimestamps();
+        }
+
+        if (replay_file) {
+            return replayCapture();
+        }
+
         return true;
     }
 
-private:
     bool queryCapabilities() {
         struct ptp_clock_caps caps;
-        if (ioctl(fd, PTP_CLOCK_GETCAPS, &caps)) {
-            perror("PTP_CLOCK_GETCAPS");
+        if (!reportError(phc.getCaps(&caps), "PTP_CLOCK_GETCAPS")) {
             return false;
+        } else if (records.structured()) {
+            records.begin("caps");
+            records.field("device", device);
+            records.field("max_adj", caps.max_adj);
+            records.field("n_alarm", caps.n_alarm);
+            records.field("n_ext_ts", caps.n_ext_ts);
+            records.field("n_per_out", caps.n_per_out);
+            records.field("pps", caps.pps);
+            records.field("n_pins", caps.n_pins);
+            records.field("cross_timestamping", caps.cross_timestamping);
+            records.end();
         } else {
             printf(
-                "/dev/ptp%d\n"
+                "%s\n"
                 "capabilities:\n"
                 "  %d maximum frequency adjustment (ppb)\n"
                 "  %d programmable alarms\n"
@@ -495,19 +1410,14 @@ private:
                 "  %d pulse per second\n"
                 "  %d programmable pins\n"
                 "  %d cross timestamping\n",
-                device, caps.max_adj, caps.n_alarm, caps.n_ext_ts, caps.n_per_out,
+                deviceName().c_str(), caps.max_adj, caps.n_alarm, caps.n_ext_ts, caps.n_per_out,
                 caps.pps, caps.n_pins, caps.cross_timestamping);
         }
         return true;
     }
 
     bool adjustFrequency() {
-        struct timex tx;
-        memset(&tx, 0, sizeof(tx));
-        tx.modes = ADJ_FREQUENCY;
-        tx.freq = ppb_to_scaled_ppm(adjfreq);
-        if (clock_adjtime(clkid, &tx)) {
-            perror("clock_adjtime");
+        if (!reportError(phc.adjustFrequency(adjfreq), "clock_adjtime")) {
             return false;
         } else {
             puts("Frequency adjustment okay");
@@ -516,13 +1426,7 @@ private:
     }
 
     bool adjustTime() {
-        struct timex tx;
-        memset(&tx, 0, sizeof(tx));
-        tx.modes = ADJ_SETOFFSET;
-        tx.time.tv_sec = adjtime;
-        tx.time.tv_usec = 0;
-        if (clock_adjtime(clkid, &tx) < 0) {
-            perror("clock_adjtime");
+        if (!reportError(phc.adjustTime(adjtime * 1000000000LL), "clock_adjtime")) {
             return false;
         } else {
             puts("Time shift okay");
@@ -532,9 +1436,14 @@ private:
 
     bool getTime() {
         struct timespec ts;
-        if (clock_gettime(clkid, &ts)) {
-            perror("clock_gettime");
+        if (!reportError(phc.getTime(&ts), "clock_gettime")) {
             return false;
+        } else if (records.structured()) {
+            records.begin("time");
+            records.field("device", device);
+            records.field("sec", ts.tv_sec);
+            records.field("nsec", ts.tv_nsec);
+            records.end();
         } else {
             printf("Clock time: %ld.%09ld or %s", ts.tv_sec, ts.tv_nsec,
                    ctime(&ts.tv_sec));
@@ -545,8 +1454,7 @@ private:
     bool setTimeFromSystem() {
         struct timespec ts;
         clock_gettime(CLOCK_REALTIME, &ts);
-        if (clock_settime(clkid, &ts)) {
-            perror("clock_settime");
+        if (!reportError(phc.setTime(&ts), "clock_settime")) {
             return false;
         } else {
             puts("Set time from system okay");
@@ -556,7 +1464,9 @@ private:
 
     bool setSystemFromTime() {
         struct timespec ts;
-        clock_gettime(clkid, &ts);
+        if (!reportError(phc.getTime(&ts), "clock_gettime")) {
+            return false;
+        }
         if (clock_settime(CLOCK_REALTIME, &ts)) {
             perror("clock_settime");
             return false;
@@ -570,8 +1480,7 @@ private:
         struct timespec ts;
         ts.tv_sec = seconds;
         ts.tv_nsec = 0;
-        if (clock_settime(clkid, &ts)) {
-            perror("clock_settime");
+        if (!reportError(phc.setTime(&ts), "clock_settime")) {
             return false;
         } else {
             puts("Set time to value okay");
@@ -607,158 +1516,912 @@ private:
         return true;
     }
 
-    bool handleExternalTimestamps() {
-        struct ptp_extts_event event;
-        struct ptp_extts_request extts_request;
-        int cnt;
+    // Opens the binary outputs requested for events. While any is open the
+    // per-event text lines are suppressed.
+    bool openEventSinks(int source) {
+        if (extts_out) {
+            int err = exttsWriter.open(extts_out, source);
+            if (err) {
+                fprintf(stderr, "Error opening %s: %s\n", extts_out, strerror(-err));
+                return false;
+            }
+        }
+        if (capture_file) {
+            int err = captureWriter.open(capture_file, source);
+            if (err) {
+                fprintf(stderr, "Error opening %s: %s\n", capture_file, strerror(-err));
+                return false;
+            }
+        }
+        return true;
+    }
 
-        memset(&extts_request, 0, sizeof(extts_request));
-        extts_request.index = index;
-        extts_request.flags = PTP_ENABLE_FEATURE;
-        if (ioctl(fd, PTP_EXTTS_REQUEST, &extts_request)) {
-            perror("PTP_EXTTS_REQUEST");
-            extts = 0;
-            return false;
-        } else {
-            puts("External time stamp request okay");
+    bool eventTextOutput() const {
+        return !exttsWriter.isOpen() && !captureWriter.isOpen();
+    }
+
+    // Status goes to stderr when the records themselves may go to stdout.
+    FILE *eventStatus() const {
+        return eventTextOutput() && !records.structured() ? stdout : stderr;
+    }
+
+    void writeEventRecord(int source, unsigned int channel, int64_t sec, unsigned int nsec) {
+        records.begin("event");
+        records.field("device", source);
+        records.field("channel", channel);
+        records.field("sec", sec);
+        records.field("nsec", nsec);
+        records.end();
+    }
+
+    bool closeEventSinks() {
+        bool ok = true;
+        FILE *status = eventStatus();
+        if (exttsWriter.isOpen()) {
+            ok = reportError(exttsWriter.close(), extts_out);
+            if (ok) {
+                fprintf(status, "%" PRIu64 " events written to %s\n",
+                        exttsWriter.records(), extts_out);
+            }
         }
-        
-        for (; extts; extts--) {
-            cnt = read(fd, &event, sizeof(event));
-            if (cnt != sizeof(event)) {
-                perror("read");
-                break;
+        if (captureWriter.isOpen()) {
+            uint64_t n = captureWriter.records();
+            if (reportError(captureWriter.close(), capture_file)) {
+                fprintf(status, "%" PRIu64 " events captured to %s\n", n, capture_file);
+            } else {
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    void printEventStats() {
+        FILE *status = eventStatus();
+        bool multi = exttsSources.size() > 1;
+        for (const auto &src : exttsSources) {
+            for (int i = 0; i < EXTTS_MAX_CHANNELS; i++) {
+                const ExttsChannel *ch = src->channels[i].get();
+                if (!ch || !ch->events) {
+                    continue;
+                }
+                double span = (ch->last - ch->first) / 1e9;
+                if (multi) {
+                    fprintf(status, "/dev/ptp%d channel %d: %" PRIu64 " events", src->device,
+                            i, ch->events);
+                } else {
+                    fprintf(status, "Channel %d: %" PRIu64 " events", i, ch->events);
+                }
+                const IntervalStats &iv = ch->intervals;
+                if (iv.count && span > 0) {
+                    fprintf(status,
+                            ", rate %.6f Hz, interval %.1f ns, stddev %.1f ns, "
+                            "deviation min %+.1f max %+.1f ns",
+                            iv.count / span, iv.mean, iv.stddev(), iv.min - iv.mean,
+                            iv.max - iv.mean);
+                }
+                fputc('\n', status);
+            }
+            if (src->dropped) {
+                fprintf(status,
+                        "/dev/ptp%d: %" PRIu64 " events dropped (channel not requested or done)\n",
+                        src->device, src->dropped);
+            }
+        }
+    }
+
+    // Common path for every external timestamp event, live or replayed:
+    // binary records or text line, -E forwarding and per-channel statistics.
+    bool processEvent(ExttsSource &src, const struct ptp_extts_event &event, int64_t host_ns) {
+        PHC_TRACE_SCOPE(PHC_TRACE_EVENT);
+        if (exttsWriter.isOpen() || captureWriter.isOpen()) {
+            ExttsRecord rec;
+            rec.channel = event.index;
+            rec.nsec = event.t.nsec;
+            rec.sec = event.t.sec;
+            rec.host_ns = host_ns;
+            if (exttsWriter.isOpen() && !reportError(exttsWriter.append(rec), extts_out)) {
+                return false;
             }
+            if (captureWriter.isOpen() &&
+                !reportError(captureWriter.append(rec), capture_file)) {
+                return false;
+            }
+        } else if (records.structured()) {
+            writeEventRecord(src.device, event.index, event.t.sec, event.t.nsec);
+        } else if (exttsSources.size() > 1) {
+            printf("/dev/ptp%d: Event index %u at %lld.%09u\n", src.device, event.index,
+                   event.t.sec, event.t.nsec);
+        } else {
             printf("Event index %u at %lld.%09u\n", event.index, event.t.sec,
                    event.t.nsec);
-         
+        }
+
+        if (sendSocket >= 0) {
             Msg msg = {};
             msg.ptpNow = event.t.sec * 1000'000UL + event.t.nsec;
             if (hostname) {
                 strncpy(msg.name, hostname, 63);
             }
-            send(sendSocket, &msg, sizeof(msg), MSG_CONFIRM);
-
-            fflush(stdout);
-        }
-        
-        extts_request.flags = 0;
-        if (ioctl(fd, PTP_EXTTS_REQUEST, &extts_request)) {
-            perror("PTP_EXTTS_REQUEST");
+            ssize_t sent;
+            {
+                PHC_TRACE_SCOPE(PHC_TRACE_SEND);
+                sent = send(sendSocket, &msg, sizeof(msg), MSG_CONFIRM);
+            }
+            if (sent < 0) {
+                forwardErrors->inc();
+            } else {
+                forwardedTotal->inc();
+            }
         }
-        return true;
-    }
 
-    bool listPins() {
-        struct ptp_clock_caps caps;
-        struct ptp_pin_desc desc;
-        int n_pins = 0;
-        
-        if (ioctl(fd, PTP_CLOCK_GETCAPS, &caps)) {
-            perror("PTP_CLOCK_GETCAPS");
-            return false;
-        } else {
-            n_pins = caps.n_pins;
-        }
-        
-        for (int i = 0; i < n_pins; i++) {
-            desc.index = i;
-            if (ioctl(fd, PTP_PIN_GETFUNC, &desc)) {
-                perror("PTP_PIN_GETFUNC");
-                break;
+        ExttsChannel *ch = src.channel(event.index);
+        if (ch) {
+            ch->eventsTotal->inc();
+            int64_t ns = PhcDevice::toNs(&event.t);
+            if (ch->events++) {
+                ch->intervals.add(ns - ch->last);
+            } else {
+                ch->first = ns;
             }
-            printf("Name %s index %u func %u chan %u\n", desc.name, desc.index,
-                   desc.func, desc.chan);
+            ch->last = ns;
         }
         return true;
     }
 
-    bool setupOneshotTimer() {
-        timer_t timerid;
-        struct itimerspec timeout;
-        struct sigevent sigevent;
+    // Bit mask of the channels to capture: --channels, or the -i index.
+    bool exttsChannelMask(const PhcDevice &dev, uint32_t *mask) {
+        *mask = 0;
+        if (!extts_channels) {
+            if (index < 0 || index >= EXTTS_MAX_CHANNELS) {
+                fprintf(stderr, "Error: channel %d out of range\n", index);
+                return false;
+            }
+            *mask = 1u << index;
+            return true;
+        }
 
-        install_handler(SIGALRM, handle_alarm);
-        
-        sigevent.sigev_notify = SIGEV_SIGNAL;
-        sigevent.sigev_signo = SIGALRM;
-        if (timer_create(clkid, &sigevent, &timerid)) {
-            perror("timer_create");
+        struct ptp_clock_caps caps;
+        if (!reportError(dev.getCaps(&caps), "PTP_CLOCK_GETCAPS")) {
             return false;
         }
-        
-        memset(&timeout, 0, sizeof(timeout));
-        timeout.it_value.tv_sec = oneshot;
-        if (timer_settime(timerid, 0, &timeout, NULL)) {
-            perror("timer_settime");
+        int n = std::min(caps.n_ext_ts, EXTTS_MAX_CHANNELS);
+        if (!strcmp(extts_channels, "all")) {
+            *mask = n ? (uint32_t)((1ull << n) - 1) : 0;
+        } else {
+            std::stringstream list(extts_channels);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                char *end;
+                long ch = strtol(item.c_str(), &end, 10);
+                if (item.empty() || *end || ch < 0 || ch >= n) {
+                    fprintf(stderr, "Error: invalid channel '%s' (device has %d)\n",
+                            item.c_str(), caps.n_ext_ts);
+                    return false;
+                }
+                *mask |= 1u << ch;
+            }
+        }
+        if (!*mask) {
+            fprintf(stderr, "Error: no external time stamp channels to enable\n");
             return false;
         }
-        pause();
-        timer_delete(timerid);
         return true;
     }
 
-    bool setupPeriodicTimer() {
-        timer_t timerid;
-        struct itimerspec timeout;
-        struct sigevent sigevent;
+    // Builds exttsSources from --devices, or from the already open -d device.
+    bool openExttsSources() {
+        exttsSources.clear();
+        if (!extts_devices) {
+            std::unique_ptr<ExttsSource> src(new ExttsSource);
+            src->device = device;
+            src->phc = &phc;
+            src->registerMetrics();
+            exttsSources.push_back(std::move(src));
+            return true;
+        }
 
-        install_handler(SIGALRM, handle_alarm);
-        
-        sigevent.sigev_notify = SIGEV_SIGNAL;
-        sigevent.sigev_signo = SIGALRM;
-        if (timer_create(clkid, &sigevent, &timerid)) {
-            perror("timer_create");
+        std::vector<std::string> names;
+        if (!strcmp(extts_devices, "all")) {
+            for (int i = 0; i < 256; i++) {
+                struct stat st;
+                std::string path = "/dev/ptp" + std::to_string(i);
+                if (stat(path.c_str(), &st) == 0) {
+                    names.push_back(std::to_string(i));
+                }
+            }
+            if (names.empty()) {
+                fprintf(stderr, "Error: no PTP devices found\n");
+                return false;
+            }
+        } else {
+            std::stringstream list(extts_devices);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                names.push_back(item);
+            }
+        }
+
+        for (const std::string &name : names) {
+            bool sim = !name.compare(0, 4, "sim:");
+            const char *num = name.c_str() + (sim ? 4 : 0);
+            char *end;
+            long n = strtol(num, &end, 10);
+            if (!*num || *end || n < 0) {
+                fprintf(stderr, "Error: invalid device '%s'\n", name.c_str());
+                return false;
+            }
+            if (!sim && geteuid() != 0) {
+                fprintf(stderr, "Error: user is not root. PTP operations require root privileges.\n");
+                return false;
+            }
+            std::unique_ptr<ExttsSource> src(new ExttsSource);
+            src->device = (int)n;
+            src->owned.reset(new PhcDevice);
+            src->phc = src->owned.get();
+            int err = sim ? src->phc->openSim(n, simConfig) : src->phc->open(n);
+            if (err) {
+                fprintf(stderr, "Error opening %s: %s\n", name.c_str(), strerror(-err));
+                return false;
+            }
+            src->registerMetrics();
+            exttsSources.push_back(std::move(src));
+        }
+        return true;
+    }
+
+    // Handles one readiness notification of a source. PTP character devices
+    // block in read() while their queue is empty even with O_NONBLOCK, so
+    // exactly one read is issued per notification; epoll is level-triggered
+    // and reports the device again while events remain queued.
+    void readSource(ExttsSource &src, EventLoop &loop, long *pending, bool *ok) {
+        struct ptp_extts_event events[EXTTS_BATCH];
+        struct timespec t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        int cnt = src.phc->readExtts(events, (int)std::min<long>(src.pending, EXTTS_BATCH));
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        src.readLatency->observe(tsns(&t2) - tsns(&t1));
+        if (cnt == -EAGAIN || cnt == -EINTR) {
+            return;
+        }
+        if (cnt <= 0) {
+            fprintf(stderr, "/dev/ptp%d: ", src.device);
+            reportError(cnt < 0 ? cnt : -EIO, "read");
+            *ok = false;
+            *pending -= src.pending;
+            src.pending = 0;
+        }
+
+        struct timespec host;
+        clock_gettime(CLOCK_REALTIME, &host);
+        int64_t host_ns = tsns(&host);
+        for (int i = 0; i < cnt && *ok; i++) {
+            unsigned int index = events[i].index;
+            ExttsChannel *ch = index < EXTTS_MAX_CHANNELS && (src.enabled & (1u << index))
+                                   ? src.channels[index].get()
+                                   : nullptr;
+            if (!ch || ch->remaining <= 0) {
+                src.dropped++;
+                src.droppedTotal->inc();
+                continue;
+            }
+            ch->remaining--;
+            src.pending--;
+            (*pending)--;
+            *ok = processEvent(src, events[i], host_ns);
+        }
+        if (eventTextOutput()) {
+            records.flush();
+        }
+
+        if (src.pending <= 0) {
+            loop.remove(src.phc->fd());
+        }
+        if (*pending <= 0 || !*ok) {
+            loop.stop();
+        }
+    }
+
+    // Captures -e events per channel on every source from one epoll loop.
+    // SIGINT/SIGTERM stop the loop after the current wakeup.
+    bool handleExternalTimestamps() {
+        if (!openExttsSources()) {
+            return false;
+        }
+        if (exttsSources.size() > 1 && (extts_out || capture_file)) {
+            fprintf(stderr, "Error: --extts-out and --capture take a single device\n");
+            return false;
+        }
+
+        EventLoop loop;
+        if (!loop.valid()) {
+            perror("epoll_create1");
+            return false;
+        }
+        int err = loop.addSignals({SIGINT, SIGTERM}, [&loop](int) {
+            interrupted = 1;
+            loop.stop();
+        });
+        if (!reportError(err, "signalfd")) {
+            return false;
+        }
+        if (!openEventSinks(exttsSources[0]->device)) {
+            closeEventSinks();
+            return false;
+        }
+        FILE *status = eventStatus();
+
+        long pending = 0;
+        bool ok = true;
+        for (const auto &ptr : exttsSources) {
+            ExttsSource &src = *ptr;
+            uint32_t mask;
+            ok = exttsChannelMask(*src.phc, &mask) &&
+                 reportError(src.phc->setNonblocking(true), "O_NONBLOCK");
+            for (int i = 0; i < EXTTS_MAX_CHANNELS && ok; i++) {
+                if (!(mask & (1u << i))) {
+                    continue;
+                }
+                ok = reportError(src.phc->enableExtts(i, 0), "PTP_EXTTS_REQUEST");
+                if (ok) {
+                    src.enabled |= 1u << i;
+                    src.channel(i)->remaining = extts;
+                    src.pending += extts;
+                }
+            }
+            if (ok) {
+                ok = reportError(loop.add(src.phc->fd(), EPOLLIN,
+                                          [this, &src, &loop, &pending, &ok](uint32_t) {
+                                              readSource(src, loop, &pending, &ok);
+                                          }),
+                                 "epoll_ctl");
+            }
+            if (!ok) {
+                break;
+            }
+            pending += src.pending;
+            if (exttsSources.size() > 1) {
+                fprintf(status, "/dev/ptp%d: external time stamp request okay on %d channels\n",
+                        src.device, __builtin_popcount(src.enabled));
+            } else if (!extts_channels) {
+                fputs("External time stamp request okay\n", status);
+            } else {
+                fprintf(status, "External time stamp request okay on %d channels\n",
+                        __builtin_popcount(src.enabled));
+            }
+        }
+
+        if (ok && pending > 0) {
+            err = loop.run();
+            if (err) {
+                ok = reportError(err, "epoll_wait");
+            }
+        }
+        extts = 0;
+
+        for (const auto &src : exttsSources) {
+            for (int i = 0; i < EXTTS_MAX_CHANNELS; i++) {
+                if (src->enabled & (1u << i)) {
+                    reportError(src->phc->disableExtts(i), "PTP_EXTTS_REQUEST");
+                }
+            }
+            src->phc->setNonblocking(false);
+        }
+        printEventStats();
+        return closeEventSinks() && ok;
+    }
+
+    // Replays a capture through processEvent(), paced by the captured PTP
+    // timestamps divided by --replay-speed.
+    bool replayCapture() {
+        ExttsCaptureReader capture;
+        int err = capture.open(replay_file);
+        if (err) {
+            fprintf(stderr, "Error opening %s: %s\n", replay_file,
+                    err == -EPROTO ? "not an event capture" : strerror(-err));
+            return false;
+        }
+        uint64_t first = replay_from ? capture.seek(replay_from) : 0;
+        if (!openEventSinks(capture.header().device)) {
+            closeEventSinks();
+            return false;
+        }
+        exttsSources.clear();
+        exttsSources.emplace_back(new ExttsSource);
+        ExttsSource &src = *exttsSources.back();
+        src.device = capture.header().device;
+        src.registerMetrics();
+
+        install_handler(SIGINT, handle_interrupt);
+        fprintf(eventStatus(), "Replaying %" PRIu64 " of %" PRIu64 " events from %s%s\n",
+                capture.size() - first, capture.size(), replay_file,
+                capture.indexed() ? "" : " (no index)");
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int64_t base = first < capture.size() ? capture.record(first).sec * 1000000000LL +
+                                                    capture.record(first).nsec
+                                              : 0;
+        bool ok = true;
+        for (uint64_t i = first; i < capture.size() && ok && !interrupted; i++) {
+            const ExttsRecord &rec = capture.record(i);
+            struct ptp_extts_event event = {};
+            event.index = rec.channel;
+            event.t.sec = rec.sec;
+            event.t.nsec = rec.nsec;
+
+            if (replay_speed > 0) {
+                int64_t offset = rec.sec * 1000000000LL + rec.nsec - base;
+                struct timespec due = start;
+                addNs(&due, (int64_t)(offset / replay_speed));
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr) == EINTR &&
+                       !interrupted) {
+                }
+            }
+            ok = processEvent(src, event, rec.host_ns);
+            if (replay_speed > 0 && eventTextOutput()) {
+                records.flush();
+            }
+        }
+        if (eventTextOutput()) {
+            records.flush();
+        }
+
+        printEventStats();
+        return closeEventSinks() && ok;
+    }
+
+    bool decodeExternalTimestamps() {
+        ExttsReader reader;
+        int err = reader.open(decode_file);
+        if (err) {
+            fprintf(stderr, "Error opening %s: %s\n", decode_file,
+                    err == -EPROTO ? "not an event record file" : strerror(-err));
+            return false;
+        }
+
+        ExttsRecord rec;
+        uint64_t n = 0;
+        while ((err = reader.next(&rec)) > 0) {
+            if (records.structured()) {
+                writeEventRecord(reader.header().device, rec.channel, rec.sec, rec.nsec);
+                n++;
+                continue;
+            }
+            printf("Event index %u at %" PRId64 ".%09u host %" PRId64 ".%09" PRId64 "\n",
+                   rec.channel, rec.sec, rec.nsec, rec.host_ns / 1000000000,
+                   rec.host_ns % 1000000000);
+            n++;
+        }
+        if (!reportError(err, decode_file)) {
             return false;
         }
+        fprintf(stderr, "%" PRIu64 " events from /dev/ptp%d\n", n, reader.header().device);
+        return true;
+    }
+
+    bool listPins() {
+        struct ptp_clock_caps caps;
+        struct ptp_pin_desc desc;
+        int n_pins = 0;
         
-        memset(&timeout, 0, sizeof(timeout));
-        timeout.it_interval.tv_sec = periodic;
-        timeout.it_value.tv_sec = periodic;
-        if (timer_settime(timerid, 0, &timeout, NULL)) {
-            perror("timer_settime");
+        if (!reportError(phc.getCaps(&caps), "PTP_CLOCK_GETCAPS")) {
             return false;
+        } else {
+            n_pins = caps.n_pins;
+        }
+        
+        for (int i = 0; i < n_pins; i++) {
+            memset(&desc, 0, sizeof(desc));
+            desc.index = i;
+            if (!reportError(phc.getPin(&desc), "PTP_PIN_GETFUNC")) {
+                break;
+            }
+            if (records.structured()) {
+                records.begin("pin");
+                records.field("device", device);
+                records.field("name", desc.name);
+                records.field("index", desc.index);
+                records.field("func", desc.func);
+                records.field("chan", desc.chan);
+                records.end();
+            } else {
+                printf("Name %s index %u func %u chan %u\n", desc.name, desc.index,
+                       desc.func, desc.chan);
+            }
+        }
+        return true;
+    }
+
+    bool setupOneshotTimer() {
+        return runTimer(oneshot, 1);
+    }
+
+    bool setupPeriodicTimer() {
+        return runTimer(periodic, timer_count);
+    }
+
+    static void addNs(struct timespec *ts, int64_t ns) {
+        int64_t total = ts->tv_nsec + ns % 1000000000LL;
+        ts->tv_sec += ns / 1000000000LL + total / 1000000000LL;
+        ts->tv_nsec = total % 1000000000LL;
+        if (ts->tv_nsec < 0) {
+            ts->tv_nsec += 1000000000LL;
+            ts->tv_sec--;
+        }
+    }
+
+    static int64_t tsns(const struct timespec *ts) {
+        return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+    }
+
+    // Arms the timer for a PHC expiry. When the kernel cannot create a
+    // timerfd on the PHC itself, the expiry is translated to CLOCK_REALTIME
+    // with a fresh PHC/system offset sample.
+    bool armTimer(int tfd, bool phc_timer, const struct timespec &expiry) {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value = expiry;
+        if (!phc_timer) {
+            PhcOffsetSample sample;
+            if (!reportError(phc.sampleOffset(5, &sample), "PTP_SYS_OFFSET")) {
+                return false;
+            }
+            addNs(&its.it_value, sample.sys_ns - sample.phc_ns);
         }
-        while (1) {
-            pause();
+        if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL)) {
+            perror("timerfd_settime");
+            return false;
         }
-        timer_delete(timerid);
         return true;
     }
 
+    // Fires 'count' expiries (0 = until interrupted) 'interval' seconds apart
+    // on the PHC timescale and records how late each wakeup observed the PHC
+    // relative to the programmed expiry.
+    bool runTimer(double interval, long count) {
+        int64_t period_ns = (int64_t)(interval * 1e9);
+        if (period_ns <= 0) {
+            fprintf(stderr, "Error: timer interval must be positive\n");
+            return false;
+        }
+
+        EventLoop loop;
+        if (!loop.valid()) {
+            perror("epoll_create1");
+            return false;
+        }
+
+        LatencyHistogram lateness;
+        uint64_t missed = 0;
+        MetricHistogram *latenessMetric = MetricsRegistry::instance().histogram(
+            "shiwaptp_timer_lateness_seconds", "Timer wakeup lateness against the PHC");
+        MetricCounter *missedMetric = MetricsRegistry::instance().counter(
+            "shiwaptp_timer_missed_total", "Timer expiries skipped because they had passed");
+        struct timespec expiry;
+        bool ok = true;
+        bool phc_timer = true;
+        int tfd = -1;
+        auto expired = [&](uint64_t) {
+            struct timespec now;
+            if (!reportError(phc.getTime(&now), "clock_gettime")) {
+                ok = false;
+                loop.stop();
+                return;
+            }
+            int64_t late = tsns(&now) - tsns(&expiry);
+            lateness.record(late);
+            latenessMetric->observe(late);
+            if (period_ns >= 1000000000LL || count == 1) {
+                printf("Timer expired at %ld.%09ld, late %" PRId64 " ns\n",
+                       now.tv_sec, now.tv_nsec, late);
+            }
+            if (count && (long)lateness.count() >= count) {
+                loop.stop();
+                return;
+            }
+
+            // Skip expiries that already passed instead of bursting.
+            addNs(&expiry, period_ns);
+            while (tsns(&expiry) <= tsns(&now)) {
+                addNs(&expiry, period_ns);
+                missed++;
+                missedMetric->inc();
+            }
+            if (!armTimer(tfd, phc_timer, expiry)) {
+                ok = false;
+                loop.stop();
+            }
+        };
+        tfd = loop.addTimer(phc.clockId(), expired);
+        if (tfd < 0) {
+            phc_timer = false;
+            tfd = loop.addTimer(CLOCK_REALTIME, expired);
+        }
+        if (!reportError(tfd, "timerfd_create") ||
+            !reportError(loop.addSignals({SIGINT, SIGTERM}, [&loop](int) { loop.stop(); }),
+                         "signalfd")) {
+            return false;
+        }
+
+        printf("Timer on %s, period %.9f s\n",
+               phc_timer ? "PHC timerfd" : "CLOCK_REALTIME timerfd mapped to PHC",
+               period_ns * 1e-9);
+
+        ok = reportError(phc.getTime(&expiry), "clock_gettime");
+        addNs(&expiry, period_ns);
+        ok = ok && armTimer(tfd, phc_timer, expiry);
+        if (ok) {
+            ok = reportError(loop.run(), "epoll_wait");
+        }
+
+        printf("Wakeups %" PRIu64 ", missed %" PRIu64 "\n"
+               "Lateness p50 %" PRId64 " ns, p99 %" PRId64 " ns, max %" PRId64
+               " ns, min %" PRId64 " ns\n",
+               lateness.count(), missed, lateness.percentile(50),
+               lateness.percentile(99), lateness.max(), lateness.min());
+        return ok;
+    }
+
+    // Lead time between programming an output and its first edge, so the
+    // start time is still in the future when the driver gets it.
+    static const int64_t PEROUT_LEAD_NS = 200000000;
+
     bool setupPeriodicOutput() {
-        struct ptp_perout_request perout_request;
+        struct ptp_perout_request req = {};
+        req.index = index;
+        if (perout == 0) {
+            if (!reportError(phc.setPerout(&req), "PTP_PEROUT_REQUEST")) {
+                return false;
+            }
+            puts("Periodic output disabled");
+            return true;
+        }
+        if (perout_phase < 0 || perout_phase >= perout) {
+            fprintf(stderr, "Error: the phase must be within the period\n");
+            return false;
+        }
+        if (perout_duty < 0 || perout_duty >= perout) {
+            fprintf(stderr, "Error: the on time must be shorter than the period\n");
+            return false;
+        }
+
         struct timespec ts;
-        
-        if (clock_gettime(clkid, &ts)) {
-            perror("clock_gettime");
+        if (!reportError(phc.getTime(&ts), "clock_gettime")) {
             return false;
         }
-        
-        memset(&perout_request, 0, sizeof(perout_request));
-        perout_request.index = index;
-        perout_request.start.sec = ts.tv_sec + 2;
-        perout_request.start.nsec = 0;
-        perout_request.period.sec = 0;
-        perout_request.period.nsec = perout;
-        if (ioctl(fd, PTP_PEROUT_REQUEST, &perout_request)) {
-            perror("PTP_PEROUT_REQUEST");
+        req.period = PhcDevice::fromNs(perout);
+        if (perout_duty) {
+            req.flags |= PTP_PEROUT_DUTY_CYCLE;
+            req.on = PhcDevice::fromNs(perout_duty);
+        }
+        if (perout_one_shot) {
+            req.flags |= PTP_PEROUT_ONE_SHOT;
+        }
+        // With the kernel phase the driver picks an edge of the grid, at
+        // the earliest the next one.
+        int64_t first;
+        if (perout_kernel_phase) {
+            req.flags |= PTP_PEROUT_PHASE;
+            req.phase = PhcDevice::fromNs(perout_phase);
+            first = PhcDevice::nextEdge(PhcDevice::toNs(&ts), perout, perout_phase);
+        } else {
+            first = PhcDevice::nextEdge(PhcDevice::toNs(&ts) + PEROUT_LEAD_NS, perout,
+                                        perout_phase);
+            req.start = PhcDevice::fromNs(first);
+        }
+
+        if (!reportError(phc.setPerout(&req), req.flags ? "PTP_PEROUT_REQUEST2"
+                                                        : "PTP_PEROUT_REQUEST")) {
             return false;
+        }
+        if (perout_kernel_phase) {
+            printf("Periodic output request okay, phase %lld ns\n", perout_phase);
         } else {
-            puts("Periodic output request okay");
+            printf("Periodic output request okay, first edge at %" PRId64 ".%09" PRId64 "\n",
+                   first / 1000000000, first % 1000000000);
         }
-        return true;
+        return perout_verify < 0 || verifyPeriodicOutput(first);
+    }
+
+    // Reacts to each edge on EXTTS channel '-i' by starting the output at
+    // the edge time plus the delay. The request is prepared once; the
+    // reaction path is a blocking read, the start time arithmetic and one
+    // ioctl. Its latency is measured from the return of the read to the
+    // completion of the ioctl, and the remaining margin to the programmed
+    // start is checked afterwards, off that path.
+    bool runTrigger() {
+        if (perout > 0 && perout_duty >= perout) {
+            fprintf(stderr, "Error: the on time must be shorter than the period\n");
+            return false;
+        }
+        if (trigger_delay <= 0) {
+            fprintf(stderr, "Error: the trigger delay must be positive\n");
+            return false;
+        }
+        struct ptp_perout_request req = {};
+        req.index = trigger_out;
+        // One-shot outputs still need a period; drivers ignore it
+        req.period = PhcDevice::fromNs(perout > 0 ? perout : 1000000000LL);
+        if (perout <= 0) {
+            req.flags |= PTP_PEROUT_ONE_SHOT;
+        }
+        if (perout_duty > 0) {
+            req.flags |= PTP_PEROUT_DUTY_CYCLE;
+            req.on = PhcDevice::fromNs(perout_duty);
+        }
+
+        install_handler(SIGINT, handle_interrupt);
+        install_handler(SIGTERM, handle_interrupt);
+        if (!reportError(phc.enableExtts(index, PTP_RISING_EDGE), "PTP_EXTTS_REQUEST")) {
+            return false;
+        }
+        MetricHistogram *reactionMetric = MetricsRegistry::instance().histogram(
+            "shiwaptp_trigger_reaction_seconds", "EXTTS read to PEROUT request completion");
+        MetricCounter *lateMetric = MetricsRegistry::instance().counter(
+            "shiwaptp_trigger_late_total", "Triggered outputs programmed after their start");
+        if (!records.structured()) {
+            printf("Triggering %s output %d at +%lld ns from edges on channel %d\n",
+                   perout > 0 ? "periodic" : "one-shot", trigger_out, trigger_delay, index);
+        }
+
+        LatencyHistogram reaction;
+        long triggers = 0, late = 0;
+        bool ok = true;
+        while (ok && triggers < trigger_count && !interrupted) {
+            struct ptp_extts_event events[EXTTS_BATCH];
+            int cnt = phc.readExtts(events, EXTTS_BATCH);
+            struct timespec t1;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (cnt == -EINTR || cnt == -EAGAIN) {
+                continue;
+            }
+            if (!reportError(cnt, "read")) {
+                ok = false;
+                break;
+            }
+            for (int i = 0; i < cnt && triggers < trigger_count; i++) {
+                if ((int)events[i].index != index) {
+                    continue;
+                }
+                int64_t edge = PhcDevice::toNs(&events[i].t);
+                int64_t start = edge + trigger_delay;
+                req.start = PhcDevice::fromNs(start);
+                int err = phc.setPerout(&req);
+                struct timespec t2;
+                clock_gettime(CLOCK_MONOTONIC, &t2);
+                if (!reportError(err, "PTP_PEROUT_REQUEST2")) {
+                    ok = false;
+                    break;
+                }
+
+                int64_t ns = tsns(&t2) - tsns(&t1);
+                reaction.record(ns);
+                reactionMetric->observe(ns);
+                triggers++;
+                struct timespec now;
+                int64_t margin = 0;
+                if (reportError(phc.getTime(&now), "clock_gettime")) {
+                    margin = start - PhcDevice::toNs(&now);
+                }
+                if (margin < 0) {
+                    late++;
+                    lateMetric->inc();
+                }
+
+                if (records.structured()) {
+                    records.begin("trigger");
+                    records.field("device", device);
+                    records.field("channel", index);
+                    records.field("output", trigger_out);
+                    records.field("edge_sec", edge / 1000000000);
+                    records.field("edge_nsec", edge % 1000000000);
+                    records.field("start_sec", start / 1000000000);
+                    records.field("start_nsec", start % 1000000000);
+                    records.field("reaction_ns", ns);
+                    records.field("margin_ns", margin);
+                    records.end();
+                } else {
+                    printf("Edge at %" PRId64 ".%09" PRId64 " -> output at %" PRId64
+                           ".%09" PRId64 ", reaction %" PRId64 " ns, margin %" PRId64 " ns%s\n",
+                           edge / 1000000000, edge % 1000000000, start / 1000000000,
+                           start % 1000000000, ns, margin, margin < 0 ? " (LATE)" : "");
+                }
+            }
+            records.flush();
+        }
+        phc.disableExtts(index);
+
+        FILE *status = eventStatus();
+        fprintf(status, "Triggers %ld, late %ld%s\n", triggers, late,
+                interrupted ? " (interrupted)" : "");
+        fprintf(status,
+                "Reaction p50 %" PRId64 " ns, p99 %" PRId64 " ns, max %" PRId64 " ns, min %" PRId64
+                " ns\n",
+                reaction.percentile(50), reaction.percentile(99), reaction.max(), reaction.min());
+        return ok;
+    }
+
+    // Timestamps the first edge of the output on an EXTTS channel wired
+    // back to it. A skipped check (no such channel) is not a failure.
+    bool verifyPeriodicOutput(int64_t first) {
+        struct ptp_clock_caps caps;
+        if (!reportError(phc.getCaps(&caps), "PTP_CLOCK_GETCAPS")) {
+            return false;
+        }
+        if (perout_verify >= caps.n_ext_ts) {
+            printf("Edge check skipped: no EXTTS channel %d\n", perout_verify);
+            return true;
+        }
+        if (!reportError(phc.enableExtts(perout_verify, PTP_RISING_EDGE), "PTP_EXTTS_REQUEST")) {
+            return false;
+        }
+
+        // Wait for the first edge plus one period and a second of margin
+        struct timespec ts, deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        if (!reportError(phc.getTime(&ts), "clock_gettime")) {
+            phc.disableExtts(perout_verify);
+            return false;
+        }
+        addNs(&deadline, std::max<int64_t>(first - PhcDevice::toNs(&ts), 0) + perout +
+                             1000000000LL);
+
+        int64_t edge = -1;
+        bool ok = true;
+        while (edge < 0 && ok) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t left = tsns(&deadline) - tsns(&now);
+            if (left <= 0) {
+                break;
+            }
+            struct pollfd pfd = {phc.fd(), POLLIN, 0};
+            int rc = poll(&pfd, 1, (int)(left / 1000000) + 1);
+            if (rc < 0 && errno != EINTR) {
+                ok = reportError(-errno, "poll");
+            }
+            if (rc <= 0) {
+                continue;
+            }
+            struct ptp_extts_event events[EXTTS_BATCH];
+            int cnt = phc.readExtts(events, EXTTS_BATCH);
+            if (cnt < 0 && cnt != -EAGAIN && cnt != -EINTR) {
+                ok = reportError(cnt, "read");
+            }
+            for (int i = 0; i < cnt && edge < 0; i++) {
+                int64_t t = PhcDevice::toNs(&events[i].t);
+                // Earlier events were queued before the output started
+                if ((int)events[i].index == perout_verify && t >= first - perout_tolerance) {
+                    edge = t;
+                }
+            }
+        }
+        phc.disableExtts(perout_verify);
+        if (!ok) {
+            return false;
+        }
+        if (edge < 0) {
+            fprintf(stderr, "Edge check failed: no edge on EXTTS channel %d\n", perout_verify);
+            return false;
+        }
+
+        // Against the nearest grid point when the driver chose the edge
+        int64_t error = edge - first;
+        if (perout_kernel_phase) {
+            error = ((edge - perout_phase) % perout + perout) % perout;
+            if (error > perout / 2) {
+                error -= perout;
+            }
+        }
+        bool inTolerance = llabs(error) <= perout_tolerance;
+        printf("First edge at %" PRId64 ".%09" PRId64 ", %+" PRId64 " ns from the target: %s\n",
+               edge / 1000000000, edge % 1000000000, error,
+               inTolerance ? "okay" : "OUT OF TOLERANCE");
+        return inTolerance;
     }
 
     bool configurePin() {
-        struct ptp_pin_desc desc;
-        
-        memset(&desc, 0, sizeof(desc));
-        desc.index = pin_index;
-        desc.func = pin_func;
-        desc.chan = index;
-        if (ioctl(fd, PTP_PIN_SETFUNC, &desc)) {
-            perror("PTP_PIN_SETFUNC");
+        if (!reportError(phc.setPin(pin_index, pin_func, index), "PTP_PIN_SETFUNC")) {
             return false;
         } else {
             puts("Set pin function okay");
@@ -767,9 +2430,7 @@ private:
     }
 
     bool configurePPS() {
-        int enable = pps ? 1 : 0;
-        if (ioctl(fd, PTP_ENABLE_PPS, enable)) {
-            perror("PTP_ENABLE_PPS");
+        if (!reportError(phc.enablePps(pps != 0), "PTP_ENABLE_PPS")) {
             return false;
         } else {
             puts("PPS for system time request okay");
@@ -777,6 +2438,201 @@ private:
         return true;
     }
 
+    // Rejects items the device cannot have before anything is changed.
+    bool checkConfig(const DeviceConfig &want, const struct ptp_clock_caps &caps) {
+        bool ok = true;
+        for (unsigned int i = 0; i < DeviceConfig::MAX_PINS; i++) {
+            const DeviceConfig::Pin &pin = want.pins[i];
+            if (!pin.set) {
+                continue;
+            }
+            int channels = pin.func == PTP_PF_EXTTS    ? caps.n_ext_ts
+                           : pin.func == PTP_PF_PEROUT ? caps.n_per_out
+                                                       : 1;
+            if ((int)i >= caps.n_pins) {
+                fprintf(stderr, "Error: pin %u: the device has %d pins\n", i, caps.n_pins);
+                ok = false;
+            } else if ((int)pin.chan >= channels) {
+                fprintf(stderr, "Error: pin %u: no %s channel %u\n", i,
+                        DeviceConfig::pinFunctionName(pin.func), pin.chan);
+                ok = false;
+            }
+        }
+        for (unsigned int i = 0; i < DeviceConfig::MAX_CHANNELS; i++) {
+            if (want.perout[i].set && (int)i >= caps.n_per_out) {
+                fprintf(stderr, "Error: perout %u: the device has %d periodic outputs\n", i,
+                        caps.n_per_out);
+                ok = false;
+            }
+        }
+        if (want.pps == 1 && !caps.pps) {
+            fprintf(stderr, "Error: the device has no PPS output\n");
+            ok = false;
+        }
+        if (want.hasFreq && fabs(want.freq) > caps.max_adj) {
+            fprintf(stderr, "Error: freq %.3f ppb exceeds the maximum of %d ppb\n", want.freq,
+                    caps.max_adj);
+            ok = false;
+        }
+        return ok;
+    }
+
+    static void describePin(unsigned int func, unsigned int chan, char *buf, size_t len) {
+        if (func == PTP_PF_NONE) {
+            snprintf(buf, len, "none");
+        } else {
+            snprintf(buf, len, "%s %u", DeviceConfig::pinFunctionName(func), chan);
+        }
+    }
+
+    static void describePerout(const DeviceConfig::Perout &p, char *buf, size_t len) {
+        if (!p.set) {
+            snprintf(buf, len, "unknown");
+        } else if (!p.period) {
+            snprintf(buf, len, "off");
+        } else {
+            snprintf(buf, len, "%" PRId64 " ns phase %" PRId64, p.period, p.phase);
+        }
+    }
+
+    // Converges the device on the --apply file. Pins and the frequency are
+    // read back from the device and outputs and PPS from the state file, and
+    // only the items that differ are programmed: reprogramming a running
+    // periodic output restarts it and glitches the signal.
+    bool applyConfig() {
+        DeviceConfig want;
+        if (!want.load(apply_file)) {
+            return false;
+        }
+        struct ptp_clock_caps caps;
+        if (!reportError(phc.getCaps(&caps), "PTP_CLOCK_GETCAPS") || !checkConfig(want, caps)) {
+            return false;
+        }
+
+        char defaultState[64];
+        const char *statePath = state_file;
+        if (!statePath) {
+            snprintf(defaultState, sizeof(defaultState), "/run/shiwaptptool-%s%d.state",
+                     simulate ? "sim" : "ptp", device);
+            statePath = defaultState;
+        }
+        DeviceConfig have;
+        if (access(statePath, F_OK) == 0 && !have.load(statePath)) {
+            fprintf(stderr, "Warning: ignoring the state file, outputs and PPS are reapplied\n");
+            have = DeviceConfig();
+        }
+
+        struct timespec t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        int changes = 0;
+        bool ok = true, stateChanged = false;
+
+        // Pins released first, so no assignment below steals a function
+        // that is still being moved.
+        for (int pass = 0; pass < 2 && ok; pass++) {
+            for (unsigned int i = 0; i < DeviceConfig::MAX_PINS && ok; i++) {
+                const DeviceConfig::Pin &pin = want.pins[i];
+                if (!pin.set || (pin.func == PTP_PF_NONE) != (pass == 0)) {
+                    continue;
+                }
+                struct ptp_pin_desc desc = {};
+                desc.index = i;
+                if (!reportError(phc.getPin(&desc), "PTP_PIN_GETFUNC")) {
+                    ok = false;
+                    break;
+                }
+                if (desc.func == pin.func && (pin.func == PTP_PF_NONE || desc.chan == pin.chan)) {
+                    continue;
+                }
+                char from[32], to[32];
+                describePin(desc.func, desc.chan, from, sizeof(from));
+                describePin(pin.func, pin.chan, to, sizeof(to));
+                printf("pin %u: %s -> %s\n", i, from, to);
+                changes++;
+                if (!dry_run) {
+                    ok = reportError(phc.setPin(i, pin.func, pin.chan), "PTP_PIN_SETFUNC");
+                }
+            }
+        }
+
+        struct timespec now = {};
+        for (unsigned int i = 0; i < DeviceConfig::MAX_CHANNELS && ok; i++) {
+            const DeviceConfig::Perout &p = want.perout[i];
+            if (!p.set || p == have.perout[i]) {
+                continue;
+            }
+            char from[64], to[64];
+            describePerout(have.perout[i], from, sizeof(from));
+            describePerout(p, to, sizeof(to));
+            printf("perout %u: %s -> %s\n", i, from, to);
+            changes++;
+            if (dry_run) {
+                continue;
+            }
+            // Each output starts on its next edge of the PTP epoch grid
+            if (!now.tv_sec && !reportError(phc.getTime(&now), "clock_gettime")) {
+                ok = false;
+                break;
+            }
+            struct ptp_perout_request req = {};
+            req.index = i;
+            if (p.period) {
+                req.start = PhcDevice::fromNs(PhcDevice::nextEdge(
+                    PhcDevice::toNs(&now) + PEROUT_LEAD_NS, p.period, p.phase));
+                req.period = PhcDevice::fromNs(p.period);
+            }
+            ok = reportError(phc.setPerout(&req), "PTP_PEROUT_REQUEST");
+            if (ok) {
+                have.perout[i] = p;
+                stateChanged = true;
+            }
+        }
+
+        if (ok && want.pps >= 0 && want.pps != have.pps) {
+            printf("pps: %s -> %s\n", have.pps < 0 ? "unknown" : have.pps ? "on" : "off",
+                   want.pps ? "on" : "off");
+            changes++;
+            if (!dry_run) {
+                ok = reportError(phc.enablePps(want.pps != 0), "PTP_ENABLE_PPS");
+                if (ok) {
+                    have.pps = want.pps;
+                    stateChanged = true;
+                }
+            }
+        }
+
+        if (ok && want.hasFreq) {
+            double current;
+            ok = reportError(phc.readFrequency(&current), "clock_adjtime");
+            // The kernel keeps the frequency in units of 1/65.536 ppb
+            if (ok && fabs(current - want.freq) >= 1 / 65.536) {
+                printf("freq: %.3f -> %.3f ppb\n", current, want.freq);
+                changes++;
+                if (!dry_run) {
+                    ok = reportError(phc.adjustFrequency(want.freq), "clock_adjtime");
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        if (dry_run) {
+            printf("%d changes (dry run, nothing applied)\n", changes);
+            return ok;
+        }
+
+        // Outputs and PPS are recorded even after a failure, for the
+        // items that did change.
+        int err = stateChanged ? have.saveState(statePath) : 0;
+        if (err) {
+            fprintf(stderr, "Warning: could not save %s: %s\n", statePath, strerror(-err));
+        }
+        if (ok) {
+            printf(changes ? "%d changes applied in %.1f us\n" : "Already up to date\n", changes,
+                   (tsns(&t2) - tsns(&t1)) / 1000.0);
+        }
+        return ok;
+    }
+
     bool measureOffset() {
         if (n_samples <= 0 || n_samples > 25) {
             puts("n_samples should be between 1 and 25");
@@ -786,19 +2642,30 @@ private:
         ptp_sys_offset sysoff = {};
         sysoff.n_samples = n_samples;
 
-        if (ioctl(fd, PTP_SYS_OFFSET, &sysoff))
-            perror("PTP_SYS_OFFSET");
-        else
+        if (reportError(phc.sysOffset(&sysoff), "PTP_SYS_OFFSET") && !records.structured())
             puts("System and phc clock time offset request okay");
 
         struct ptp_clock_time *pct = &sysoff.ts[0];
         for (unsigned int i = 0; i < sysoff.n_samples; i++) {
-            int64_t t1 = pctns(pct + 2 * i);
-            int64_t tp = pctns(pct + 2 * i + 1);
-            int64_t t2 = pctns(pct + 2 * i + 2);
+            int64_t t1 = PhcDevice::toNs(pct + 2 * i);
+            int64_t tp = PhcDevice::toNs(pct + 2 * i + 1);
+            int64_t t2 = PhcDevice::toNs(pct + 2 * i + 2);
             int64_t interval = t2 - t1;
             int64_t offset = (t2 + t1) / 2 - tp;
 
+            if (records.structured()) {
+                records.begin("offset");
+                records.field("device", device);
+                records.field("sample", i);
+                records.field("sys_sec", (pct + 2 * i)->sec);
+                records.field("sys_nsec", (pct + 2 * i)->nsec);
+                records.field("phc_sec", (pct + 2 * i + 1)->sec);
+                records.field("phc_nsec", (pct + 2 * i + 1)->nsec);
+                records.field("offset_ns", offset);
+                records.field("delay_ns", interval);
+                records.end();
+                continue;
+            }
             printf("System time: %lld.%u\n", (pct + 2 * i)->sec, (pct + 2 * i)->nsec);
             printf("PHC    time: %lld.%u\n", (pct + 2 * i + 1)->sec,
                    (pct + 2 * i + 1)->nsec);
@@ -811,10 +2678,850 @@ private:
         }
         return true;
     }
+
+    struct SweepStep {
+        double drift;      // PHC rate relative to the system clock (ppb)
+        double settle_ms;  // negative when the step never settled
+    };
+
+    // Holds the current frequency for one dwell period while sampling the
+    // PHC/system offset. The drift is fitted over the second half of the
+    // dwell; the settling time is the start of the first sliding window
+    // after which every window slope stays within the tolerance band.
+    bool measureStep(SweepStep *step) {
+        std::vector<double> t, off;
+        int64_t sys0 = 0, phc0 = 0;
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+
+        int count = std::max(4, sweep_dwell * 1000 / sweep_interval);
+        for (int i = 0; i < count && !interrupted; i++) {
+            PhcOffsetSample sample;
+            if (!reportError(phc.sampleOffset(5, &sample), "PTP_SYS_OFFSET")) {
+                return false;
+            }
+            if (t.empty()) {
+                sys0 = sample.sys_ns;
+                phc0 = sample.phc_ns;
+            }
+            t.push_back((sample.sys_ns - sys0) * 1e-9);
+            off.push_back((double)((sample.phc_ns - phc0) - (sample.sys_ns - sys0)));
+
+            next.tv_nsec += sweep_interval * 1000000L;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+        if (interrupted) {
+            return false;
+        }
+
+        size_t n = t.size();
+        PhcLineFit fit;
+        if (!phcFitLine(&t[n / 2], &off[n / 2], n - n / 2, &fit)) {
+            fprintf(stderr, "Error: not enough samples to fit the drift\n");
+            return false;
+        }
+        step->drift = fit.slope;
+
+        size_t window = std::max<size_t>(4, 2000 / sweep_interval);
+        step->settle_ms = -1;
+        if (window >= n) {
+            return true;
+        }
+        for (size_t start = n - window + 1; start-- > 0;) {
+            if (!phcFitLine(&t[start], &off[start], window, &fit) ||
+                fabs(fit.slope - step->drift) > sweep_tolerance) {
+                break;
+            }
+            step->settle_ms = t[start] * 1000.0;
+        }
+        return true;
+    }
+
+    bool frequencySweep() {
+        if (sweep_dwell <= 0 || sweep_interval <= 0) {
+            fprintf(stderr, "Error: dwell and sampling interval must be positive\n");
+            return false;
+        }
+        struct ptp_clock_caps caps;
+        if (!reportError(phc.getCaps(&caps), "PTP_CLOCK_GETCAPS")) {
+            return false;
+        }
+        if (std::max(abs(sweep_min), abs(sweep_max)) > caps.max_adj) {
+            fprintf(stderr, "Error: sweep range %d..%d ppb exceeds the maximum of %d ppb\n",
+                    sweep_min, sweep_max, caps.max_adj);
+            return false;
+        }
+
+        double original;
+        if (!reportError(phc.readFrequency(&original), "clock_adjtime")) {
+            return false;
+        }
+
+        install_handler(SIGINT, handle_interrupt);
+        install_handler(SIGTERM, handle_interrupt);
+
+        printf("Frequency response of %s: %d..%d ppb step %d, "
+               "dwell %d s, interval %d ms\n",
+               deviceName().c_str(), sweep_min, sweep_max, sweep_step, sweep_dwell,
+               sweep_interval);
+
+        // The drift measured against the system clock includes the system
+        // clock's own error, so every step is referenced to a baseline taken
+        // at the frequency that was active before the sweep.
+        SweepStep baseline;
+        if (!measureStep(&baseline)) {
+            phc.adjustFrequency(original);
+            return false;
+        }
+        printf("Baseline drift %+.1f ppb at %+.1f ppb\n\n", baseline.drift, original);
+        printf("%10s %10s %10s %10s\n", "requested", "actual", "error", "settling");
+        printf("%10s %10s %10s %10s\n", "(ppb)", "(ppb)", "(ppb)", "(ms)");
+
+        std::vector<double> requested, actual;
+        bool ok = true;
+        for (long ppb = sweep_min; ppb <= sweep_max; ppb += sweep_step) {
+            SweepStep step;
+            if (!reportError(phc.adjustFrequency(ppb), "clock_adjtime") ||
+                !measureStep(&step)) {
+                ok = false;
+                break;
+            }
+            double real = original + (step.drift - baseline.drift);
+            requested.push_back(ppb);
+            actual.push_back(real);
+            if (step.settle_ms < 0) {
+                printf("%10ld %10.1f %+10.1f %10s\n", ppb, real, real - ppb, "n/a");
+            } else {
+                printf("%10ld %10.1f %+10.1f %10.0f\n", ppb, real, real - ppb,
+                       step.settle_ms);
+            }
+        }
+
+        if (phc.adjustFrequency(original)) {
+            fprintf(stderr, "Warning: failed to restore frequency %+.1f ppb\n", original);
+        }
+        if (interrupted) {
+            puts("Sweep interrupted, frequency restored");
+        }
+
+        PhcLineFit line;
+        if (phcFitLine(requested.data(), actual.data(), requested.size(), &line)) {
+            double gain = line.slope, offset = line.intercept;
+            double worst = 0;
+            for (size_t i = 0; i < requested.size(); i++) {
+                worst = std::max(worst, fabs(actual[i] - (gain * requested[i] + offset)));
+            }
+            double span = requested.back() - requested.front();
+            printf("\nLinearity: gain %.5f, offset %+.1f ppb, max deviation %.1f ppb"
+                   " (%.3f%% of span)\n",
+                   gain, offset, worst, 100.0 * worst / span);
+        }
+        return ok;
+    }
+
+    // Samples the offset at a fixed rate and reports the regression of the
+    // last window, so the estimate follows frequency changes with a delay
+    // of half a window.
+    bool estimateDrift() {
+        if (drift_window < 3 || drift_interval <= 0) {
+            fprintf(stderr, "Error: the window needs 3 samples and the interval must be "
+                            "positive\n");
+            return false;
+        }
+        install_handler(SIGINT, handle_interrupt);
+        install_handler(SIGTERM, handle_interrupt);
+
+        MetricGauge *ppbGauge = MetricsRegistry::instance().gauge(
+            "shiwaptp_drift_ppb", "PHC frequency error against the system clock");
+        MetricGauge *errorGauge = MetricsRegistry::instance().gauge(
+            "shiwaptp_drift_error_ppb", "3-sigma uncertainty of the PHC frequency error");
+
+        printf("Drift of %s: window %d samples, interval %d us\n\n", deviceName().c_str(),
+               drift_window, drift_interval);
+        printf("%10s %12s %10s %12s %10s\n", "time", "frequency", "3-sigma", "offset",
+               "residual");
+        printf("%10s %12s %10s %12s %10s\n", "(s)", "(ppb)", "(ppb)", "(ns)", "(ns)");
+
+        PhcDriftEstimator estimator(drift_window);
+        struct timespec start, next;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        next = start;
+        for (long i = 0; i < drift_samples && !interrupted; i++) {
+            PhcOffsetSample sample;
+            if (!reportError(phc.sampleOffset(5, &sample), "PTP_SYS_OFFSET")) {
+                return false;
+            }
+            estimator.add(sample);
+
+            PhcDriftEstimator::Estimate e;
+            if ((i + 1) % drift_window == 0 && estimator.estimate(&e)) {
+                ppbGauge->set(e.ppb);
+                errorGauge->set(e.ppbError);
+                printf("%10.3f %+12.3f %10.3f %+12" PRId64 " %10.1f\n",
+                       (next.tv_sec - start.tv_sec) + (next.tv_nsec - start.tv_nsec) * 1e-9,
+                       e.ppb, e.ppbError, e.offset, e.residual);
+            }
+
+            addNs(&next, drift_interval * 1000LL);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+        return true;
+    }
+
+    // Serves every device through the control daemon until SIGINT/SIGTERM.
+    bool runDaemon() {
+        EventLoop loop;
+        if (!loop.valid()) {
+            perror("epoll_create1");
+            return false;
+        }
+        int err = loop.addSignals({SIGINT, SIGTERM}, [&loop](int) { loop.stop(); });
+        if (!reportError(err, "signalfd")) {
+            return false;
+        }
+        PhcDaemon daemon(loop, simConfig);
+        err = daemon.start(socket_path);
+        if (err) {
+            fprintf(stderr, "Error listening on %s: %s\n", socket_path, strerror(-err));
+            return false;
+        }
+        fprintf(stderr, "Serving PHC devices on %s\n", socket_path);
+        err = loop.run();
+        fprintf(stderr, "Daemon stopped with %zu clients connected\n", daemon.clientCount());
+        return reportError(err, "epoll_wait");
+    }
+
+    // Prints offsets sampled by the daemon on its own timer, so the client
+    // only waits on the socket.
+    bool watchOffset() {
+        if (!remote) {
+            fprintf(stderr, "Error: --watch-offset needs a daemon device (-d remote:N)\n");
+            return false;
+        }
+        if (watch_interval <= 0) {
+            fprintf(stderr, "Error: the interval must be positive\n");
+            return false;
+        }
+        install_handler(SIGINT, handle_interrupt);
+        install_handler(SIGTERM, handle_interrupt);
+        if (!reportError(phc.subscribeOffset(watch_interval, 5), "subscribe")) {
+            return false;
+        }
+
+        bool ok = true;
+        for (long i = 0; i < watch_offset && !interrupted; i++) {
+            PhcOffsetSample sample;
+            int err = phc.readOffset(&sample);
+            if (err == -EINTR) {
+                continue;
+            }
+            if (!reportError(err, "offset")) {
+                ok = false;
+                break;
+            }
+            int64_t offset = sample.phc_ns - sample.sys_ns;
+            if (records.structured()) {
+                records.begin("offset");
+                records.field("device", device);
+                records.field("sample", i);
+                records.field("sys_sec", sample.sys_ns / 1000000000);
+                records.field("sys_nsec", sample.sys_ns % 1000000000);
+                records.field("phc_sec", sample.phc_ns / 1000000000);
+                records.field("phc_nsec", sample.phc_ns % 1000000000);
+                records.field("offset_ns", offset);
+                records.field("delay_ns", sample.delay_ns);
+                records.end();
+                records.flush();
+            } else {
+                printf("system time: %" PRId64 ".%09" PRId64 " phc offset: %" PRId64
+                       " ns delay: %" PRId64 " ns\n",
+                       sample.sys_ns / 1000000000, sample.sys_ns % 1000000000, offset,
+                       sample.delay_ns);
+            }
+        }
+        phc.subscribeOffset(0, 0);
+        return ok;
+    }
+
+    // Samples the PHC/system offset on a fixed monotonic schedule and feeds
+    // the health checks of PhcWatchdog. Nothing is printed until a check
+    // raises or clears an alert; every alert goes to stdout (or a structured
+    // "alert" record) and, when configured, to syslog and the hook command.
+    bool runWatchdog() {
+        if (watchdog_interval <= 0 || watchdogConfig.stepNs <= 0 ||
+            watchdogConfig.freqPpb <= 0 || watchdogConfig.latencyNs <= 0) {
+            fprintf(stderr, "Error: the watchdog interval and limits must be positive\n");
+            return false;
+        }
+        std::string device_name = deviceName();
+        const char *name = device_name.c_str();
+        install_handler(SIGINT, handle_interrupt);
+        install_handler(SIGTERM, handle_interrupt);
+        if (watchdog_syslog) {
+            openlog("shiwaptptool", LOG_PID, LOG_DAEMON);
+        }
+
+        PhcWatchdog watchdog(watchdogConfig);
+        MetricCounter *alertsMetric[PHC_WD_CHECKS];
+        for (int c = 0; c < PHC_WD_CHECKS; c++) {
+            alertsMetric[c] = MetricsRegistry::instance().counter(
+                "shiwaptp_watchdog_alerts_total", "Watchdog alerts raised",
+                MetricsRegistry::label("check", PhcWatchdog::checkName((PhcWatchdogCheck)c)));
+        }
+        MetricHistogram *readMetric = MetricsRegistry::instance().histogram(
+            "shiwaptp_watchdog_read_seconds", "Watchdog offset sample read time");
+        MetricGauge *freqMetric = MetricsRegistry::instance().gauge(
+            "shiwaptp_watchdog_frequency_ppb", "PHC frequency error against the system clock");
+        if (!records.structured()) {
+            printf("Watching %s every %d ms: step %" PRId64 " ns, frequency %g ppb, latency %" PRId64
+                   " ns\n",
+                   name, watchdog_interval, watchdogConfig.stepNs, watchdogConfig.freqPpb,
+                   watchdogConfig.latencyNs);
+            fflush(stdout);
+        }
+
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        while (!interrupted) {
+            PhcWatchdogAlert alerts[PHC_WD_CHECKS];
+            PhcOffsetSample sample = {};
+            struct timespec t1, t2;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            int err = phc.sampleOffset(5, &sample);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            int n;
+            if (err == -EINTR) {
+                continue;
+            } else if (err) {
+                n = watchdog.readFailed(alerts);
+                if (n) {
+                    fprintf(stderr, "%s: PTP_SYS_OFFSET: %s\n", name, strerror(-err));
+                }
+            } else {
+                int64_t ns = tsns(&t2) - tsns(&t1);
+                n = watchdog.add(sample, ns, alerts);
+                readMetric->observe(ns);
+                freqMetric->set(watchdog.frequency());
+            }
+            for (int i = 0; i < n; i++) {
+                if (alerts[i].raised) {
+                    alertsMetric[alerts[i].check]->inc();
+                }
+                reportAlert(name, alerts[i], err ? tsns(&t2) : sample.sys_ns);
+            }
+            // Hooks run detached; collect the ones that have finished
+            while (waitpid(-1, nullptr, WNOHANG) > 0) {
+            }
+
+            addNs(&next, watchdog_interval * 1000000LL);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        FILE *status = records.structured() ? stderr : stdout;
+        fprintf(status, "%" PRIu64 " samples, frequency %.1f ppb, alerts:", watchdog.samples(),
+                watchdog.frequency());
+        for (int c = 0; c < PHC_WD_CHECKS; c++) {
+            fprintf(status, " %s %" PRIu64, PhcWatchdog::checkName((PhcWatchdogCheck)c),
+                    watchdog.raised((PhcWatchdogCheck)c));
+        }
+        fprintf(status, "\n");
+        if (watchdog_syslog) {
+            closelog();
+        }
+        return true;
+    }
+
+    void reportAlert(const char *name, const PhcWatchdogAlert &alert, int64_t when) {
+        const char *check = PhcWatchdog::checkName(alert.check);
+        const char *state = alert.raised ? "raised" : "cleared";
+        const char *unit = alert.check == PHC_WD_FREQ ? "ppb" : "ns";
+        char message[256];
+        snprintf(message, sizeof(message), "%s: %s %s, %.0f %s (limit %.0f %s)", name, check,
+                 state, alert.value, unit, alert.limit, unit);
+
+        if (records.structured()) {
+            records.begin("alert");
+            records.field("device", device);
+            records.field("sys_sec", when / 1000000000);
+            records.field("sys_nsec", when % 1000000000);
+            records.field("check", check);
+            records.field("state", state);
+            records.field("value", alert.value);
+            records.field("limit", alert.limit);
+            records.end();
+            records.flush();
+        } else {
+            printf("%" PRId64 ".%09" PRId64 " %s\n", when / 1000000000, when % 1000000000,
+                   message);
+            fflush(stdout);
+        }
+        if (watchdog_syslog) {
+            int priority = !alert.raised ? LOG_NOTICE
+                           : alert.check == PHC_WD_STALL || alert.check == PHC_WD_READ ? LOG_ERR
+                                                                                     : LOG_WARNING;
+            syslog(priority, "%s", message);
+        }
+        if (watchdog_hook) {
+            runAlertHook(name, alert, check, state, message);
+        }
+    }
+
+    // Starts the hook without waiting for it, so a slow hook cannot delay
+    // the sampling. Everything is prepared before the fork; the child only
+    // makes system calls. It drops what the sampler inherited from the
+    // real-time profile and the trace dump: the blocked signals, the
+    // SCHED_FIFO policy and the CPU pinning.
+    void runAlertHook(const char *name, const PhcWatchdogAlert &alert, const char *check,
+                      const char *state, const char *message) {
+        char value[64], limit[64];
+        snprintf(value, sizeof(value), "%.0f", alert.value);
+        snprintf(limit, sizeof(limit), "%.0f", alert.limit);
+        std::vector<std::string> vars = {
+            std::string("SHIWA_DEVICE=") + name,  std::string("SHIWA_CHECK=") + check,
+            std::string("SHIWA_STATE=") + state,  std::string("SHIWA_VALUE=") + value,
+            std::string("SHIWA_LIMIT=") + limit,  std::string("SHIWA_MESSAGE=") + message,
+        };
+        std::vector<char *> env;
+        for (char **e = environ; *e; e++) {
+            if (strncmp(*e, "SHIWA_", 6)) {
+                env.push_back(*e);
+            }
+        }
+        for (std::string &v : vars) {
+            env.push_back(&v[0]);
+        }
+        env.push_back(nullptr);
+        const char *argv[] = {"sh", "-c", watchdog_hook, nullptr};
+        sigset_t noSignals;
+        sigemptyset(&noSignals);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            sigprocmask(SIG_SETMASK, &noSignals, nullptr);
+            RealtimeProfile::releaseThread();
+            execve("/bin/sh", (char *const *)argv, env.data());
+            _exit(127);
+        } else if (pid < 0) {
+            perror("fork");
+        }
+    }
+
+    // Overlapping ADEV, MDEV and TDEV of a phase series: the time error of a
+    // capture channel against its ideal pulse grid, or live PHC/system
+    // offsets. Either way the series streams through the analyzer once.
+    bool analyzeStability() {
+        install_handler(SIGINT, handle_interrupt);
+        install_handler(SIGTERM, handle_interrupt);
+
+        std::unique_ptr<StabilityAnalyzer> analyzer;
+        bool ok = stability_file ? captureStability(&analyzer) : liveStability(&analyzer);
+        if (!ok) {
+            return false;
+        }
+        std::vector<StabilityPoint> points = analyzer->finish();
+        if (points.empty()) {
+            fprintf(stderr, "Error: at least 3 samples are needed, got %" PRIu64 "\n",
+                    analyzer->samples());
+            return false;
+        }
+
+        printf("%" PRIu64 " samples%s, %d threads\n\n", analyzer->samples(),
+               interrupted ? " (interrupted)" : "", analyzer->threads());
+        printf("%12s %12s %12s %12s %12s\n", "tau (s)", "terms", "ADEV", "MDEV", "TDEV (ns)");
+        for (const StabilityPoint &p : points) {
+            if (p.mdevTerms) {
+                printf("%12g %12" PRIu64 " %12.4e %12.4e %12.4g\n", p.tau, p.adevTerms, p.adev,
+                       p.mdev, p.tdev * 1e9);
+            } else {
+                printf("%12g %12" PRIu64 " %12.4e %12s %12s\n", p.tau, p.adevTerms, p.adev, "-",
+                       "-");
+            }
+        }
+        return true;
+    }
+
+    // Median of the first intervals of 'channel', rounded to a microsecond.
+    static bool inferPeriod(const ExttsCaptureReader &capture, unsigned int channel,
+                            int64_t *period) {
+        std::vector<int64_t> intervals;
+        int64_t prev = -1;
+        for (uint64_t i = 0; i < capture.size() && intervals.size() < 101; i++) {
+            const ExttsRecord &rec = capture.record(i);
+            if (rec.channel != channel) {
+                continue;
+            }
+            int64_t t = rec.sec * 1000000000LL + rec.nsec;
+            if (prev >= 0) {
+                intervals.push_back(t - prev);
+            }
+            prev = t;
+        }
+        if (intervals.empty()) {
+            return false;
+        }
+        std::nth_element(intervals.begin(), intervals.begin() + intervals.size() / 2,
+                         intervals.end());
+        *period = (intervals[intervals.size() / 2] + 500) / 1000 * 1000;
+        return *period > 0;
+    }
+
+    // Phase of every pulse against the grid started by the first one.
+    // Missing pulses are filled by linear interpolation; events that do not
+    // advance the grid (duplicates, glitches) are skipped.
+    bool captureStability(std::unique_ptr<StabilityAnalyzer> *analyzer) {
+        static const int64_t MAX_GAP = 1000000;
+
+        ExttsCaptureReader capture;
+        int err = capture.open(stability_file);
+        if (err) {
+            fprintf(stderr, "Error opening %s: %s\n", stability_file,
+                    err == -EPROTO ? "not an event capture" : strerror(-err));
+            return false;
+        }
+        int64_t period = stability_period;
+        if (period <= 0 && !inferPeriod(capture, index, &period)) {
+            fprintf(stderr, "Error: no pulse period for channel %d in %s, use --stability-period\n",
+                    index, stability_file);
+            return false;
+        }
+        printf("Stability of channel %d in %s, period %" PRId64 " ns: ", index, stability_file,
+               period);
+        analyzer->reset(new StabilityAnalyzer(period * 1e-9, capture.size()));
+
+        int64_t t0 = 0, last = -1;
+        double lastX = 0;
+        uint64_t missing = 0, skipped = 0;
+        for (uint64_t i = 0; i < capture.size() && !interrupted; i++) {
+            const ExttsRecord &rec = capture.record(i);
+            if (rec.channel != (unsigned int)index) {
+                continue;
+            }
+            int64_t t = rec.sec * 1000000000LL + rec.nsec;
+            if (last < 0) {
+                t0 = t;
+            }
+            int64_t d = t - t0;
+            int64_t n = (d >= 0 ? d + period / 2 : d - period / 2) / period;
+            if (n <= last) {
+                skipped++;
+                continue;
+            }
+            double x = (double)(d - n * period);
+            if (last >= 0 && n - last > 1) {
+                if (n - last - 1 > MAX_GAP) {
+                    printf("\n");
+                    fprintf(stderr, "Error: %" PRId64 " pulses missing before %" PRId64
+                            ".%09u\n", n - last - 1, rec.sec, rec.nsec);
+                    return false;
+                }
+                for (int64_t k = last + 1; k < n; k++) {
+                    (*analyzer)->add(lastX + (x - lastX) * (k - last) / (n - last));
+                }
+                missing += n - last - 1;
+            }
+            (*analyzer)->add(x);
+            last = n;
+            lastX = x;
+        }
+        if (missing || skipped) {
+            printf("%" PRIu64 " missing pulses interpolated, %" PRIu64 " events skipped, ",
+                   missing, skipped);
+        }
+        return true;
+    }
+
+    bool liveStability(std::unique_ptr<StabilityAnalyzer> *analyzer) {
+        if (stability_interval <= 0) {
+            fprintf(stderr, "Error: sampling interval must be positive\n");
+            return false;
+        }
+        printf("Stability of %s against the system clock, interval %d ms: ",
+               deviceName().c_str(), stability_interval);
+        analyzer->reset(new StabilityAnalyzer(stability_interval * 1e-3, stability_samples));
+
+        int64_t sys0 = 0, phc0 = 0;
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        for (long long i = 0; i < stability_samples && !interrupted; i++) {
+            PhcOffsetSample sample;
+            if (!reportError(phc.sampleOffset(5, &sample), "PTP_SYS_OFFSET")) {
+                return false;
+            }
+            if (i == 0) {
+                sys0 = sample.sys_ns;
+                phc0 = sample.phc_ns;
+            }
+            (*analyzer)->add((double)((sample.phc_ns - phc0) - (sample.sys_ns - sys0)));
+
+            addNs(&next, stability_interval * 1000000LL);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+        return true;
+    }
+
+    // Times 'iterations' calls of 'op' with the vDSO monotonic clock and
+    // prints the percentiles. The first failing call marks the method as
+    // unsupported on this device.
+    template <typename Op>
+    bool benchOne(const char *name, Op op, int64_t baseline_p50, int64_t *p50) {
+        LatencyHistogram hist;
+        for (int i = 0; i < bench_iterations && !interrupted; i++) {
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+            int err = op();
+            clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+            if (err) {
+                printf("%-28s not supported (%s)\n", name, strerror(-err));
+                return false;
+            }
+            hist.record(tsns(&t1) - tsns(&t0));
+        }
+        *p50 = hist.percentile(50);
+        printf("%-28s %8" PRId64 " %8" PRId64 " %8" PRId64 " %8" PRId64 " %8" PRId64
+               " %8.1fx\n",
+               name, hist.min(), *p50, hist.percentile(99), hist.percentile(99.9),
+               hist.max(), baseline_p50 > 0 ? (double)*p50 / baseline_p50 : 1.0);
+        return true;
+    }
+
+    bool benchmarkReads() {
+        if (bench_iterations <= 0) {
+            fprintf(stderr, "Error: iteration count must be positive\n");
+            return false;
+        }
+        install_handler(SIGINT, handle_interrupt);
+
+        struct ptp_clock_caps caps;
+        if (!reportError(phc.getCaps(&caps), "PTP_CLOCK_GETCAPS")) {
+            return false;
+        }
+
+        printf("%s: %d iterations per method, times in ns\n", deviceName().c_str(),
+               bench_iterations);
+        printf("%-28s %8s %8s %8s %8s %8s %9s\n", "method", "min", "p50", "p99",
+               "p99.9", "max", "vs vDSO");
+
+        struct timespec ts;
+        int64_t vdso = 0, p50 = 0;
+        benchOne("clock_gettime(REALTIME)",
+                 [&] { return clock_gettime(CLOCK_REALTIME, &ts) ? -errno : 0; }, 0, &vdso);
+        benchOne("clock_gettime(PHC)", [&] { return phc.getTime(&ts); }, vdso, &p50);
+
+        ptp_sys_offset sysoff;
+        sysoff.n_samples = 1;
+        benchOne("PTP_SYS_OFFSET n=1",
+                 [&] { return phc.sysOffset(&sysoff); }, vdso, &p50);
+        sysoff.n_samples = PTP_MAX_SAMPLES;
+        benchOne("PTP_SYS_OFFSET n=25",
+                 [&] { return phc.sysOffset(&sysoff); }, vdso, &p50);
+
+        ptp_sys_offset_extended extended;
+        memset(&extended, 0, sizeof(extended));
+        extended.n_samples = 1;
+        if (benchOne("PTP_SYS_OFFSET_EXTENDED n=1",
+                     [&] { return phc.sysOffsetExtended(&extended); }, vdso,
+                     &p50)) {
+            extended.n_samples = PTP_MAX_SAMPLES;
+            benchOne("PTP_SYS_OFFSET_EXTENDED n=25",
+                     [&] { return phc.sysOffsetExtended(&extended); }, vdso,
+                     &p50);
+        }
+
+        if (caps.cross_timestamping) {
+            ptp_sys_offset_precise precise;
+            memset(&precise, 0, sizeof(precise));
+            benchOne("PTP_SYS_OFFSET_PRECISE",
+                     [&] { return phc.sysOffsetPrecise(&precise); }, vdso,
+                     &p50);
+        } else {
+            printf("%-28s not supported (no cross timestamping)\n",
+                   "PTP_SYS_OFFSET_PRECISE");
+        }
+        return true;
+    }
+
+    // Runs the interpolated clock model against the real PHC: every 10 ms
+    // one direct PHC read is compared with the model evaluated around it,
+    // and 100 model reads are timed.
+    bool checkInterpolation() {
+        PhcClockModel model(phc);
+        if (!model.start(model_interval)) {
+            perror("clock model refresh");
+            return false;
+        }
+        install_handler(SIGINT, handle_interrupt);
+        printf("Clock model on %s from %s, refresh %d ms\n", deviceName().c_str(),
+               model.usesPreciseTimestamps() ? "PTP_SYS_OFFSET_PRECISE"
+                                             : "bracketed PHC reads",
+               model_interval);
+
+        LatencyHistogram cost, error, bound;
+        int violations = 0;
+        for (int i = 0; i < interp_checks && !interrupted; i++) {
+            struct timespec t0, t1, direct;
+            int64_t before, after, err_before, err_after, est = 0, est_err = 0;
+            for (int j = 0; j < 100; j++) {
+                clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+                model.now(&est, &est_err);
+                clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+                cost.record(tsns(&t1) - tsns(&t0));
+            }
+
+            model.now(&before, &err_before);
+            if (!reportError(phc.getTime(&direct), "clock_gettime")) {
+                return false;
+            }
+            model.now(&after, &err_after);
+            int64_t diff = llabs(tsns(&direct) - (before + after) / 2);
+            error.record(diff);
+            bound.record(err_after);
+            if (diff > err_after + (after - before) / 2) {
+                violations++;
+            }
+            usleep(10000);
+        }
+
+        PhcClockModel::Params p;
+        model.snapshot(&p);
+        printf("Model rate %+.3f ppb (+/- %.3f), %" PRIu64 " refreshes\n", p.rate * 1e9,
+               p.rateError * 1e9, p.sequence);
+        printf("Read cost   p50 %" PRId64 " ns, p99 %" PRId64 " ns, max %" PRId64 " ns\n",
+               cost.percentile(50), cost.percentile(99), cost.max());
+        printf("Read error  p50 %" PRId64 " ns, p99 %" PRId64 " ns, max %" PRId64 " ns\n",
+               error.percentile(50), error.percentile(99), error.max());
+        printf("Error bound p50 %" PRId64 " ns, p99 %" PRId64 " ns, %d of %" PRIu64
+               " checks outside the bound\n",
+               bound.percentile(50), bound.percentile(99), violations, error.count());
+        return true;
+    }
+
+    static void writeShmPage(struct phc_shm_page *page, const PhcClockModel::Params &p,
+                             int interval_ms) {
+        uint32_t s = page->seq;
+        __atomic_store_n(&page->seq, s + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        page->mapping.raw_ref = p.rawRef;
+        page->mapping.offset_ns = p.phcRef - p.rawRef;
+        page->mapping.freq_ratio = 1.0 + p.rate;
+        page->mapping.ratio_error = p.rateError;
+        page->mapping.base_error_ns = p.baseError;
+        page->mapping.update_seq = p.sequence;
+        page->mapping.interval_ns = interval_ms * 1000000LL;
+        __atomic_store_n(&page->seq, s + 2, __ATOMIC_RELEASE);
+    }
+
+    // Refreshes the clock model every model_interval ms and mirrors it into
+    // a world-readable /dev/shm page. The page is unlinked on exit; readers
+    // that still have it mapped see it go stale.
+    bool publishSharedMemory() {
+        char path[256];
+        snprintf(path, sizeof(path), "/%s", shm_publish);
+        int shm_fd = shm_open(path, O_CREAT | O_RDWR, 0644);
+        if (shm_fd < 0) {
+            perror("shm_open");
+            return false;
+        }
+        fchmod(shm_fd, 0644);
+        if (ftruncate(shm_fd, sizeof(struct phc_shm_page))) {
+            perror("ftruncate");
+            close(shm_fd);
+            return false;
+        }
+        void *addr = mmap(NULL, sizeof(struct phc_shm_page), PROT_READ | PROT_WRITE,
+                          MAP_SHARED, shm_fd, 0);
+        close(shm_fd);
+        if (addr == MAP_FAILED) {
+            perror("mmap");
+            return false;
+        }
+
+        struct phc_shm_page *page = (struct phc_shm_page *)addr;
+        memset(page, 0, sizeof(*page));
+        page->version = PHC_SHM_VERSION;
+        page->device = device;
+        __atomic_store_n(&page->magic, PHC_SHM_MAGIC, __ATOMIC_RELEASE);
+
+        install_handler(SIGINT, handle_interrupt);
+        install_handler(SIGTERM, handle_interrupt);
+        printf("Publishing %s clock model to /dev/shm%s every %d ms\n", deviceName().c_str(),
+               path, model_interval);
+
+        PhcClockModel model(phc);
+        MetricsRegistry &m = MetricsRegistry::instance();
+        MetricGauge *rateMetric =
+            m.gauge("shiwaptp_model_rate_ppb", "Clock model PHC rate against MONOTONIC_RAW");
+        MetricGauge *rateErrorMetric =
+            m.gauge("shiwaptp_model_rate_error_ppb", "Clock model 3-sigma rate uncertainty");
+        MetricGauge *baseErrorMetric =
+            m.gauge("shiwaptp_model_base_error_ns", "Clock model error bound at the reference");
+        MetricCounter *updatesMetric =
+            m.counter("shiwaptp_model_updates_total", "Clock model refreshes published");
+        MetricHistogram *refreshMetric =
+            m.histogram("shiwaptp_model_refresh_seconds", "Duration of clock model refreshes");
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        bool ok = true;
+        while (!interrupted) {
+            PhcClockModel::Params p;
+            struct timespec t1, t2;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (!model.refresh()) {
+                perror("clock model refresh");
+                ok = false;
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            refreshMetric->observe(tsns(&t2) - tsns(&t1));
+            model.snapshot(&p);
+            writeShmPage(page, p, model_interval);
+            rateMetric->set(p.rate * 1e9);
+            rateErrorMetric->set(p.rateError * 1e9);
+            baseErrorMetric->set((double)p.baseError);
+            updatesMetric->inc();
+
+            addNs(&next, model_interval * 1000000LL);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        shm_unlink(path);
+        munmap(addr, sizeof(struct phc_shm_page));
+        puts("Publisher stopped");
+        return ok;
+    }
+
+    bool readSharedMemory() {
+        const struct phc_shm_page *page = nullptr;
+        int err = phc_shm_open(shm_read, &page);
+        if (err) {
+            fprintf(stderr, "Error opening /dev/shm/%s: %s\n", shm_read, strerror(-err));
+            return false;
+        }
+        int64_t phc_ns = 0, error_ns = 0;
+        err = phc_shm_now(page, &phc_ns, &error_ns);
+        struct phc_shm_mapping m;
+        phc_shm_read(page, &m);
+        int dev = page->device;
+        phc_shm_close(page);
+        if (err == -EAGAIN) {
+            fprintf(stderr, "Error: no mapping published yet\n");
+            return false;
+        }
+
+        printf("/dev/ptp%d time: %" PRId64 ".%09" PRId64 " +/- %" PRId64
+               " ns (update %" PRIu64 ", ratio %.12f)%s\n",
+               dev, phc_ns / 1000000000, phc_ns % 1000000000, error_ns, m.update_seq,
+               m.freq_ratio, err == -ESTALE ? " STALE" : "");
+        return err == 0;
+    }
 };
 
-// Definition of static member
+// Definition of static members
 bool PTPToolCLI::server_running = false;
+volatile sig_atomic_t PTPToolCLI::interrupted = 0;
 
 int main(int argc, char *argv[]) {
     PTPToolCLI cli;
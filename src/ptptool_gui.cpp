@@ -42,6 +42,8 @@
 #include <QTcpSocket>
 #include <QUdpSocket>
 #include <QNetworkInterface>
+#include <QHash>
+#include <QtEndian>
 
 #include <arpa/inet.h>
 #include <assert.h>
@@ -86,6 +88,9 @@
 #include <memory>
 #include <functional>
 
+#include "phc_clock_model.h"
+#include "phc_device.h"
+
 // PTP Worker Thread Class
 class PTPWorker : public QThread {
     Q_OBJECT
@@ -93,8 +98,7 @@ class PTPWorker : public QThread {
 public:
     struct PTPData {
         int device = -1;
-        clockid_t clkid;
-        int fd = -1;
+        PhcDevice phc;
         bool isConnected = false;
     };
 
@@ -127,30 +131,25 @@ private:
     QMutex mutex;
     bool running = false;
 
-    static clockid_t get_clockid(int fd) {
-        #define CLOCKFD 3
-        #define FD_TO_CLOCKID(fd) ((~(clockid_t)(fd) << 3) | CLOCKFD)
-        return FD_TO_CLOCKID(fd);
-    }
-
-    static long ppb_to_scaled_ppm(int ppb) {
-        return (long)(ppb * 65.536);
-    }
-
-    static int64_t pctns(struct ptp_clock_time *t) {
-        return t->sec * 1000000000LL + t->nsec;
-    }
-
-    std::string getPHCFileName(int phc_index) {
-        std::stringstream s;
-        s << "/dev/ptp" << phc_index;
-        return s.str();
-    }
-
     bool openDevice(int deviceIndex);
     void closeDevice();
 };
 
+// Binary PHC time update streamed to subscribed TCP clients. All fields
+// are little-endian.
+#define PTP_UPDATE_MAGIC 0x55505450   // "PTPU"
+#define PTP_UPDATE_VERSION 1
+#define PTP_UPDATE_PHC 0x0001         // time read from the PHC, else the system clock
+
+struct PTPTimeUpdate {
+    quint32 magic;
+    quint16 version;
+    quint16 flags;
+    quint64 sequence;    // tick number of the client's update interval
+    qint64 timeNs;       // clock time
+    qint64 sysNs;        // CLOCK_REALTIME right after the clock read
+} __attribute__((packed));
+
 // PTP Server Class
 class PTPServer : public QObject {
     Q_OBJECT
@@ -159,8 +158,13 @@ public:
     PTPServer(QObject *parent = nullptr);
     ~PTPServer();
 
+    static const int MAX_RATE = 1000;                 // updates per second
+    static const qint64 MAX_BACKLOG = 64 * 1024;      // unsent bytes per subscriber
+    static const int MODEL_INTERVAL = 100;            // clock model refresh (ms)
+    static const int64_t RESPONSE_TICK = 100000;      // response cache lifetime (ns)
+
 public slots:
-    void startServer(const QString &address, int port);
+    void startServer(const QString &address, int port, int device);
     void stopServer();
 
 signals:
@@ -186,9 +190,37 @@ private:
     QString serverAddress;
     int serverPort;
 
+    // Streaming subscriptions. Clients with the same update interval share
+    // one timer; every tick reads the clock once and writes the same
+    // serialized update to all of them.
+    struct Subscription {
+        QTimer *timer = nullptr;
+        QList<QTcpSocket*> clients;
+        quint64 sequence = 0;
+    };
+    std::map<int, Subscription> subscriptions;   // keyed by interval (ms)
+    QHash<QTcpSocket*, int> subscriberIntervals;
+    PhcDevice phc;
+    quint64 droppedUpdates = 0;
+
+    void subscribe(QTcpSocket *client, int rate);
+    void unsubscribe(QTcpSocket *client);
+    void publishUpdate(int interval);
+
+    // Request/response time comes from a clock model refreshed with cross
+    // timestamps in the background, so requests never reach the driver.
+    // All requests within one response tick of the same model refresh get
+    // the same serialized response, stamped at the middle of the tick.
+    enum ResponseKind { RESPONSE_TIME, RESPONSE_SYNC, RESPONSE_DELAY, RESPONSE_OTHER, RESPONSE_KINDS };
+    std::unique_ptr<PhcClockModel> model;
+    QByteArray cachedResponses[RESPONSE_KINDS];
+    int64_t cachedTick = -1;
+    uint64_t cachedSequence = 0;
+
     void sendPTPResponse(QTcpSocket *client, const QString &request);
     void sendUdpPTPResponse(const QHostAddress &address, quint16 port, const QString &request);
-    QString generatePTPResponse(const QString &request);
+    QByteArray generatePTPResponse(const QString &request);
+    static QByteArray formatPTPResponse(ResponseKind kind, int64_t timestamp, int64_t error);
 };
 
 // PTPServer Implementation
@@ -204,7 +236,7 @@ PTPServer::~PTPServer() {
     stopServer();
 }
 
-void PTPServer::startServer(const QString &address, int port) {
+void PTPServer::startServer(const QString &address, int port, int device) {
     QMutexLocker locker(&mutex);
     
     if (isRunning) {
@@ -236,8 +268,28 @@ void PTPServer::startServer(const QString &address, int port) {
         return;
     }
     
+    // Serve the PHC when it can be opened, else the system clock
+    QString source = "system clock";
+    if (device >= 0) {
+        int err = phc.open(device, O_RDONLY);
+        if (err) {
+            source = QString("system clock, /dev/ptp%1: %2").arg(device).arg(strerror(-err));
+        } else {
+            model.reset(new PhcClockModel(phc));
+            if (!model->start(MODEL_INTERVAL)) {
+                model.reset();
+            }
+            source = QString("/dev/ptp%1%2").arg(device)
+                     .arg(!model ? " (no cross timestamps, streaming only)"
+                          : model->usesPreciseTimestamps() ? " (precise cross timestamps)" : "");
+        }
+    }
+    droppedUpdates = 0;
+    cachedTick = -1;
+
     isRunning = true;
-    emit serverStarted(QString("PTP Server started on %1:%2 (TCP) and %3 (UDP)").arg(address).arg(port).arg(ptpPort));
+    emit serverStarted(QString("PTP Server started on %1:%2 (TCP) and %3 (UDP), streaming %4")
+                       .arg(address).arg(port).arg(ptpPort).arg(source));
 }
 
 void PTPServer::stopServer() {
@@ -247,6 +299,15 @@ void PTPServer::stopServer() {
         return;
     }
     
+    for (auto &entry : subscriptions) {
+        entry.second.timer->stop();
+        entry.second.timer->deleteLater();
+    }
+    subscriptions.clear();
+    subscriberIntervals.clear();
+    model.reset();
+    phc.close();
+
     // Close all client connections
     for (QTcpSocket *client : clients) {
         client->disconnectFromHost();
@@ -259,7 +320,8 @@ void PTPServer::stopServer() {
     udpSocket->close();
     
     isRunning = false;
-    emit serverStopped("PTP Server stopped");
+    emit serverStopped(QString("PTP Server stopped, %1 updates dropped for slow subscribers")
+                       .arg(droppedUpdates));
 }
 
 void PTPServer::handleNewConnection() {
@@ -279,6 +341,7 @@ void PTPServer::handleClientDisconnected() {
     QTcpSocket *client = qobject_cast<QTcpSocket*>(sender());
     if (client) {
         QString clientInfo = QString("%1:%2").arg(client->peerAddress().toString()).arg(client->peerPort());
+        unsubscribe(client);
         clients.removeAll(client);
         emit clientDisconnected(QString("Client disconnected: %1").arg(clientInfo));
         client->deleteLater();
@@ -295,7 +358,88 @@ void PTPServer::handleDataReceived() {
                          .arg(client->peerPort())
                          .arg(request.trimmed()));
         
-        sendPTPResponse(client, request);
+        // "subscribe <rate>" switches the connection to binary updates,
+        // "unsubscribe" back to request/response
+        QString command = request.trimmed().toLower();
+        if (command.startsWith("unsubscribe")) {
+            unsubscribe(client);
+            client->write("PTP_UNSUBSCRIBED\n");
+        } else if (command.startsWith("subscribe")) {
+            bool ok = false;
+            int rate = command.section(' ', 1, 1, QString::SectionSkipEmpty).toInt(&ok);
+            if (!ok || rate < 1 || rate > MAX_RATE) {
+                client->write(QString("PTP_ERROR: rate must be 1 to %1 Hz\n").arg(MAX_RATE).toUtf8());
+            } else {
+                subscribe(client, rate);
+            }
+        } else if (!subscriberIntervals.contains(client)) {
+            // Text responses would corrupt a subscriber's binary stream
+            sendPTPResponse(client, request);
+        }
+    }
+}
+
+void PTPServer::subscribe(QTcpSocket *client, int rate) {
+    unsubscribe(client);
+    int interval = qMax(1, qRound(1000.0 / rate));
+    Subscription &sub = subscriptions[interval];
+    if (!sub.timer) {
+        sub.timer = new QTimer(this);
+        sub.timer->setTimerType(Qt::PreciseTimer);
+        connect(sub.timer, &QTimer::timeout, this, [this, interval]() { publishUpdate(interval); });
+        sub.timer->start(interval);
+    }
+    sub.clients.append(client);
+    subscriberIntervals.insert(client, interval);
+    client->write(QString("PTP_SUBSCRIBED: every %1 ms, %2 byte updates\n")
+                  .arg(interval).arg(sizeof(PTPTimeUpdate)).toUtf8());
+}
+
+void PTPServer::unsubscribe(QTcpSocket *client) {
+    auto entry = subscriberIntervals.find(client);
+    if (entry == subscriberIntervals.end()) {
+        return;
+    }
+    auto it = subscriptions.find(entry.value());
+    subscriberIntervals.erase(entry);
+    it->second.clients.removeAll(client);
+    if (it->second.clients.isEmpty()) {
+        it->second.timer->stop();
+        it->second.timer->deleteLater();
+        subscriptions.erase(it);
+    }
+}
+
+void PTPServer::publishUpdate(int interval) {
+    auto it = subscriptions.find(interval);
+    if (it == subscriptions.end()) {
+        return;
+    }
+    Subscription &sub = it->second;
+
+    struct timespec now, sys;
+    bool fromPhc = phc.isOpen() && phc.getTime(&now) == 0;
+    clock_gettime(CLOCK_REALTIME, &sys);
+    if (!fromPhc) {
+        now = sys;
+    }
+    PTPTimeUpdate update;
+    update.magic = qToLittleEndian<quint32>(PTP_UPDATE_MAGIC);
+    update.version = qToLittleEndian<quint16>(PTP_UPDATE_VERSION);
+    update.flags = qToLittleEndian<quint16>(fromPhc ? PTP_UPDATE_PHC : 0);
+    update.sequence = qToLittleEndian<quint64>(sub.sequence++);
+    update.timeNs = qToLittleEndian<qint64>(PhcDevice::toNs(&now));
+    update.sysNs = qToLittleEndian<qint64>(PhcDevice::toNs(&sys));
+
+    // Serialized once per tick for every subscriber. A client that does
+    // not drain its socket skips updates instead of growing its buffer.
+    const QByteArray buffer(reinterpret_cast<const char*>(&update), sizeof(update));
+    for (QTcpSocket *client : sub.clients) {
+        if (client->bytesToWrite() > MAX_BACKLOG) {
+            droppedUpdates++;
+            continue;
+        }
+        client->write(buffer);
     }
 }
 
@@ -319,35 +463,60 @@ void PTPServer::handleUdpDataReceived() {
 }
 
 void PTPServer::sendPTPResponse(QTcpSocket *client, const QString &request) {
-    QString response = generatePTPResponse(request);
-    client->write(response.toUtf8());
+    client->write(generatePTPResponse(request));
     client->flush();
 }
 
 void PTPServer::sendUdpPTPResponse(const QHostAddress &address, quint16 port, const QString &request) {
-    QString response = generatePTPResponse(request);
-    udpSocket->writeDatagram(response.toUtf8(), address, port);
+    udpSocket->writeDatagram(generatePTPResponse(request), address, port);
 }
 
-QString PTPServer::generatePTPResponse(const QString &request) {
-    // Generate timestamp
+QByteArray PTPServer::generatePTPResponse(const QString &request) {
+    QString command = request.trimmed().toLower();
+    ResponseKind kind = command.contains("time")    ? RESPONSE_TIME
+                        : command.contains("sync")  ? RESPONSE_SYNC
+                        : command.contains("delay") ? RESPONSE_DELAY
+                                                    : RESPONSE_OTHER;
+
+    PhcClockModel::Params params;
+    if (model && model->snapshot(&params)) {
+        struct timespec raw;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+        int64_t tick = PhcDevice::toNs(&raw) / RESPONSE_TICK;
+        if (tick != cachedTick || params.sequence != cachedSequence) {
+            for (QByteArray &response : cachedResponses) {
+                response.clear();
+            }
+            cachedTick = tick;
+            cachedSequence = params.sequence;
+        }
+        QByteArray &cached = cachedResponses[kind];
+        int64_t timestamp, error;
+        if (cached.isEmpty() &&
+            model->at(tick * RESPONSE_TICK + RESPONSE_TICK / 2, &timestamp, &error) == 0) {
+            cached = formatPTPResponse(kind, timestamp, error + RESPONSE_TICK / 2);
+        }
+        if (!cached.isEmpty()) {
+            return cached;
+        }
+    }
+
+    // No PHC: host time without an uncertainty
     auto now = std::chrono::system_clock::now();
     auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
-    
-    // Basic PTP-like response format
-    QString response;
-    
-    if (request.trimmed().toLower().contains("time")) {
-        response = QString("PTP_TIME_RESPONSE: %1 ns\n").arg(timestamp);
-    } else if (request.trimmed().toLower().contains("sync")) {
-        response = QString("PTP_SYNC_RESPONSE: %1 ns\n").arg(timestamp);
-    } else if (request.trimmed().toLower().contains("delay")) {
-        response = QString("PTP_DELAY_RESPONSE: %1 ns\n").arg(timestamp);
-    } else {
-        response = QString("PTP_RESPONSE: Server time %1 ns\n").arg(timestamp);
+    return formatPTPResponse(kind, timestamp, -1);
+}
+
+QByteArray PTPServer::formatPTPResponse(ResponseKind kind, int64_t timestamp, int64_t error) {
+    static const char *const formats[RESPONSE_KINDS] = {
+        "PTP_TIME_RESPONSE: %1 ns", "PTP_SYNC_RESPONSE: %1 ns", "PTP_DELAY_RESPONSE: %1 ns",
+        "PTP_RESPONSE: Server time %1 ns",
+    };
+    QString response = QString(formats[kind]).arg(timestamp);
+    if (error >= 0) {
+        response += QString(" +/- %1 ns").arg(error);
     }
-    
-    return response;
+    return (response + "\n").toUtf8();
 }
 
 // Main GUI Window
@@ -456,8 +625,9 @@ void PTPWorker::getTime() {
     }
 
     struct timespec ts;
-    if (clock_gettime(ptpData.clkid, &ts)) {
-        emit errorOccurred(QString("clock_gettime failed: %1").arg(strerror(errno)));
+    int err = ptpData.phc.getTime(&ts);
+    if (err) {
+        emit errorOccurred(QString("clock_gettime failed: %1").arg(strerror(-err)));
         return;
     }
 
@@ -477,8 +647,9 @@ void PTPWorker::getCapabilities() {
     }
 
     struct ptp_clock_caps caps;
-    if (ioctl(ptpData.fd, PTP_CLOCK_GETCAPS, &caps)) {
-        emit errorOccurred(QString("PTP_CLOCK_GETCAPS failed: %1").arg(strerror(errno)));
+    int err = ptpData.phc.getCaps(&caps);
+    if (err) {
+        emit errorOccurred(QString("PTP_CLOCK_GETCAPS failed: %1").arg(strerror(-err)));
         return;
     }
 
@@ -519,8 +690,9 @@ void PTPWorker::measureOffset(int samples) {
     ptp_sys_offset sysoff = {};
     sysoff.n_samples = samples;
 
-    if (ioctl(ptpData.fd, PTP_SYS_OFFSET, &sysoff)) {
-        emit errorOccurred(QString("PTP_SYS_OFFSET failed: %1").arg(strerror(errno)));
+    int err = ptpData.phc.sysOffset(&sysoff);
+    if (err) {
+        emit errorOccurred(QString("PTP_SYS_OFFSET failed: %1").arg(strerror(-err)));
         return;
     }
 
@@ -528,9 +700,9 @@ void PTPWorker::measureOffset(int samples) {
     struct ptp_clock_time *pct = &sysoff.ts[0];
     
     for (unsigned int i = 0; i < sysoff.n_samples; i++) {
-        int64_t t1 = pctns(pct + 2 * i);
-        int64_t tp = pctns(pct + 2 * i + 1);
-        int64_t t2 = pctns(pct + 2 * i + 2);
+        int64_t t1 = PhcDevice::toNs(pct + 2 * i);
+        int64_t tp = PhcDevice::toNs(pct + 2 * i + 1);
+        int64_t t2 = PhcDevice::toNs(pct + 2 * i + 2);
         int64_t interval = t2 - t1;
         int64_t offset = (t2 + t1) / 2 - tp;
 
@@ -561,13 +733,9 @@ void PTPWorker::adjustFrequency(int ppb) {
         return;
     }
 
-    struct timex tx;
-    memset(&tx, 0, sizeof(tx));
-    tx.modes = ADJ_FREQUENCY;
-    tx.freq = ppb_to_scaled_ppm(ppb);
-    
-    if (clock_adjtime(ptpData.clkid, &tx)) {
-        emit errorOccurred(QString("clock_adjtime failed: %1").arg(strerror(errno)));
+    int err = ptpData.phc.adjustFrequency(ppb);
+    if (err) {
+        emit errorOccurred(QString("clock_adjtime failed: %1").arg(strerror(-err)));
         return;
     }
     
@@ -582,14 +750,9 @@ void PTPWorker::adjustTime(int seconds) {
         return;
     }
 
-    struct timex tx;
-    memset(&tx, 0, sizeof(tx));
-    tx.modes = ADJ_SETOFFSET;
-    tx.time.tv_sec = seconds;
-    tx.time.tv_usec = 0;
-    
-    if (clock_adjtime(ptpData.clkid, &tx) < 0) {
-        emit errorOccurred(QString("clock_adjtime failed: %1").arg(strerror(errno)));
+    int err = ptpData.phc.adjustTime(seconds * 1000000000LL);
+    if (err) {
+        emit errorOccurred(QString("clock_adjtime failed: %1").arg(strerror(-err)));
         return;
     }
     
@@ -607,8 +770,9 @@ void PTPWorker::setTimeFromSystem() {
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
     
-    if (clock_settime(ptpData.clkid, &ts)) {
-        emit errorOccurred(QString("clock_settime failed: %1").arg(strerror(errno)));
+    int err = ptpData.phc.setTime(&ts);
+    if (err) {
+        emit errorOccurred(QString("clock_settime failed: %1").arg(strerror(-err)));
         return;
     }
     
@@ -624,7 +788,11 @@ void PTPWorker::setSystemFromTime() {
     }
 
     struct timespec ts;
-    clock_gettime(ptpData.clkid, &ts);
+    int err = ptpData.phc.getTime(&ts);
+    if (err) {
+        emit errorOccurred(QString("clock_gettime failed: %1").arg(strerror(-err)));
+        return;
+    }
     
     if (clock_settime(CLOCK_REALTIME, &ts)) {
         emit errorOccurred(QString("clock_settime failed: %1").arg(strerror(errno)));
@@ -646,8 +814,9 @@ void PTPWorker::listPins() {
     struct ptp_pin_desc desc;
     int n_pins = 0;
     
-    if (ioctl(ptpData.fd, PTP_CLOCK_GETCAPS, &caps)) {
-        emit errorOccurred(QString("PTP_CLOCK_GETCAPS failed: %1").arg(strerror(errno)));
+    int err = ptpData.phc.getCaps(&caps);
+    if (err) {
+        emit errorOccurred(QString("PTP_CLOCK_GETCAPS failed: %1").arg(strerror(-err)));
         return;
     } else {
         n_pins = caps.n_pins;
@@ -656,9 +825,11 @@ void PTPWorker::listPins() {
     QString pinsStr = QString("Pin configuration for /dev/ptp%1:\n\n").arg(ptpData.device);
     
     for (int i = 0; i < n_pins; i++) {
+        memset(&desc, 0, sizeof(desc));
         desc.index = i;
-        if (ioctl(ptpData.fd, PTP_PIN_GETFUNC, &desc)) {
-            pinsStr += QString("Error reading pin %1: %2\n").arg(i).arg(strerror(errno));
+        err = ptpData.phc.getPin(&desc);
+        if (err) {
+            pinsStr += QString("Error reading pin %1: %2\n").arg(i).arg(strerror(-err));
             break;
         }
         pinsStr += QString("Name %1 index %2 func %3 chan %4\n")
@@ -697,20 +868,11 @@ bool PTPWorker::openDevice(int deviceIndex) {
         return false;
     }
     
-    std::string devicePath = getPHCFileName(deviceIndex);
-    ptpData.fd = open(devicePath.c_str(), O_RDWR);
-    if (ptpData.fd < 0) {
-        emit errorOccurred(QString("Error opening %1: %2")
-                          .arg(QString::fromStdString(devicePath))
-                          .arg(strerror(errno)));
-        return false;
-    }
-    
-    ptpData.clkid = get_clockid(ptpData.fd);
-    if (ptpData.clkid == -1) {
-        emit errorOccurred("Failed to read clock id");
-        close(ptpData.fd);
-        ptpData.fd = -1;
+    int err = ptpData.phc.open(deviceIndex);
+    if (err) {
+        emit errorOccurred(QString("Error opening /dev/ptp%1: %2")
+                          .arg(deviceIndex)
+                          .arg(strerror(-err)));
         return false;
     }
     
@@ -718,10 +880,7 @@ bool PTPWorker::openDevice(int deviceIndex) {
 }
 
 void PTPWorker::closeDevice() {
-    if (ptpData.fd >= 0) {
-        close(ptpData.fd);
-        ptpData.fd = -1;
-    }
+    ptpData.phc.close();
     ptpData.isConnected = false;
 }
 
@@ -1096,10 +1255,11 @@ void PTPToolGUI::closeEvent(QCloseEvent *event) {
 void PTPToolGUI::onStartServer() {
     QString address = serverAddressEdit->text();
     int port = serverPortSpinBox->value();
+    int device = deviceComboBox->currentIndex();
     
     networkLog->append(QString("Starting server on %1:%2...").arg(address).arg(port));
     QMetaObject::invokeMethod(ptpServer, "startServer", Qt::QueuedConnection,
-                             Q_ARG(QString, address), Q_ARG(int, port));
+                             Q_ARG(QString, address), Q_ARG(int, port), Q_ARG(int, device));
 }
 
 void PTPToolGUI::onStopServer() {
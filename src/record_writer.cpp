@@ -0,0 +1,242 @@
+/*
+ * ShiwaPTPTool - Structured command output
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "record_writer.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+bool RecordWriter::setFormat(const char *name) {
+    static const struct {
+        const char *name;
+        OutputFormat format;
+    } FORMATS[] = {
+        {"text", OUTPUT_TEXT},
+        {"json", OUTPUT_JSON},
+        {"csv", OUTPUT_CSV},
+        {"binary", OUTPUT_BINARY},
+    };
+    for (const auto &f : FORMATS) {
+        if (!strcmp(name, f.name)) {
+            fmt = f.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Oversized records are truncated rather than overflowing the buffer;
+// with the short field lists the commands use this never happens.
+void RecordWriter::put(const char *data, size_t n) {
+    if (length + n > MAX_RECORD) {
+        n = MAX_RECORD - length;
+    }
+    memcpy(line + length, data, n);
+    length += n;
+}
+
+void RecordWriter::putString(const char *s) {
+    put(s, strlen(s));
+}
+
+void RecordWriter::putInt(int64_t v) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+    do {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) {
+        *--p = '-';
+    }
+    put(p, digits + sizeof(digits) - p);
+}
+
+void RecordWriter::putQuoted(const char *s) {
+    if (fmt == OUTPUT_JSON) {
+        putChar('"');
+        for (; *s; s++) {
+            unsigned char c = *s;
+            if (c == '"' || c == '\\') {
+                putChar('\\');
+                putChar(c);
+            } else if (c < 0x20) {
+                static const char HEX[] = "0123456789abcdef";
+                char esc[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 15]};
+                put(esc, sizeof(esc));
+            } else {
+                putChar(c);
+            }
+        }
+        putChar('"');
+        return;
+    }
+
+    // CSV: quote only when needed, doubling embedded quotes
+    if (!strpbrk(s, ",\"\r\n")) {
+        putString(s);
+        return;
+    }
+    putChar('"');
+    for (; *s; s++) {
+        if (*s == '"') {
+            putChar('"');
+        }
+        putChar(*s);
+    }
+    putChar('"');
+}
+
+void RecordWriter::putName(const char *name, FieldKind kind) {
+    fields++;
+    switch (fmt) {
+        case OUTPUT_JSON:
+            putChar(',');
+            putQuoted(name);
+            putChar(':');
+            break;
+        case OUTPUT_CSV:
+            putChar(',');
+            addHeader(name);
+            break;
+        case OUTPUT_BINARY: {
+            size_t n = strnlen(name, 255);
+            char tag[2] = {(char)kind, (char)n};
+            put(tag, sizeof(tag));
+            put(name, n);
+            break;
+        }
+        case OUTPUT_TEXT:
+            break;
+    }
+}
+
+void RecordWriter::addHeader(const char *name) {
+    if (!newType) {
+        return;
+    }
+    size_t n = strlen(name);
+    if (headerLength + n + 1 > sizeof(header)) {
+        return;
+    }
+    header[headerLength++] = ',';
+    memcpy(header + headerLength, name, n);
+    headerLength += n;
+}
+
+void RecordWriter::begin(const char *type) {
+    length = 0;
+    fields = 0;
+    switch (fmt) {
+        case OUTPUT_JSON:
+            putString("{\"type\":");
+            putQuoted(type);
+            break;
+        case OUTPUT_CSV:
+            newType = strncmp(type, lastType, sizeof(lastType)) != 0;
+            if (newType) {
+                snprintf(lastType, sizeof(lastType), "%s", type);
+                memcpy(header, "type", 4);
+                headerLength = 4;
+            }
+            putQuoted(type);
+            break;
+        case OUTPUT_BINARY: {
+            // Length and field count are filled in by end()
+            size_t n = strnlen(type, 255);
+            char head[4] = {0, 0, 0, (char)n};
+            put(head, sizeof(head));
+            put(type, n);
+            break;
+        }
+        case OUTPUT_TEXT:
+            break;
+    }
+}
+
+void RecordWriter::intField(const char *name, int64_t value) {
+    putName(name, FIELD_INT);
+    if (fmt == OUTPUT_BINARY) {
+        put((const char *)&value, sizeof(value));
+    } else {
+        putInt(value);
+    }
+}
+
+void RecordWriter::field(const char *name, double value) {
+    putName(name, FIELD_DOUBLE);
+    if (fmt == OUTPUT_BINARY) {
+        put((const char *)&value, sizeof(value));
+    } else if (isfinite(value)) {
+        char text[32];
+        int n = snprintf(text, sizeof(text), "%.12g", value);
+        put(text, n);
+    } else if (fmt == OUTPUT_JSON) {
+        putString("null");
+    }
+}
+
+void RecordWriter::field(const char *name, const char *value) {
+    putName(name, FIELD_STRING);
+    if (fmt == OUTPUT_BINARY) {
+        uint16_t n = (uint16_t)strnlen(value, MAX_RECORD);
+        put((const char *)&n, sizeof(n));
+        put(value, n);
+    } else {
+        putQuoted(value);
+    }
+}
+
+void RecordWriter::end() {
+    switch (fmt) {
+        case OUTPUT_JSON:
+            putString("}\n");
+            break;
+        case OUTPUT_CSV:
+            putChar('\n');
+            break;
+        case OUTPUT_BINARY: {
+            uint16_t n = (uint16_t)length;
+            memcpy(line, &n, sizeof(n));
+            line[2] = (char)fields;
+            break;
+        }
+        case OUTPUT_TEXT:
+            return;
+    }
+
+    size_t needed = length + (fmt == OUTPUT_CSV && newType ? headerLength + 1 : 0);
+    if (used + needed > sizeof(buffer)) {
+        flush();
+    }
+    if (fmt == OUTPUT_CSV && newType) {
+        memcpy(buffer + used, header, headerLength);
+        used += headerLength;
+        buffer[used++] = '\n';
+        newType = false;
+    }
+    memcpy(buffer + used, line, length);
+    used += length;
+}
+
+int RecordWriter::flush() {
+    if (used) {
+        if (fwrite(buffer, 1, used, out) != used && !error) {
+            error = errno ? -errno : -EIO;
+        }
+        used = 0;
+    }
+    if (fflush(out) && !error) {
+        error = -errno;
+    }
+    return error;
+}
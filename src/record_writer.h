@@ -0,0 +1,112 @@
+/*
+ * ShiwaPTPTool - Structured command output
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_RECORD_WRITER_H
+#define SHIWA_RECORD_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <type_traits>
+
+enum OutputFormat {
+    OUTPUT_TEXT,    // free-form text printed by each command
+    OUTPUT_JSON,    // one JSON object per line
+    OUTPUT_CSV,     // header line whenever the record type changes
+    OUTPUT_BINARY,  // self-describing records, see below
+};
+
+// Formats flat records of named fields into one reusable buffer and
+// writes it out with a single fwrite() when it fills up or on flush().
+// Nothing is allocated after construction, so the high-rate modes pay for
+// the formatting only.
+//
+// Every record carries a "type" (e.g. "event") and its fields in order:
+//
+//   {"type":"event","device":0,"channel":1,"sec":1700000000,"nsec":42}
+//   type,device,channel,sec,nsec
+//   event,0,1,1700000000,42
+//
+// Absolute times are split into seconds and nanoseconds so JSON readers
+// that parse numbers as doubles keep them exact.
+//
+// Binary records use host byte order (little endian on x86-64 and arm64):
+//
+//   u16 record length in bytes, including this header
+//   u8  number of fields
+//   u8  type length, type bytes
+//   per field: u8 kind (1 int64, 2 double, 3 string), u8 name length,
+//              name bytes, then 8 value bytes or u16 length + string bytes
+class RecordWriter {
+public:
+    enum FieldKind { FIELD_INT = 1, FIELD_DOUBLE = 2, FIELD_STRING = 3 };
+
+    explicit RecordWriter(FILE *out) : out(out) {}
+    ~RecordWriter() { flush(); }
+
+    RecordWriter(const RecordWriter &) = delete;
+    RecordWriter &operator=(const RecordWriter &) = delete;
+
+    // Accepts "text", "json", "csv" or "binary".
+    bool setFormat(const char *name);
+    void setFormat(OutputFormat format) { fmt = format; }
+
+    // Repeats the CSV header before the next record, for when something
+    // else has written to the same stream in between.
+    void restartHeader() { lastType[0] = '\0'; }
+    OutputFormat format() const { return fmt; }
+    bool structured() const { return fmt != OUTPUT_TEXT; }
+
+    void begin(const char *type);
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value>::type field(const char *name, T value) {
+        intField(name, (int64_t)value);
+    }
+    void field(const char *name, double value);
+    void field(const char *name, const char *value);
+    void end();
+
+    // Returns 0 or -errno of the first failed write.
+    int flush();
+
+private:
+    static const size_t BUFFER_SIZE = 64 * 1024;
+    static const size_t MAX_RECORD = 2048;
+    static const size_t MAX_TYPE = 32;
+
+    FILE *out;
+    OutputFormat fmt = OUTPUT_TEXT;
+    int error = 0;
+
+    char buffer[BUFFER_SIZE];
+    size_t used = 0;
+
+    // Record being built
+    char line[MAX_RECORD];
+    size_t length = 0;
+    unsigned int fields = 0;
+
+    // CSV header of the current record type
+    char header[MAX_RECORD];
+    size_t headerLength = 0;
+    bool newType = false;
+    char lastType[MAX_TYPE] = "";
+
+    void put(const char *data, size_t n);
+    void putChar(char c) { put(&c, 1); }
+    void putString(const char *s);
+    void putInt(int64_t v);
+    void putQuoted(const char *s);
+    void putName(const char *name, FieldKind kind);
+    void addHeader(const char *name);
+    void intField(const char *name, int64_t value);
+};
+
+#endif // SHIWA_RECORD_WRITER_H
@@ -0,0 +1,239 @@
+/*
+ * ShiwaPTPTool - Real-time execution profile
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "rt_profile.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Stack and heap reserves touched up front so the hot loop never takes a
+// page fault on first use.
+static const size_t PREFAULT_STACK_SIZE = 512 * 1024;
+static const size_t PREFAULT_HEAP_SIZE = 8 * 1024 * 1024;
+
+// CPUs the process could use before the hot thread was pinned; written
+// by apply() before any helper thread that reads it is started.
+static cpu_set_t inheritedCpus;
+static bool pinned = false;
+
+// Returns true when 'cpu' appears in a kernel CPU list such as "2-5,7".
+static bool cpuInList(const char *path, int cpu, bool *present) {
+    *present = false;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    char buf[256] = {};
+    if (!fgets(buf, sizeof(buf), f)) {
+        buf[0] = '\0';
+    }
+    fclose(f);
+
+    for (char *tok = strtok(buf, ",\n"); tok; tok = strtok(NULL, ",\n")) {
+        int lo, hi;
+        int cnt = sscanf(tok, "%d-%d", &lo, &hi);
+        if (cnt == 1) {
+            hi = lo;
+        }
+        if (cnt >= 1 && cpu >= lo && cpu <= hi) {
+            *present = true;
+        }
+    }
+    return true;
+}
+
+// Returns false when the file is missing or does not hold a number.
+static bool readProcLong(const char *path, long *value) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    bool ok = fscanf(f, "%ld", value) == 1;
+    fclose(f);
+    return ok;
+}
+
+bool RealtimeProfile::apply() {
+    bool ok = true;
+    if (lockMemory) {
+        ok = applyMemoryLock() && ok;
+    }
+    if (cpu >= 0) {
+        ok = applyAffinity() && ok;
+    }
+    if (priority > 0) {
+        ok = applyScheduling() && ok;
+    }
+    validateIsolation();
+
+    getrusage(RUSAGE_THREAD, &start);
+    startCpu = sched_getcpu();
+    return ok;
+}
+
+bool RealtimeProfile::applyMemoryLock() {
+    // Keep freed memory in the locked heap instead of returning it to the
+    // kernel, and serve large allocations from it rather than fresh mmaps.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        struct rlimit rl;
+        getrlimit(RLIMIT_MEMLOCK, &rl);
+        fprintf(stderr, "Warning: mlockall failed: %s (RLIMIT_MEMLOCK %llu bytes)\n",
+                strerror(errno), (unsigned long long)rl.rlim_cur);
+        return false;
+    }
+
+    prefaultStack();
+    prefaultHeap();
+    return true;
+}
+
+bool RealtimeProfile::applyAffinity() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_getaffinity(0, sizeof(inheritedCpus), &inheritedCpus)) {
+        CPU_ZERO(&inheritedCpus);
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            CPU_SET(i, &inheritedCpus);
+        }
+    }
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        fprintf(stderr, "Warning: cannot pin to CPU %d: %s\n", cpu, strerror(errno));
+        return false;
+    }
+    pinned = true;
+    return true;
+}
+
+bool RealtimeProfile::applyScheduling() {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+        fprintf(stderr, "Warning: cannot set SCHED_FIFO priority %d: %s\n", priority,
+                strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Checks that what was requested is actually in effect and that the rest
+// of the system does not undermine it.
+void RealtimeProfile::validateIsolation() {
+    if (priority > 0) {
+        struct sched_param param;
+        if (sched_getscheduler(0) != SCHED_FIFO || sched_getparam(0, &param) ||
+            param.sched_priority != priority) {
+            fprintf(stderr, "Warning: SCHED_FIFO priority %d is not in effect\n", priority);
+        }
+        long runtime;
+        if (readProcLong("/proc/sys/kernel/sched_rt_runtime_us", &runtime) && runtime >= 0) {
+            fprintf(stderr, "Warning: RT throttling is active "
+                            "(kernel.sched_rt_runtime_us != -1)\n");
+        }
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) || CPU_COUNT(&set) != 1 ||
+            !CPU_ISSET(cpu, &set)) {
+            fprintf(stderr, "Warning: thread is not pinned to CPU %d\n", cpu);
+        }
+        bool isolated = false, nohz = false;
+        if (!cpuInList("/sys/devices/system/cpu/isolated", cpu, &isolated) || !isolated) {
+            fprintf(stderr, "Warning: CPU %d is not isolated (isolcpus), other tasks "
+                            "may be scheduled on it\n", cpu);
+        }
+        if (!cpuInList("/sys/devices/system/cpu/nohz_full", cpu, &nohz) || !nohz) {
+            fprintf(stderr, "Warning: CPU %d is not in nohz_full, the scheduler tick "
+                            "will interrupt it\n", cpu);
+        }
+    }
+
+    if (lockMemory) {
+        FILE *f = fopen("/proc/self/status", "r");
+        char line[128];
+        long locked = -1;
+        while (f && fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "VmLck: %ld", &locked) == 1) {
+                break;
+            }
+        }
+        if (f) {
+            fclose(f);
+        }
+        if (locked == 0) {
+            fprintf(stderr, "Warning: no memory is locked (VmLck 0 kB)\n");
+        }
+    }
+}
+
+// Only plain system calls, so it is also safe in a child between fork()
+// and exec().
+void RealtimeProfile::releaseThread() {
+    if (sched_getscheduler(0) == SCHED_FIFO) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        sched_setscheduler(0, SCHED_OTHER, &param);
+    }
+    if (pinned) {
+        sched_setaffinity(0, sizeof(inheritedCpus), &inheritedCpus);
+    }
+}
+
+void RealtimeProfile::prefaultStack() {
+    char stack[PREFAULT_STACK_SIZE];
+    volatile char *touch = stack;
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < PREFAULT_STACK_SIZE; i += page) {
+        touch[i] = 0;
+    }
+}
+
+void RealtimeProfile::prefaultHeap() {
+    char *reserve = (char *)malloc(PREFAULT_HEAP_SIZE);
+    if (!reserve) {
+        return;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < PREFAULT_HEAP_SIZE; i += page) {
+        reserve[i] = 0;
+    }
+    free(reserve);
+}
+
+void RealtimeProfile::report() {
+    struct rusage now;
+    getrusage(RUSAGE_THREAD, &now);
+    long minflt = now.ru_minflt - start.ru_minflt;
+    long majflt = now.ru_majflt - start.ru_majflt;
+    long nivcsw = now.ru_nivcsw - start.ru_nivcsw;
+    int endCpu = sched_getcpu();
+
+    printf("Real-time profile: %ld minor / %ld major page faults, "
+           "%ld involuntary context switches, CPU %d -> %d\n",
+           minflt, majflt, nivcsw, startCpu, endCpu);
+    if (majflt > 0 || (lockMemory && minflt > 0)) {
+        fprintf(stderr, "Warning: page faults occurred in the real-time loop\n");
+    }
+    if (cpu < 0 && startCpu != endCpu) {
+        fprintf(stderr, "Warning: thread migrated between CPUs, use --cpu to pin it\n");
+    }
+}
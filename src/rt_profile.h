@@ -0,0 +1,50 @@
+/*
+ * ShiwaPTPTool - Real-time execution profile
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_RT_PROFILE_H
+#define SHIWA_RT_PROFILE_H
+
+#include <sys/resource.h>
+
+// Scheduling and memory residency settings for the latency-critical loops
+// (extts capture, timers, server). apply() is called once on the hot thread
+// before the loop starts and warns about every setting that did not take
+// effect; report() prints the page faults, context switches and CPU
+// migrations that still happened while the profile was active.
+class RealtimeProfile {
+public:
+    int priority = 0;      // SCHED_FIFO priority, 0 keeps the default policy
+    int cpu = -1;          // CPU to pin the hot thread to, -1 for no pinning
+    bool lockMemory = false;
+
+    bool enabled() const { return priority > 0 || cpu >= 0 || lockMemory; }
+
+    bool apply();
+    void report();
+
+    // Returns the calling thread to the default policy and to the CPUs
+    // the process had before apply() pinned it. Helper threads call this
+    // first so they do not compete with the hot thread they were started
+    // from.
+    static void releaseThread();
+
+private:
+    struct rusage start = {};
+    int startCpu = -1;
+
+    bool applyMemoryLock();
+    bool applyAffinity();
+    bool applyScheduling();
+    void validateIsolation();
+    static void prefaultStack();
+    static void prefaultHeap();
+};
+
+#endif // SHIWA_RT_PROFILE_H
@@ -0,0 +1,165 @@
+/*
+ * ShiwaPTPTool - Streaming frequency stability analysis
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#include "stability.h"
+#include "rt_profile.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+static uint64_t roundUpPow2(uint64_t v) {
+    uint64_t p = 1;
+    while (p < v) {
+        p <<= 1;
+    }
+    return p;
+}
+
+StabilityAnalyzer::StabilityAnalyzer(double tau0, uint64_t expected, int threads) : tau0(tau0) {
+    for (uint64_t m = 1; m <= MAX_FACTOR && 2 * m + 1 <= expected; m *= 2) {
+        taus.emplace_back();
+        Tau &t = taus.back();
+        t.m = m;
+        t.diffs.assign(roundUpPow2(m + 1), 0.0);
+        t.diffMask = t.diffs.size() - 1;
+    }
+
+    // The producer runs at most one block ahead of the slowest worker,
+    // which still reads 2 * m samples back from its block.
+    uint64_t maxM = taus.empty() ? 0 : taus.back().m;
+    ring.assign(roundUpPow2(2 * maxM + 2 * BLOCK + 1), 0.0);
+    ringMask = ring.size() - 1;
+
+    workerCount = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+    workerCount = std::max(1, std::min(workerCount, (int)taus.size()));
+    if (taus.empty()) {
+        workerCount = 0;
+    }
+    progress.assign(workerCount, 0);
+    for (int w = 0; w < workerCount; w++) {
+        workers.emplace_back([this, w] { work(w); });
+    }
+}
+
+StabilityAnalyzer::~StabilityAnalyzer() {
+    if (!finished) {
+        finish();
+    }
+}
+
+void StabilityAnalyzer::publish(bool last) {
+    std::unique_lock<std::mutex> guard(lock);
+    published = count;
+    finished = last;
+    dataReady.notify_all();
+    if (last) {
+        return;
+    }
+
+    // The next block overwrites the ring, so every worker must be done
+    // with the block before this one.
+    uint64_t need = count - BLOCK;
+    blockDone.wait(guard, [this, need] {
+        return std::all_of(progress.begin(), progress.end(),
+                           [need](uint64_t p) { return p >= need; });
+    });
+}
+
+void StabilityAnalyzer::work(int worker) {
+    // Spread over all CPUs even when the producer is pinned
+    RealtimeProfile::releaseThread();
+    uint64_t done = 0;
+    for (;;) {
+        uint64_t end;
+        bool last;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            dataReady.wait(guard, [this, done] { return published > done || finished; });
+            end = published;
+            last = finished;
+        }
+        for (size_t i = worker; i < taus.size(); i += workerCount) {
+            process(taus[i], done, end);
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            progress[worker] = end;
+        }
+        blockDone.notify_one();
+        done = end;
+        if (last) {
+            break;
+        }
+    }
+}
+
+// For sample n the second difference d = x[n] - 2 x[n-m] + x[n-2m] is one
+// ADEV term; the sum of the last m of them is one MDEV term.
+void StabilityAnalyzer::process(Tau &t, uint64_t begin, uint64_t end) {
+    const uint64_t m = t.m;
+    const double *x = ring.data();
+    double *diffs = t.diffs.data();
+    long double sum = t.sum;
+    double adevSum = 0, mdevSum = 0;
+    uint64_t mdevTerms = 0;
+
+    uint64_t n = std::max(begin, 2 * m);
+    if (n >= end) {
+        return;
+    }
+    t.adevTerms += end - n;
+    for (; n < end; n++) {
+        double d = x[n & ringMask] - 2 * x[(n - m) & ringMask] + x[(n - 2 * m) & ringMask];
+        adevSum += d * d;
+        uint64_t j = n - 2 * m;
+        sum += d;
+        if (j >= m) {
+            sum -= diffs[(j - m) & t.diffMask];
+        }
+        diffs[j & t.diffMask] = d;
+        if (j + 1 >= m) {
+            mdevSum += (double)(sum * sum);
+            mdevTerms++;
+        }
+    }
+    t.sum = sum;
+    t.adevSum += adevSum;
+    t.mdevSum += mdevSum;
+    t.mdevTerms += mdevTerms;
+}
+
+std::vector<StabilityPoint> StabilityAnalyzer::finish() {
+    if (!finished) {
+        publish(true);
+        for (std::thread &w : workers) {
+            w.join();
+        }
+    }
+
+    std::vector<StabilityPoint> points;
+    for (const Tau &t : taus) {
+        if (!t.adevTerms) {
+            continue;
+        }
+        StabilityPoint p = {};
+        p.m = t.m;
+        p.tau = t.m * tau0;
+        p.adevTerms = t.adevTerms;
+        p.adev = sqrt(t.adevSum / (2.0 * t.adevTerms)) * 1e-9 / p.tau;
+        p.mdevTerms = t.mdevTerms;
+        if (t.mdevTerms) {
+            p.mdev = sqrt(t.mdevSum / (2.0 * t.mdevTerms)) / t.m * 1e-9 / p.tau;
+            p.tdev = p.tau * p.mdev / sqrt(3.0);
+        }
+        points.push_back(p);
+    }
+    return points;
+}
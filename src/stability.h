@@ -0,0 +1,104 @@
+/*
+ * ShiwaPTPTool - Streaming frequency stability analysis
+ *
+ * Copyright (c) 2024 SHIWA NETWORK
+ * All rights reserved.
+ *
+ * This software is provided as-is for educational and development purposes.
+ * Use at your own risk.
+ */
+
+#ifndef SHIWA_STABILITY_H
+#define SHIWA_STABILITY_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Statistics at one averaging time tau = m * tau0.
+struct StabilityPoint {
+    uint64_t m;
+    double tau;           // s
+    uint64_t adevTerms;
+    double adev;          // overlapping Allan deviation
+    uint64_t mdevTerms;   // 0 when the series is too short for MDEV/TDEV
+    double mdev;          // modified Allan deviation
+    double tdev;          // time deviation (s)
+};
+
+// Overlapping ADEV, MDEV and TDEV of a phase (time error) series at octave
+// spaced taus, computed in one pass as samples arrive.
+//
+// The series is kept in a ring just long enough for the largest tau;
+// every tau additionally keeps a ring of its m most recent second
+// differences for the MDEV moving sum. Samples are handed over in blocks
+// to worker threads that each own a share of the taus, so memory does not
+// grow with the series length and the taus are computed in parallel.
+class StabilityAnalyzer {
+public:
+    // Largest averaging factor m; bounds the memory to a few tens of MB.
+    static const uint64_t MAX_FACTOR = 1ull << 20;
+
+    // 'tau0' is the sample spacing in seconds. 'expected' is an upper
+    // bound on the number of samples and selects the taus; 'threads' = 0
+    // uses every CPU.
+    StabilityAnalyzer(double tau0, uint64_t expected, int threads = 0);
+    ~StabilityAnalyzer();
+
+    StabilityAnalyzer(const StabilityAnalyzer &) = delete;
+    StabilityAnalyzer &operator=(const StabilityAnalyzer &) = delete;
+
+    // Appends a phase sample in ns.
+    void add(double x) {
+        ring[count & ringMask] = x;
+        if ((++count & (BLOCK - 1)) == 0) {
+            publish(false);
+        }
+    }
+
+    // Waits for the workers and returns one point per tau, in order.
+    std::vector<StabilityPoint> finish();
+
+    uint64_t samples() const { return count; }
+    int threads() const { return workerCount; }
+
+private:
+    static const uint64_t BLOCK = 1 << 16;
+
+    struct Tau {
+        uint64_t m;
+        std::vector<double> diffs;  // ring of second differences
+        uint64_t diffMask;
+        long double sum = 0;        // moving sum of the last m differences
+        double adevSum = 0;
+        uint64_t adevTerms = 0;
+        double mdevSum = 0;
+        uint64_t mdevTerms = 0;
+    };
+
+    double tau0;
+    std::vector<double> ring;
+    uint64_t ringMask = 0;
+    uint64_t count = 0;
+
+    std::vector<Tau> taus;
+    int workerCount = 0;
+    std::vector<std::thread> workers;
+    std::vector<uint64_t> progress;  // samples processed by each worker
+
+    std::mutex lock;
+    std::condition_variable dataReady;
+    std::condition_variable blockDone;
+    uint64_t published = 0;
+    bool finished = false;
+
+    void publish(bool last);
+    void work(int worker);
+    void process(Tau &t, uint64_t begin, uint64_t end);
+};
+
+#endif // SHIWA_STABILITY_H